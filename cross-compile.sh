@@ -76,17 +76,17 @@ wget http://python.org/ftp/python/2.7.2/python-2.7.2.msi
 7z x python-2.7.2.msi -opython
 7z x python/python -opython
 
-# boost-python
+# boost-python, boost-thread
 wget --trust-server-names=on http://sourceforge.net/projects/boost/files/boost/1.47.0/boost_1_47_0.tar.bz2/download
 tar xf boost_1_47_0.tar.bz2
 cd boost_1_47_0
 echo "using gcc : : $COMPILER : <compileflags>-I$BASE/python <archiver>$ARCHIVER ;" >> tools/build/v2/user-config.jam
 ./bootstrap.sh
-./bjam install -j 3 --prefix=$BASE/boost --with-python toolset=gcc link=static
+./bjam install -j 3 --prefix=$BASE/boost --with-python --with-thread --with-system toolset=gcc link=static
 cd ..
 
 # pyexiv2
 cd $BRANCH
 mkdir -p build
-$COMPILER -o build/libexiv2python.pyd -DBOOST_PYTHON_STATIC_LIB -shared src/exiv2wrapper.cpp src/exiv2wrapper_python.cpp $BASE/exiv2/lib/libexiv2.a $BASE/zlib/lib/libz.a $BASE/libiconv/lib/libiconv.a $BASE/expat/lib/libexpat.a $BASE/boost/lib/libboost_python.a -I$BASE/exiv2/include -I$BASE/python -I$BASE/boost/include -L$BASE/python -lpython27
+$COMPILER -o build/libexiv2python.pyd -DBOOST_PYTHON_STATIC_LIB -DBOOST_THREAD_USE_LIB -shared src/exiv2wrapper.cpp src/exiv2wrapper_python.cpp $BASE/exiv2/lib/libexiv2.a $BASE/zlib/lib/libz.a $BASE/libiconv/lib/libiconv.a $BASE/expat/lib/libexpat.a $BASE/boost/lib/libboost_python.a $BASE/boost/lib/libboost_thread_win32.a $BASE/boost/lib/libboost_system.a -I$BASE/exiv2/include -I$BASE/python -I$BASE/boost/include -L$BASE/python -lpython27
 
@@ -25,9 +25,20 @@
 
 #include "exiv2wrapper.hpp"
 
+#include "exiv2/futils.hpp"
+#include "exiv2/xmpsidecar.hpp"
+
 #include "boost/python/stl_iterator.hpp"
+#include "boost/thread/tss.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <sstream>
 
 // Custom error codes for Exiv2 exceptions
 #define METADATA_NOT_READ 101
@@ -37,6 +48,9 @@
 #define EXISTING_PREFIX 105
 #define BUILTIN_NS 106
 #define NOT_REGISTERED 107
+#define TRANSACTION_IN_PROGRESS 108
+#define NO_TRANSACTION 109
+#define BUFFER_EXPORTED 110
 
 // Custom macros
 #define CHECK_METADATA_READ \
@@ -45,9 +59,326 @@
 namespace exiv2wrapper
 {
 
+// Scoped lock on the mutex of an image, or on the XMP namespace registry, to
+// be taken with the GIL held. If the mutex is not available right away, the
+// GIL is released while waiting for it, so that the thread holding it can
+// re-acquire the GIL without deadlocking.
+template <class Lock>
+class ScopedLock
+{
+public:
+    ScopedLock(boost::shared_mutex& mutex): _lock(mutex, boost::try_to_lock)
+    {
+        if (!_lock.owns_lock())
+        {
+            Py_BEGIN_ALLOW_THREADS
+            _lock.lock();
+            Py_END_ALLOW_THREADS
+        }
+    }
+
+private:
+    Lock _lock;
+};
+
+typedef ScopedLock<boost::shared_lock<boost::shared_mutex> > ReadLock;
+typedef ScopedLock<boost::unique_lock<boost::shared_mutex> > WriteLock;
+
+// Guard libexiv2's global XMP namespace registry. Looking up XMP properties
+// (building keys, serializing XMP packets) takes it shared, registering and
+// unregistering namespaces takes it exclusively, and so does parsing XMP
+// packets that declare namespaces libexiv2 doesn't know yet (see
+// decodeXmpPacket()).
+// The plain locks below are only taken with the GIL released, ReadLock and
+// WriteLock are used instead when it is held: it is never waited for with the
+// GIL held, nor held while waiting for the GIL.
+static boost::shared_mutex xmpRegistryMutex;
+typedef boost::shared_lock<boost::shared_mutex> XmpRegistryReadLock;
+typedef boost::unique_lock<boost::shared_mutex> XmpRegistryWriteLock;
+
+// Information about an XMP property, resolved through the namespace registry
+// once and for all.
+struct XmpPropertyDetails
+{
+    XmpPropertyDetails(const std::string& key);
+
+    Exiv2::XmpKey key;
+    Exiv2::TypeId type;
+    std::string title;
+    std::string description;
+    std::string name;
+    std::string xmpValueType;
+};
+
+XmpPropertyDetails::XmpPropertyDetails(const std::string& key): key(key)
+{
+    type = Exiv2::XmpProperties::propertyType(this->key);
+
+    const char* title = Exiv2::XmpProperties::propertyTitle(this->key);
+    if (title != 0)
+    {
+        this->title = title;
+    }
+
+    const char* description = Exiv2::XmpProperties::propertyDesc(this->key);
+    if (description != 0)
+    {
+        this->description = description;
+    }
+
+    const Exiv2::XmpPropertyInfo* info = Exiv2::XmpProperties::propertyInfo(this->key);
+    if (info != 0)
+    {
+        name = info->name_;
+        xmpValueType = info->xmpValueType_;
+    }
+}
+
+// Process-wide cache of the details of XMP properties, indexed by key.
+// It is emptied whenever the namespace registry is modified, and when it
+// grows too large (keys come from the images read).
+#define XMP_PROPERTY_CACHE_SIZE 4096
+typedef std::map<std::string, boost::shared_ptr<const XmpPropertyDetails> > XmpPropertyCache;
+static XmpPropertyCache xmpPropertyCache;
+static boost::shared_mutex xmpPropertyCacheMutex;
+
+// Return the details of an XMP property.
+// To be called with the namespace registry locked.
+// Throw an exception if the key is invalid.
+static boost::shared_ptr<const XmpPropertyDetails> xmpPropertyDetails(const std::string& key)
+{
+    {
+        boost::shared_lock<boost::shared_mutex> lock(xmpPropertyCacheMutex);
+        XmpPropertyCache::const_iterator i = xmpPropertyCache.find(key);
+        if (i != xmpPropertyCache.end())
+        {
+            return i->second;
+        }
+    }
+
+    boost::shared_ptr<const XmpPropertyDetails> details(new XmpPropertyDetails(key));
+    boost::unique_lock<boost::shared_mutex> lock(xmpPropertyCacheMutex);
+    if (xmpPropertyCache.size() >= XMP_PROPERTY_CACHE_SIZE)
+    {
+        xmpPropertyCache.clear();
+    }
+    xmpPropertyCache[key] = details;
+    return details;
+}
+
+// Return the details of an XMP property, locking the namespace registry with
+// a lock of the given type only if they are not cached yet.
+// Throw an exception if the key is invalid.
+template <class RegistryLock>
+static boost::shared_ptr<const XmpPropertyDetails> cachedXmpPropertyDetails(const std::string& key)
+{
+    {
+        boost::shared_lock<boost::shared_mutex> lock(xmpPropertyCacheMutex);
+        XmpPropertyCache::const_iterator i = xmpPropertyCache.find(key);
+        if (i != xmpPropertyCache.end())
+        {
+            return i->second;
+        }
+    }
+
+    RegistryLock registryLock(xmpRegistryMutex);
+    return xmpPropertyDetails(key);
+}
+
+// Namespaces declared by the XMP packets parsed so far, forgotten when they
+// grow too large (namespaces come from the images read).
+// To be accessed with the namespace registry locked exclusively.
+#define PARSED_XMP_NAMESPACES_SIZE 1024
+static std::set<std::string> parsedXmpNamespaces;
+
+// To be called with the namespace registry locked exclusively.
+static void clearXmpPropertyCache()
+{
+    boost::unique_lock<boost::shared_mutex> lock(xmpPropertyCacheMutex);
+    xmpPropertyCache.clear();
+    parsedXmpNamespaces.clear();
+}
+
+// Find the namespaces declared by an XMP packet. Return false if some
+// declarations may have been missed: the packet is not encoded in UTF-8, or
+// declares namespaces in a way this simple scan doesn't handle.
+static bool xmpPacketNamespaces(const std::string& packet,
+                                std::vector<std::string>& namespaces)
+{
+    if ((packet.find('\0') != std::string::npos) ||
+        (packet.find("<!DOCTYPE") != std::string::npos))
+    {
+        return false;
+    }
+
+    bool complete = true;
+    std::string::size_type position = 0;
+    while ((position = packet.find("xmlns", position)) != std::string::npos)
+    {
+        position += 5;
+        if ((position >= packet.size()) || (packet[position] != ':'))
+        {
+            // A default namespace, or some text.
+            complete = false;
+            continue;
+        }
+        const std::string::size_type equal = packet.find('=', position);
+        if (equal == std::string::npos)
+        {
+            complete = false;
+            break;
+        }
+        const std::string::size_type start =
+            packet.find_first_not_of(" \t\r\n", equal + 1);
+        if ((start == std::string::npos) ||
+            ((packet[start] != '"') && (packet[start] != '\'')))
+        {
+            complete = false;
+            continue;
+        }
+        const std::string::size_type end = packet.find(packet[start], start + 1);
+        if (end == std::string::npos)
+        {
+            complete = false;
+            break;
+        }
+        namespaces.push_back(packet.substr(start + 1, end - start - 1));
+        position = end + 1;
+    }
+    return complete;
+}
+
+// Parsing an XMP packet (XmpParser::decode(), directly or through
+// Image::readMetadata()) registers the namespaces it declares that libexiv2
+// doesn't know yet, so it has to be done with the registry locked
+// exclusively, unless they are all registered already. Once it is parsed, the
+// cache of property details is cleared if the packet declared namespaces that
+// were not seen before.
+static void xmpPacketDecoded(const std::string& packet)
+{
+    std::vector<std::string> namespaces;
+    xmpPacketNamespaces(packet, namespaces);
+    bool unseen = false;
+    for (std::vector<std::string>::const_iterator i = namespaces.begin();
+         i != namespaces.end(); ++i)
+    {
+        if (parsedXmpNamespaces.size() >= PARSED_XMP_NAMESPACES_SIZE)
+        {
+            parsedXmpNamespaces.clear();
+            unseen = true;
+        }
+        if (parsedXmpNamespaces.insert(*i).second)
+        {
+            unseen = true;
+        }
+    }
+    if (unseen)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(xmpPropertyCacheMutex);
+        xmpPropertyCache.clear();
+    }
+}
+
+// Return whether parsing an XMP packet leaves the namespace registry
+// untouched, that is whether all the namespaces it declares are registered.
+// To be called with the namespace registry locked.
+static bool xmpNamespacesRegistered(const std::string& packet)
+{
+    std::vector<std::string> namespaces;
+    if (!xmpPacketNamespaces(packet, namespaces))
+    {
+        return false;
+    }
+    for (std::vector<std::string>::const_iterator i = namespaces.begin();
+         i != namespaces.end(); ++i)
+    {
+        // The syntax namespaces are not registered, and never need to be.
+        if ((*i == "adobe:ns:meta/") ||
+            (*i == "http://www.w3.org/1999/02/22-rdf-syntax-ns#"))
+        {
+            continue;
+        }
+        if (i->empty() || Exiv2::XmpProperties::prefix(*i).empty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse an XMP packet, with the namespace registry locked shared if it only
+// declares registered namespaces, and exclusively otherwise. The types of the
+// locks depend on whether the GIL is held.
+template <class RegistryReadLock, class RegistryWriteLock>
+static int decodeXmpPacket(Exiv2::XmpData& xmpData, const std::string& packet)
+{
+    {
+        RegistryReadLock registryLock(xmpRegistryMutex);
+        if (xmpNamespacesRegistered(packet))
+        {
+            return Exiv2::XmpParser::decode(xmpData, packet);
+        }
+    }
+
+    RegistryWriteLock registryLock(xmpRegistryMutex);
+    const int result = Exiv2::XmpParser::decode(xmpData, packet);
+    xmpPacketDecoded(packet);
+    return result;
+}
+
+// Read the metadata of an image. libexiv2 parses the XMP packet embedded in
+// the image while reading it, so the namespaces it declares can't be checked
+// beforehand: the registry is locked exclusively, unless the format of the
+// image doesn't support XMP at all.
+// To be called with the GIL released.
+static void readImageMetadata(Exiv2::Image& image)
+{
+    if (!image.supportsMetadata(Exiv2::mdXmp))
+    {
+        image.readMetadata();
+        return;
+    }
+
+    XmpRegistryWriteLock registryLock(xmpRegistryMutex);
+    image.readMetadata();
+    xmpPacketDecoded(image.xmpPacket());
+}
+
+// Return the datum for a key, adding it if needed (like XmpData::operator[],
+// without resolving the key again).
+static Exiv2::Xmpdatum& findOrAddXmpDatum(Exiv2::XmpData& xmpData,
+                                          const Exiv2::XmpKey& key)
+{
+    Exiv2::XmpMetadata::iterator i = xmpData.findKey(key);
+    if (i == xmpData.end())
+    {
+        xmpData.add(Exiv2::Xmpdatum(key));
+        i = xmpData.findKey(key);
+    }
+    return *i;
+}
+
 void Image::_instantiate_image()
 {
     _exifThumbnail = 0;
+    _savedExifData = 0;
+    _savedIptcData = 0;
+    _savedXmpData = 0;
+    _pixelWidth = 0;
+    _pixelHeight = 0;
+    _image = _open();
+    _dataRead = false;
+    _xmpModified = false;
+    _xmpPacketPending = false;
+    _xmpFromSidecar = false;
+    _iptcCharsetValid = false;
+    _generation = 0;
+    _exports = 0;
+}
+
+boost::shared_ptr<Exiv2::Image> Image::_open() const
+{
+    Exiv2::Image::AutoPtr image;
 
     // If an exception is thrown, it has to be done outside of the
     // Py_{BEGIN,END}_ALLOW_THREADS block.
@@ -59,13 +390,13 @@ void Image::_instantiate_image()
 
     try
     {
-        if (_data != 0)
+        if (_data)
         {
-            _image = Exiv2::ImageFactory::open(_data, _size);
+            image = Exiv2::ImageFactory::open(_data.get(), _size);
         }
         else
         {
-            _image = Exiv2::ImageFactory::open(_filename);
+            image = Exiv2::ImageFactory::open(_filename);
         }
     }
     catch (Exiv2::Error& err)
@@ -76,22 +407,59 @@ void Image::_instantiate_image()
     // Re-acquire the GIL
     Py_END_ALLOW_THREADS
 
-    if (error.code() == 0)
+    if (error.code() != 0)
+    {
+        throw error;
+    }
+
+    assert(image.get() != 0);
+    return boost::shared_ptr<Exiv2::Image>(image.release());
+}
+
+void Image::_checkExports() const
+{
+    if (_exports > 0)
     {
-        assert(_image.get() != 0);
-        _dataRead = false;
+        throw Exiv2::Error(BUFFER_EXPORTED);
     }
-    else
+}
+
+void Image::_detach()
+{
+    if (_image.unique())
     {
-        throw error;
+        return;
     }
+    // The exported buffers point into the shared metadata.
+    _checkExports();
+
+    // The underlying image is shared with clones: open the image again and
+    // give it a private copy of the metadata, without parsing it again.
+    boost::shared_ptr<Exiv2::Image> image = _open();
+    image->setByteOrder(_image->byteOrder());
+    if (_dataRead)
+    {
+        image->setExifData(*_exifData);
+        image->setIptcData(*_iptcData);
+        image->setXmpData(*_xmpData);
+        image->xmpPacket() = _image->xmpPacket();
+        image->setComment(_image->comment());
+    }
+    _image = image;
+    _exifData = &_image->exifData();
+    _iptcData = &_image->iptcData();
+    _xmpData = &_image->xmpData();
+    ++_generation;
+
+    // The thumbnail refers to the previous EXIF data.
+    delete _exifThumbnail;
+    _exifThumbnail = 0;
 }
 
 // Base constructor
 Image::Image(const std::string& filename)
 {
     _filename = filename;
-    _data = 0;
     _instantiate_image();
 }
 
@@ -99,7 +467,7 @@ Image::Image(const std::string& filename)
 Image::Image(const std::string& buffer, unsigned long size)
 {
     // Deep copy of the data buffer
-    _data = new Exiv2::byte[size];
+    _data.reset(new Exiv2::byte[size]);
     for (unsigned long i = 0; i < size; ++i)
     {
         _data[i] = buffer[i];
@@ -116,20 +484,81 @@ Image::Image(const Image& image)
     _instantiate_image();
 }
 
+// Copy on write constructor
+Image::Image(const Image& image,
+             const boost::shared_ptr<Exiv2::Image>& shared)
+{
+    _filename = image._filename;
+    _data = image._data;
+    _size = image._size;
+    _image = shared;
+    _exifData = image._exifData;
+    _iptcData = image._iptcData;
+    _xmpData = image._xmpData;
+    _pixelWidth = image._pixelWidth;
+    _pixelHeight = image._pixelHeight;
+    _dataRead = image._dataRead;
+    _xmpModified = image._xmpModified;
+    _xmpPacketPending = image._xmpPacketPending;
+    _xmpFromSidecar = image._xmpFromSidecar;
+    _embeddedXmpPacket = image._embeddedXmpPacket;
+    _iptcCharset = image._iptcCharset;
+    _iptcCharsetValid = image._iptcCharsetValid;
+    _generation = 0;
+    _exports = 0;
+    _exifThumbnail = 0;
+    _savedExifData = 0;
+    _savedIptcData = 0;
+    _savedXmpData = 0;
+}
+
 Image::~Image()
 {
-    if (_data != 0)
-    {
-        delete[] _data;
-    }
     if (_exifThumbnail != 0)
     {
         delete _exifThumbnail;
     }
+    _endTransaction();
+}
+
+Image* Image::clone()
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _checkExports();
+    // The tags already bound to the image would modify the metadata shared
+    // with the clone: have them detach it first (see ExifTag::_revalidate()).
+    ++_generation;
+    return new Image(*this, _image);
+}
+
+ImageSnapshot Image::snapshot()
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _checkExports();
+    if (_xmpPacketPending)
+    {
+        _decodeXmpPacket();
+    }
+    // As for clones, the tags already bound to the image would modify the
+    // metadata shared with the snapshot: have them detach it first.
+    ++_generation;
+    return ImageSnapshot(_image);
 }
 
 void Image::readMetadata()
 {
+    WriteLock lock(_mutex);
+    _checkExports();
+    if (!_image.unique())
+    {
+        // Do not re-read the metadata shared with clones.
+        delete _exifThumbnail;
+        _exifThumbnail = 0;
+        _image = _open();
+    }
+
     // If an exception is thrown, it has to be done outside of the
     // Py_{BEGIN,END}_ALLOW_THREADS block.
     Exiv2::Error error(0);
@@ -138,13 +567,24 @@ void Image::readMetadata()
     // while reading metadata.
     Py_BEGIN_ALLOW_THREADS
 
+    // Re-reading the metadata discards any transaction in progress.
+    _endTransaction();
+
     try
     {
-        _image->readMetadata();
+        readImageMetadata(*_image);
         _exifData = &_image->exifData();
         _iptcData = &_image->iptcData();
         _xmpData = &_image->xmpData();
+        _pixelWidth = _image->pixelWidth();
+        _pixelHeight = _image->pixelHeight();
         _dataRead = true;
+        _xmpModified = false;
+        _xmpPacketPending = false;
+        _xmpFromSidecar = false;
+        _embeddedXmpPacket.clear();
+        _iptcCharsetValid = false;
+        ++_generation;
     }
     catch (Exiv2::Error& err)
     {
@@ -160,9 +600,22 @@ void Image::readMetadata()
     }
 }
 
-void Image::writeMetadata()
+void Image::writeMetadata(int xmpFormat, unsigned int xmpPadding)
 {
+    WriteLock lock(_mutex);
     CHECK_METADATA_READ
+    // libexiv2 may erase EXIF tags when encoding the EXIF data.
+    _checkExports();
+    _detach();
+#if EXIV2_TEST_VERSION(0,22,0)
+    if (xmpFormat >= 0)
+    {
+        _decodeXmpPacket();
+    }
+#else
+    // libexiv2 always serializes the XMP data.
+    _decodeXmpPacket();
+#endif
 
     // If an exception is thrown, it has to be done outside of the
     // Py_{BEGIN,END}_ALLOW_THREADS block.
@@ -174,7 +627,64 @@ void Image::writeMetadata()
 
     try
     {
+#if EXIV2_TEST_VERSION(0,22,0)
+        XmpRegistryReadLock registryLock(xmpRegistryMutex);
+        if (_xmpFromSidecar)
+        {
+            // The XMP data merged with a sidecar is only written back to the
+            // sidecar, leave the packet embedded in the image as it was.
+            _image->xmpPacket() = _embeddedXmpPacket;
+            _image->writeXmpFromPacket(true);
+        }
+        else if (xmpFormat >= 0)
+        {
+            // Serialize the XMP data with the requested layout and have
+            // libexiv2 write the resulting packet as is.
+            std::string packet;
+            if (!_xmpData->empty() &&
+                (Exiv2::XmpParser::encode(packet, *_xmpData,
+                                          xmpFormat, xmpPadding) > 1))
+            {
+                throw Exiv2::Error(INVALID_VALUE);
+            }
+            _image->xmpPacket() = packet;
+            _image->writeXmpFromPacket(true);
+        }
+        else
+        {
+            // Skip the serialization of XMP data that wasn't modified.
+            _image->writeXmpFromPacket(!_xmpModified);
+        }
         _image->writeMetadata();
+#else
+        if (_xmpFromSidecar)
+        {
+            // libexiv2 always serializes the XMP data: swap the embedded data
+            // in for the time of the write.
+            Exiv2::XmpData embedded;
+            decodeXmpPacket<XmpRegistryReadLock, XmpRegistryWriteLock>(
+                embedded, _embeddedXmpPacket);
+            Exiv2::XmpData merged(*_xmpData);
+            *_xmpData = embedded;
+            XmpRegistryReadLock registryLock(xmpRegistryMutex);
+            try
+            {
+                _image->writeMetadata();
+            }
+            catch (Exiv2::Error&)
+            {
+                *_xmpData = merged;
+                throw;
+            }
+            *_xmpData = merged;
+            ++_generation;
+        }
+        else
+        {
+            XmpRegistryReadLock registryLock(xmpRegistryMutex);
+            _image->writeMetadata();
+        }
+#endif
     }
     catch (Exiv2::Error& err)
     {
@@ -192,24 +702,28 @@ void Image::writeMetadata()
 
 unsigned int Image::pixelWidth() const
 {
+    ReadLock lock(_mutex);
     CHECK_METADATA_READ
-    return _image->pixelWidth();
+    return _pixelWidth;
 }
 
 unsigned int Image::pixelHeight() const
 {
+    ReadLock lock(_mutex);
     CHECK_METADATA_READ
-    return _image->pixelHeight();
+    return _pixelHeight;
 }
 
 std::string Image::mimeType() const
 {
+    ReadLock lock(_mutex);
     CHECK_METADATA_READ
     return _image->mimeType();
 }
 
 boost::python::list Image::exifKeys()
 {
+    ReadLock lock(_mutex);
     CHECK_METADATA_READ
 
     boost::python::list keys;
@@ -224,21 +738,34 @@ boost::python::list Image::exifKeys()
 
 const ExifTag Image::getExifTag(std::string key)
 {
+    ReadLock lock(_mutex);
     CHECK_METADATA_READ
 
     Exiv2::ExifKey exifKey = Exiv2::ExifKey(key);
+    Exiv2::ExifMetadata::iterator datum = _exifData->findKey(exifKey);
 
-    if(_exifData->findKey(exifKey) == _exifData->end())
+    if(datum == _exifData->end())
     {
         throw Exiv2::Error(KEY_NOT_FOUND, key);
     }
 
-    return ExifTag(key, &(*_exifData)[key], _exifData, _image->byteOrder());
+    // The metadata may be shared with clones: the tag detaches it before it
+    // first modifies the datum (see ExifTag::_revalidate()).
+    return ExifTag(key, &(*datum), _exifData, _image->byteOrder(),
+                   false, this);
 }
 
 void Image::deleteExifTag(std::string key)
+{
+    WriteLock lock(_mutex);
+    _deleteExifTag(key);
+}
+
+void Image::_deleteExifTag(const std::string& key)
 {
     CHECK_METADATA_READ
+    _checkExports();
+    _detach();
 
     Exiv2::ExifKey exifKey = Exiv2::ExifKey(key);
     Exiv2::ExifMetadata::iterator datum = _exifData->findKey(exifKey);
@@ -248,10 +775,12 @@ void Image::deleteExifTag(std::string key)
     }
 
     _exifData->erase(datum);
+    ++_generation;
 }
 
 boost::python::list Image::iptcKeys()
 {
+    ReadLock lock(_mutex);
     CHECK_METADATA_READ
 
     boost::python::list keys;
@@ -271,6 +800,7 @@ boost::python::list Image::iptcKeys()
 
 const IptcTag Image::getIptcTag(std::string key)
 {
+    ReadLock lock(_mutex);
     CHECK_METADATA_READ
 
     Exiv2::IptcKey iptcKey = Exiv2::IptcKey(key);
@@ -280,12 +810,20 @@ const IptcTag Image::getIptcTag(std::string key)
         throw Exiv2::Error(KEY_NOT_FOUND, key);
     }
 
-    return IptcTag(key, _iptcData);
+    // As for EXIF tags, the data is detached before it is first modified.
+    return IptcTag(key, _iptcData, false, this);
 }
 
 void Image::deleteIptcTag(std::string key)
+{
+    WriteLock lock(_mutex);
+    _deleteIptcTag(key);
+}
+
+void Image::_deleteIptcTag(const std::string& key)
 {
     CHECK_METADATA_READ
+    _detach();
 
     Exiv2::IptcKey iptcKey = Exiv2::IptcKey(key);
     Exiv2::IptcMetadata::iterator dataIterator = _iptcData->findKey(iptcKey);
@@ -295,6 +833,8 @@ void Image::deleteIptcTag(std::string key)
         throw Exiv2::Error(KEY_NOT_FOUND, key);
     }
 
+    _iptcCharsetValid = false;
+    ++_generation;
     while (dataIterator != _iptcData->end())
     {
         if (dataIterator->key() == key)
@@ -310,8 +850,22 @@ void Image::deleteIptcTag(std::string key)
 
 boost::python::list Image::xmpKeys()
 {
-    CHECK_METADATA_READ
+    {
+        ReadLock lock(_mutex);
+        CHECK_METADATA_READ
+        if (!_xmpPacketPending)
+        {
+            return _xmpKeys();
+        }
+    }
 
+    WriteLock lock(_mutex);
+    _decodeXmpPacket();
+    return _xmpKeys();
+}
+
+boost::python::list Image::_xmpKeys() const
+{
     boost::python::list keys;
     for(Exiv2::XmpMetadata::iterator i = _xmpData->begin();
         i != _xmpData->end();
@@ -324,396 +878,2537 @@ boost::python::list Image::xmpKeys()
 
 const XmpTag Image::getXmpTag(std::string key)
 {
-    CHECK_METADATA_READ
+    {
+        ReadLock lock(_mutex);
+        CHECK_METADATA_READ
+        if (!_xmpPacketPending)
+        {
+            return _getXmpTag(key);
+        }
+    }
 
-    Exiv2::XmpKey xmpKey = Exiv2::XmpKey(key);
+    WriteLock lock(_mutex);
+    _decodeXmpPacket();
+    return _getXmpTag(key);
+}
 
-    if(_xmpData->findKey(xmpKey) == _xmpData->end())
+const XmpTag Image::_getXmpTag(const std::string& key)
+{
+    Exiv2::Xmpdatum* datum;
     {
-        throw Exiv2::Error(KEY_NOT_FOUND, key);
+        Exiv2::XmpMetadata::iterator i = _xmpData->findKey(
+            cachedXmpPropertyDetails<ReadLock>(key)->key);
+        if(i == _xmpData->end())
+        {
+            throw Exiv2::Error(KEY_NOT_FOUND, key);
+        }
+        datum = &(*i);
     }
 
-    return XmpTag(key, &(*_xmpData)[key]);
+    // The metadata may be shared with clones: the tag detaches it, and flags
+    // the XMP data as modified, before it first modifies the datum (see
+    // XmpTag::_revalidate()).
+    return XmpTag(key, datum, false, this);
 }
 
 void Image::deleteXmpTag(std::string key)
+{
+    WriteLock lock(_mutex);
+    _deleteXmpTag(key);
+}
+
+void Image::_deleteXmpTag(const std::string& key)
 {
     CHECK_METADATA_READ
+    _decodeXmpPacket();
 
-    Exiv2::XmpKey xmpKey = Exiv2::XmpKey(key);
-    Exiv2::XmpMetadata::iterator i = _xmpData->findKey(xmpKey);
+    Exiv2::XmpMetadata::iterator i = _xmpData->findKey(
+        cachedXmpPropertyDetails<ReadLock>(key)->key);
     if(i != _xmpData->end())
     {
         _xmpData->erase(i);
+        _xmpModified = true;
+        ++_generation;
     }
     else
         throw Exiv2::Error(KEY_NOT_FOUND, key);
 }
 
-const std::string Image::getComment() const
+// Whether an XMP key is the one of a structure or of one of its members.
+static bool inXmpStruct(const std::string& key, const std::string& root)
 {
-    CHECK_METADATA_READ
-    return _image->comment();
+    return (key.compare(0, root.size(), root) == 0) &&
+           ((key.size() == root.size()) ||
+            (key[root.size()] == '/') || (key[root.size()] == '['));
 }
 
-void Image::setComment(const std::string& comment)
+static Exiv2::XmpValue::XmpArrayType xmpArrayType(Exiv2::TypeId type)
 {
-    CHECK_METADATA_READ
-    _image->setComment(comment);
+    switch (type)
+    {
+        case Exiv2::xmpAlt:
+            return Exiv2::XmpValue::xaAlt;
+        case Exiv2::xmpSeq:
+            return Exiv2::XmpValue::xaSeq;
+        default:
+            return Exiv2::XmpValue::xaBag;
+    }
 }
 
-void Image::clearComment()
+static Exiv2::TypeId xmpArrayTypeId(Exiv2::XmpValue::XmpArrayType type)
 {
-    CHECK_METADATA_READ
-    _image->clearComment();
+    switch (type)
+    {
+        case Exiv2::XmpValue::xaAlt:
+            return Exiv2::xmpAlt;
+        case Exiv2::XmpValue::xaSeq:
+            return Exiv2::xmpSeq;
+        default:
+            return Exiv2::xmpBag;
+    }
 }
 
-
-boost::python::list Image::previews()
+// Return the array type of a datum if it is the container of an array of
+// structures or of arrays, invalidTypeId otherwise.
+static Exiv2::TypeId xmpContainerArrayType(const Exiv2::Xmpdatum& datum)
 {
-    CHECK_METADATA_READ
-
-    boost::python::list previews;
-    Exiv2::PreviewManager pm(*_image);
-    Exiv2::PreviewPropertiesList props = pm.getPreviewProperties();
-    for (Exiv2::PreviewPropertiesList::const_iterator i = props.begin();
-         i != props.end();
-         ++i)
+    if (datum.typeId() == Exiv2::xmpText)
     {
-        previews.append(Preview(pm.getPreviewImage(*i)));
+        const Exiv2::XmpValue& value =
+            dynamic_cast<const Exiv2::XmpValue&>(datum.value());
+        if (value.xmpArrayType() != Exiv2::XmpValue::xaNone)
+        {
+            return xmpArrayTypeId(value.xmpArrayType());
+        }
     }
-
-    return previews;
+    return Exiv2::invalidTypeId;
 }
 
-void Image::copyMetadata(Image& other, bool exif, bool iptc, bool xmp) const
+static bool isXmpStructContainer(const Exiv2::Xmpdatum& datum)
 {
-    CHECK_METADATA_READ
-    if (!other._dataRead) throw Exiv2::Error(METADATA_NOT_READ);
-
-    if (exif)
-        other._image->setExifData(*_exifData);
-    if (iptc)
-        other._image->setIptcData(*_iptcData);
-    if (xmp)
-        other._image->setXmpData(*_xmpData);
+    return (datum.typeId() == Exiv2::xmpText) &&
+           (dynamic_cast<const Exiv2::XmpValue&>(datum.value()).xmpStruct() ==
+            Exiv2::XmpValue::xsStruct);
 }
 
-std::string Image::getDataBuffer() const
+// Return the Python representation of a datum of a structure.
+static boost::python::object xmpStructValue(const Exiv2::Xmpdatum& datum)
 {
-    std::string buffer;
-
-    // Release the GIL to allow other python threads to run
-    // while reading the image data.
-    Py_BEGIN_ALLOW_THREADS
-
-    Exiv2::BasicIo& io = _image->io();
-    unsigned long size = io.size();
-    long pos = -1;
-
-    if (io.isopen())
+    if (isXmpStructContainer(datum))
     {
-        // Remember the current position in the stream
+        return boost::python::dict();
+    }
+    if (xmpContainerArrayType(datum) != Exiv2::invalidTypeId)
+    {
+        return boost::python::list();
+    }
+
+    switch (datum.typeId())
+    {
+        case Exiv2::xmpAlt:
+        case Exiv2::xmpBag:
+        case Exiv2::xmpSeq:
+        {
+            const std::vector<std::string>& value =
+                dynamic_cast<const Exiv2::XmpArrayValue&>(datum.value()).value_;
+            boost::python::list rvalue;
+            for(std::vector<std::string>::const_iterator i = value.begin();
+                i != value.end(); ++i)
+            {
+                rvalue.append(*i);
+            }
+            return rvalue;
+        }
+        case Exiv2::langAlt:
+        {
+            const Exiv2::LangAltValue::ValueType& value =
+                dynamic_cast<const Exiv2::LangAltValue&>(datum.value()).value_;
+            boost::python::dict rvalue;
+            for (Exiv2::LangAltValue::ValueType::const_iterator i = value.begin();
+                 i != value.end(); ++i)
+            {
+                rvalue[i->first] = i->second;
+            }
+            return rvalue;
+        }
+        default:
+            return boost::python::str(datum.toString());
+    }
+}
+
+// Return the child of a node of a structure for a path segment ("/ns:name"
+// for a field, "[n]" for an array item), setting it to value if it is not
+// set yet.
+static boost::python::object xmpStructChild(const boost::python::object& node,
+                                            const std::string& segment,
+                                            const boost::python::object& value)
+{
+    const std::string name = segment.substr(1);
+    if (segment[0] == '[')
+    {
+        boost::python::list items = boost::python::extract<boost::python::list>(node);
+        const long index = std::atol(name.c_str()) - 1;
+        if (index < 0)
+        {
+            throw Exiv2::Error(INVALID_VALUE);
+        }
+        while (boost::python::len(items) <= index)
+        {
+            items.append(boost::python::object());
+        }
+        boost::python::object item = items[index];
+        if (item.ptr() == Py_None)
+        {
+            items[index] = value;
+            item = value;
+        }
+        return item;
+    }
+    else
+    {
+        boost::python::dict fields = boost::python::extract<boost::python::dict>(node);
+        if (!fields.has_key(name))
+        {
+            fields[name] = value;
+        }
+        return fields[name];
+    }
+}
+
+// Split the path of a datum relative to the structure it belongs to into
+// segments.
+static std::vector<std::string> xmpStructPath(const std::string& path)
+{
+    std::vector<std::string> segments;
+    std::string::size_type start = 0;
+    while (start < path.size())
+    {
+        std::string::size_type end = path.find_first_of("/[", start + 1);
+        if (path[start] == '[')
+        {
+            end = path.find(']', start);
+            if (end == std::string::npos)
+            {
+                throw Exiv2::Error(INVALID_VALUE);
+            }
+            segments.push_back(path.substr(start, end - start));
+            ++end;
+        }
+        else
+        {
+            segments.push_back(path.substr(start, end - start));
+        }
+        start = end;
+    }
+    return segments;
+}
+
+boost::python::object Image::getXmpStruct(std::string key)
+{
+    {
+        ReadLock lock(_mutex);
+        CHECK_METADATA_READ
+        if (!_xmpPacketPending)
+        {
+            return _getXmpStruct(key);
+        }
+    }
+
+    WriteLock lock(_mutex);
+    _decodeXmpPacket();
+    return _getXmpStruct(key);
+}
+
+boost::python::object Image::_getXmpStruct(const std::string& key) const
+{
+    const std::string root = cachedXmpPropertyDetails<ReadLock>(key)->key.key();
+
+    boost::python::object rvalue;
+    bool found = false;
+    for(Exiv2::XmpMetadata::const_iterator i = _xmpData->begin();
+        i != _xmpData->end(); ++i)
+    {
+        const std::string datumKey = i->key();
+        if (!inXmpStruct(datumKey, root))
+        {
+            continue;
+        }
+        const std::vector<std::string> segments =
+            xmpStructPath(datumKey.substr(root.size()));
+        if (segments.empty())
+        {
+            rvalue = xmpStructValue(*i);
+            found = true;
+            continue;
+        }
+        if (!found)
+        {
+            if (segments[0][0] == '[')
+                rvalue = boost::python::list();
+            else
+                rvalue = boost::python::dict();
+            found = true;
+        }
+
+        boost::python::object node = rvalue;
+        for (std::vector<std::string>::size_type j = 0; j < segments.size() - 1; ++j)
+        {
+            if (segments[j + 1][0] == '[')
+                node = xmpStructChild(node, segments[j], boost::python::list());
+            else
+                node = xmpStructChild(node, segments[j], boost::python::dict());
+        }
+        xmpStructChild(node, segments.back(), xmpStructValue(*i));
+    }
+
+    if (!found)
+    {
+        throw Exiv2::Error(KEY_NOT_FOUND, key);
+    }
+    return rvalue;
+}
+
+// Add the data for a structure (or any part of it) to xmpData. arrayTypes
+// holds the types of the arrays it previously contained, by key.
+// To be called with the XMP namespace registry locked.
+static void addXmpStruct(Exiv2::XmpData& xmpData,
+                         const std::string& key,
+                         const boost::python::object& value,
+                         const std::map<std::string, Exiv2::TypeId>& arrayTypes)
+{
+    std::map<std::string, Exiv2::TypeId>::const_iterator arrayType =
+        arrayTypes.find(key);
+
+    boost::python::extract<std::string> text(value);
+    if (text.check())
+    {
+        Exiv2::XmpTextValue datum(text());
+        xmpData.add(Exiv2::XmpKey(key), &datum);
+        return;
+    }
+
+    boost::python::extract<boost::python::dict> fields(value);
+    if (fields.check())
+    {
+        boost::python::list names = fields().keys();
+        bool langAlt = (boost::python::len(names) > 0);
+        for(boost::python::stl_input_iterator<std::string> iterator(names);
+            iterator != boost::python::stl_input_iterator<std::string>();
+            ++iterator)
+        {
+            langAlt = langAlt && ((*iterator).find(':') == std::string::npos);
+        }
+
+        if (langAlt)
+        {
+            Exiv2::LangAltValue datum;
+            for(boost::python::stl_input_iterator<std::string> iterator(names);
+                iterator != boost::python::stl_input_iterator<std::string>();
+                ++iterator)
+            {
+                boost::python::extract<std::string> alternative(fields().get(*iterator));
+                if (!alternative.check())
+                {
+                    throw Exiv2::Error(INVALID_VALUE);
+                }
+                datum.read("lang=\"" + *iterator + "\" " + alternative());
+            }
+            xmpData.add(Exiv2::XmpKey(key), &datum);
+            return;
+        }
+
+        Exiv2::XmpTextValue datum;
+        datum.setXmpStruct();
+        xmpData.add(Exiv2::XmpKey(key), &datum);
+        for(boost::python::stl_input_iterator<std::string> iterator(names);
+            iterator != boost::python::stl_input_iterator<std::string>();
+            ++iterator)
+        {
+            addXmpStruct(xmpData, key + "/" + *iterator,
+                         fields().get(*iterator), arrayTypes);
+        }
+        return;
+    }
+
+    boost::python::extract<boost::python::list> items(value);
+    if (items.check())
+    {
+        const Exiv2::TypeId type = (arrayType != arrayTypes.end()) ?
+                                   arrayType->second : Exiv2::xmpBag;
+        const long count = boost::python::len(items());
+        bool simple = true;
+        for (long i = 0; i < count; ++i)
+        {
+            simple = simple &&
+                     boost::python::extract<std::string>(items()[i]).check();
+        }
+
+        if (simple)
+        {
+            Exiv2::XmpArrayValue datum(type);
+            for (long i = 0; i < count; ++i)
+            {
+                datum.read(boost::python::extract<std::string>(items()[i]));
+            }
+            xmpData.add(Exiv2::XmpKey(key), &datum);
+            return;
+        }
+
+        Exiv2::XmpTextValue datum;
+        datum.setXmpArrayType(xmpArrayType(type));
+        xmpData.add(Exiv2::XmpKey(key), &datum);
+        for (long i = 0; i < count; ++i)
+        {
+            std::ostringstream item;
+            item << key << "[" << (i + 1) << "]";
+            addXmpStruct(xmpData, item.str(), items()[i], arrayTypes);
+        }
+        return;
+    }
+
+    throw Exiv2::Error(INVALID_VALUE);
+}
+
+void Image::setXmpStruct(std::string key, const boost::python::object& value)
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _decodeXmpPacket();
+
+    ReadLock registryLock(xmpRegistryMutex);
+    boost::shared_ptr<const XmpPropertyDetails> details = xmpPropertyDetails(key);
+    const std::string root = details->key.key();
+
+    // Keep the types of the arrays being replaced.
+    std::map<std::string, Exiv2::TypeId> arrayTypes;
+    if ((details->type == Exiv2::xmpAlt) || (details->type == Exiv2::xmpBag) ||
+        (details->type == Exiv2::xmpSeq))
+    {
+        arrayTypes[root] = details->type;
+    }
+    for(Exiv2::XmpMetadata::const_iterator i = _xmpData->begin();
+        i != _xmpData->end(); ++i)
+    {
+        const std::string datumKey = i->key();
+        if (inXmpStruct(datumKey, root))
+        {
+            Exiv2::TypeId type = xmpContainerArrayType(*i);
+            if ((type == Exiv2::invalidTypeId) &&
+                ((i->typeId() == Exiv2::xmpAlt) ||
+                 (i->typeId() == Exiv2::xmpBag) ||
+                 (i->typeId() == Exiv2::xmpSeq)))
+            {
+                type = i->typeId();
+            }
+            if (type != Exiv2::invalidTypeId)
+            {
+                arrayTypes[datumKey] = type;
+            }
+        }
+    }
+
+    // Build the new structure before erasing the old one, so that it is left
+    // untouched if the value is invalid.
+    Exiv2::XmpData xmpData;
+    addXmpStruct(xmpData, root, value, arrayTypes);
+
+    Exiv2::XmpMetadata::iterator i = _xmpData->begin();
+    while (i != _xmpData->end())
+    {
+        if (inXmpStruct(i->key(), root))
+            i = _xmpData->erase(i);
+        else
+            ++i;
+    }
+    for(Exiv2::XmpMetadata::const_iterator j = xmpData.begin();
+        j != xmpData.end(); ++j)
+    {
+        _xmpData->add(*j);
+    }
+    _xmpModified = true;
+    ++_generation;
+}
+
+const std::string Image::getXmpPacket() const
+{
+    ReadLock lock(_mutex);
+    CHECK_METADATA_READ
+
+    if (!_xmpModified)
+    {
+        return _image->xmpPacket();
+    }
+
+    std::string packet;
+    ReadLock registryLock(xmpRegistryMutex);
+    if (Exiv2::XmpParser::encode(packet, *_xmpData) > 1)
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+    return packet;
+}
+
+void Image::setXmpPacket(const std::string& packet, bool check)
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _detach();
+
+    if (check)
+    {
+        Exiv2::XmpData xmpData;
+        if (decodeXmpPacket<ReadLock, WriteLock>(xmpData, packet) != 0)
+        {
+            throw Exiv2::Error(INVALID_VALUE);
+        }
+        *_xmpData = xmpData;
+        _xmpPacketPending = false;
+    }
+    else
+    {
+        _xmpPacketPending = true;
+    }
+
+    // Assign the packet directly: Image::setXmpPacket() parses it in recent
+    // versions of libexiv2.
+    _image->xmpPacket() = packet;
+    _xmpModified = false;
+    // Either way the XMP data is replaced, and the tags bound to the image
+    // have to flag it as modified again before writing to it.
+    ++_generation;
+}
+
+void Image::_decodeXmpPacket()
+{
+    _detach();
+    if (!_xmpPacketPending)
+    {
+        return;
+    }
+
+    // Decode into a temporary container so that a malformed packet leaves the
+    // current XMP metadata untouched and still pending, and every subsequent
+    // access keeps raising the error instead of seeing partial data.
+    Exiv2::XmpData xmpData;
+    if (decodeXmpPacket<ReadLock, WriteLock>(xmpData, _image->xmpPacket()) != 0)
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+    *_xmpData = xmpData;
+    _xmpPacketPending = false;
+    ++_generation;
+}
+
+// Return the key of the top-level property an XMP key belongs to.
+static std::string xmpPropertyKey(const std::string& key)
+{
+    return key.substr(0, key.find_first_of("/["));
+}
+
+void Image::readSidecar(const std::string& path, bool sidecarWins)
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _decodeXmpPacket();
+
+    // If an exception is thrown, it has to be done outside of the
+    // Py_{BEGIN,END}_ALLOW_THREADS block.
+    Exiv2::Error error(0);
+    Exiv2::XmpData sidecarData;
+
+    // Release the GIL to allow other python threads to run
+    // while reading the sidecar.
+    Py_BEGIN_ALLOW_THREADS
+
+    try
+    {
+        Exiv2::Image::AutoPtr sidecar = Exiv2::ImageFactory::open(path);
+        assert(sidecar.get() != 0);
+        if (sidecar->mimeType() == "application/rdf+xml")
+        {
+            // Read the packet and parse it here rather than through
+            // XmpSidecar::readMetadata(), to only lock the registry
+            // exclusively if it declares new namespaces. As libexiv2 does, a
+            // malformed packet is taken for an empty one.
+            Exiv2::BasicIo& io = sidecar->io();
+            if (io.open() != 0)
+            {
+                throw Exiv2::Error(9, io.path(), Exiv2::strError());
+            }
+            Exiv2::DataBuf buffer = io.read(io.size());
+            io.close();
+            const std::string packet(reinterpret_cast<const char*>(buffer.pData_),
+                                     buffer.size_);
+            if (decodeXmpPacket<XmpRegistryReadLock, XmpRegistryWriteLock>(
+                    sidecarData, packet) != 0)
+            {
+                sidecarData.clear();
+            }
+        }
+        else
+        {
+            readImageMetadata(*sidecar);
+            sidecarData = sidecar->xmpData();
+        }
+    }
+    catch (Exiv2::Error& err)
+    {
+        error = err;
+    }
+
+    // Re-acquire the GIL
+    Py_END_ALLOW_THREADS
+
+    if (error.code() != 0)
+    {
+        throw error;
+    }
+
+    if (!_xmpFromSidecar)
+    {
+        // Keep the XMP packet embedded in the image, to write it back as is.
+        if (!_xmpModified)
+        {
+            _embeddedXmpPacket = _image->xmpPacket();
+        }
+        else
+        {
+            ReadLock registryLock(xmpRegistryMutex);
+            if (Exiv2::XmpParser::encode(_embeddedXmpPacket, *_xmpData) > 1)
+            {
+                throw Exiv2::Error(INVALID_VALUE);
+            }
+        }
+        _xmpFromSidecar = true;
+    }
+
+    // The properties that take precedence
+    std::set<std::string> properties;
+    const Exiv2::XmpData& preferred = sidecarWins ? sidecarData : *_xmpData;
+    for(Exiv2::XmpMetadata::const_iterator i = preferred.begin();
+        i != preferred.end(); ++i)
+    {
+        properties.insert(xmpPropertyKey(i->key()));
+    }
+
+    if (sidecarWins)
+    {
+        Exiv2::XmpMetadata::iterator i = _xmpData->begin();
+        while (i != _xmpData->end())
+        {
+            if (properties.count(xmpPropertyKey(i->key())) > 0)
+                i = _xmpData->erase(i);
+            else
+                ++i;
+        }
+    }
+    for(Exiv2::XmpMetadata::const_iterator i = sidecarData.begin();
+        i != sidecarData.end(); ++i)
+    {
+        if (sidecarWins || (properties.count(xmpPropertyKey(i->key())) == 0))
+        {
+            _xmpData->add(*i);
+        }
+    }
+    _xmpModified = true;
+    ++_generation;
+}
+
+void Image::writeSidecar(const std::string& path)
+{
+    {
+        ReadLock lock(_mutex);
+        CHECK_METADATA_READ
+#if EXIV2_TEST_VERSION(0,22,0)
+        // An unmodified packet is written as is, even if it is pending.
+        if (!_xmpPacketPending || !_xmpModified)
+#else
+        if (!_xmpPacketPending)
+#endif
+        {
+            _writeSidecar(path);
+            return;
+        }
+    }
+
+    // The pending packet has to be parsed into the XMP data written.
+    WriteLock lock(_mutex);
+    _decodeXmpPacket();
+    _writeSidecar(path);
+}
+
+void Image::_writeSidecar(const std::string& path) const
+{
+    // If an exception is thrown, it has to be done outside of the
+    // Py_{BEGIN,END}_ALLOW_THREADS block.
+    Exiv2::Error error(0);
+
+    // Release the GIL to allow other python threads to run
+    // while writing the sidecar.
+    Py_BEGIN_ALLOW_THREADS
+
+    try
+    {
+        Exiv2::Image::AutoPtr sidecar =
+            Exiv2::ImageFactory::create(Exiv2::ImageType::xmp, path);
+        assert(sidecar.get() != 0);
+#if EXIV2_TEST_VERSION(0,22,0)
+        if (!_xmpModified)
+        {
+            // Write the packet as read (or set) as is, without parsing it if
+            // it is pending.
+            sidecar->xmpPacket() = _image->xmpPacket();
+            sidecar->writeXmpFromPacket(true);
+        }
+        else
+#endif
+        {
+            sidecar->setXmpData(*_xmpData);
+        }
+        XmpRegistryReadLock registryLock(xmpRegistryMutex);
+        sidecar->writeMetadata();
+    }
+    catch (Exiv2::Error& err)
+    {
+        error = err;
+    }
+
+    // Re-acquire the GIL
+    Py_END_ALLOW_THREADS
+
+    if (error.code() != 0)
+    {
+        throw error;
+    }
+}
+
+const std::string Image::getComment() const
+{
+    ReadLock lock(_mutex);
+    CHECK_METADATA_READ
+    return _image->comment();
+}
+
+void Image::setComment(const std::string& comment)
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _detach();
+    _image->setComment(comment);
+}
+
+void Image::clearComment()
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _detach();
+    _image->clearComment();
+}
+
+
+boost::python::list Image::previews()
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    // The underlying image file or buffer is not to be accessed concurrently
+    // through clones.
+    _detach();
+
+    boost::python::list previews;
+    Exiv2::PreviewManager pm(*_image);
+    Exiv2::PreviewPropertiesList props = pm.getPreviewProperties();
+    for (Exiv2::PreviewPropertiesList::const_iterator i = props.begin();
+         i != props.end();
+         ++i)
+    {
+        previews.append(Preview(pm.getPreviewImage(*i)));
+    }
+
+    return previews;
+}
+
+void Image::begin()
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    if (_savedExifData != 0) throw Exiv2::Error(TRANSACTION_IN_PROGRESS);
+    _decodeXmpPacket();
+
+    _savedExifData = new Exiv2::ExifData(*_exifData);
+    _savedIptcData = new Exiv2::IptcData(*_iptcData);
+    _savedXmpData = new Exiv2::XmpData(*_xmpData);
+    _savedComment = _image->comment();
+}
+
+void Image::commit()
+{
+    WriteLock lock(_mutex);
+    if (_savedExifData == 0) throw Exiv2::Error(NO_TRANSACTION);
+
+    _endTransaction();
+}
+
+void Image::rollback()
+{
+    WriteLock lock(_mutex);
+    if (_savedExifData == 0) throw Exiv2::Error(NO_TRANSACTION);
+    _checkExports();
+    _detach();
+
+    // Assign the containers rather than replacing them, so that pointers to
+    // them (e.g. from the EXIF thumbnail) remain valid.
+    *_exifData = *_savedExifData;
+    *_iptcData = *_savedIptcData;
+    *_xmpData = *_savedXmpData;
+    _xmpModified = true;
+    _xmpPacketPending = false;
+    _iptcCharsetValid = false;
+    ++_generation;
+    _image->setComment(_savedComment);
+    _endTransaction();
+}
+
+void Image::_endTransaction()
+{
+    delete _savedExifData;
+    delete _savedIptcData;
+    delete _savedXmpData;
+    _savedExifData = 0;
+    _savedIptcData = 0;
+    _savedXmpData = 0;
+    _savedComment.clear();
+}
+
+void Image::copyMetadata(Image& other, bool exif, bool iptc, bool xmp) const
+{
+    if (&other == this)
+    {
+        return;
+    }
+
+    // Lock both images in a consistent order to avoid deadlocks.
+    if (this < &other)
+    {
+        ReadLock lock(_mutex);
+        WriteLock otherLock(other._mutex);
+        _copyMetadata(other, exif, iptc, xmp);
+    }
+    else
+    {
+        WriteLock otherLock(other._mutex);
+        ReadLock lock(_mutex);
+        _copyMetadata(other, exif, iptc, xmp);
+    }
+}
+
+void Image::_copyMetadata(Image& other, bool exif, bool iptc, bool xmp) const
+{
+    CHECK_METADATA_READ
+    if (!other._dataRead) throw Exiv2::Error(METADATA_NOT_READ);
+    other._checkExports();
+    other._detach();
+    ++other._generation;
+
+    if (exif)
+        other._image->setExifData(*_exifData);
+    if (iptc)
+    {
+        other._image->setIptcData(*_iptcData);
+        other._iptcCharset = _iptcCharset;
+        other._iptcCharsetValid = _iptcCharsetValid;
+    }
+    if (xmp)
+    {
+        other._image->setXmpData(*_xmpData);
+        other._image->xmpPacket() = _image->xmpPacket();
+        other._xmpModified = _xmpModified;
+        other._xmpPacketPending = _xmpPacketPending;
+    }
+}
+
+std::string Image::getDataBuffer()
+{
+    WriteLock lock(_mutex);
+    // The underlying image file or buffer is not to be accessed concurrently
+    // through clones.
+    _detach();
+
+    std::string buffer;
+
+    // Release the GIL to allow other python threads to run
+    // while reading the image data.
+    Py_BEGIN_ALLOW_THREADS
+
+    Exiv2::BasicIo& io = _image->io();
+    unsigned long size = io.size();
+    long pos = -1;
+
+    if (io.isopen())
+    {
+        // Remember the current position in the stream
         pos = io.tell();
         // Go to the beginning of the stream
         io.seek(0, Exiv2::BasicIo::beg);
     }
-    else
+    else
+    {
+        io.open();
+    }
+
+    // Copy the data buffer in a string. Since the data buffer can contain null
+    // characters ('\x00'), the string cannot be simply constructed like that:
+    //     _data = std::string((char*) previewImage.pData());
+    // because it would be truncated after the first occurence of a null
+    // character. Therefore, it has to be copied character by character.
+    // First allocate the memory for the whole string...
+    buffer.resize(size, ' ');
+    // ... then fill it with the raw data.
+    for (unsigned long i = 0; i < size; ++i)
+    {
+        io.read((Exiv2::byte*) &buffer[i], 1);
+    }
+
+    if (pos == -1)
+    {
+        // The stream was initially closed
+        io.close();
+    }
+    else
+    {
+        // Reset to the initial position in the stream
+        io.seek(pos, Exiv2::BasicIo::beg);
+    }
+
+    // Re-acquire the GIL
+    Py_END_ALLOW_THREADS
+
+    return buffer;
+}
+
+// Parse a dictionary of raw values (see Image::update()) into staging
+// containers. Where a tag is already set in the reference containers, the
+// type of its value is preserved.
+// Throw an exception if one of the keys or values is invalid.
+static void stageEdits(const boost::python::dict& edits,
+                       Exiv2::ExifData& exifEdits,
+                       Exiv2::IptcData& iptcEdits,
+                       Exiv2::XmpData& xmpEdits,
+                       const Exiv2::ExifData& exifData=Exiv2::ExifData(),
+                       const Exiv2::XmpData& xmpData=Exiv2::XmpData())
+{
+    for(boost::python::stl_input_iterator<std::string> iterator(edits);
+        iterator != boost::python::stl_input_iterator<std::string>();
+        ++iterator)
+    {
+        const std::string key = *iterator;
+        const boost::python::object value = edits.get(key);
+
+        if (key.compare(0, 5, "Exif.") == 0)
+        {
+            Exiv2::ExifKey exifKey(key);
+            // Preserve the type of an existing value.
+            Exiv2::ExifMetadata::const_iterator datum = exifData.findKey(exifKey);
+            Exiv2::Value::AutoPtr exifValue = (datum != exifData.end()) ?
+                datum->getValue() :
+                Exiv2::Value::create(exifKey.defaultTypeId());
+            std::string raw = boost::python::extract<std::string>(value);
+            if (exifValue->read(raw) != 0)
+            {
+                throw Exiv2::Error(INVALID_VALUE);
+            }
+            exifEdits.add(exifKey, exifValue.get());
+        }
+        else if (key.compare(0, 5, "Iptc.") == 0)
+        {
+            Exiv2::IptcKey iptcKey(key);
+            const Exiv2::TypeId type = Exiv2::IptcDataSets::dataSetType(
+                iptcKey.tag(), iptcKey.record());
+            for(boost::python::stl_input_iterator<std::string> raw(value);
+                raw != boost::python::stl_input_iterator<std::string>();
+                ++raw)
+            {
+                Exiv2::Value::AutoPtr iptcValue = Exiv2::Value::create(type);
+                if (iptcValue->read(*raw) != 0)
+                {
+                    throw Exiv2::Error(INVALID_VALUE);
+                }
+                if (iptcEdits.add(iptcKey, iptcValue.get()) == 6)
+                {
+                    throw Exiv2::Error(NON_REPEATABLE);
+                }
+            }
+        }
+        else if (key.compare(0, 4, "Xmp.") == 0)
+        {
+            boost::shared_ptr<const XmpPropertyDetails> details =
+                cachedXmpPropertyDetails<ReadLock>(key);
+            const Exiv2::XmpKey& xmpKey = details->key;
+            Exiv2::XmpMetadata::const_iterator datum = xmpData.findKey(xmpKey);
+            const Exiv2::TypeId type = (datum != xmpData.end()) ?
+                datum->typeId() : details->type;
+            Exiv2::Value::AutoPtr xmpValue = Exiv2::Value::create(type);
+            int result = 0;
+            boost::python::extract<std::string> text(value);
+            boost::python::extract<boost::python::dict> langAlt(value);
+            if (text.check())
+            {
+                result = xmpValue->read(text());
+            }
+            else if (langAlt.check())
+            {
+                const boost::python::dict values = langAlt();
+                for(boost::python::stl_input_iterator<std::string> lang(values);
+                    (lang != boost::python::stl_input_iterator<std::string>()) &&
+                    (result == 0);
+                    ++lang)
+                {
+                    std::string item = boost::python::extract<std::string>(values.get(*lang));
+                    result = xmpValue->read("lang=\"" + *lang + "\" " + item);
+                }
+            }
+            else
+            {
+                for(boost::python::stl_input_iterator<std::string> item(value);
+                    (item != boost::python::stl_input_iterator<std::string>()) &&
+                    (result == 0);
+                    ++item)
+                {
+                    result = xmpValue->read(*item);
+                }
+            }
+            if (result != 0)
+            {
+                throw Exiv2::Error(INVALID_VALUE);
+            }
+            xmpEdits.add(xmpKey, xmpValue.get());
+        }
+        else
+        {
+            // Invalid key
+            throw Exiv2::Error(6, key);
+        }
+    }
+}
+
+// Apply staged changes to metadata containers. This cannot fail.
+// The namespace registry is locked with a lock of the given type.
+template <class RegistryLock>
+static void applyEdits(Exiv2::ExifData& exifData,
+                       Exiv2::IptcData& iptcData,
+                       Exiv2::XmpData& xmpData,
+                       const Exiv2::ExifData& exifEdits,
+                       const Exiv2::IptcData& iptcEdits,
+                       const Exiv2::XmpData& xmpEdits)
+{
+    for (Exiv2::ExifMetadata::const_iterator i = exifEdits.begin();
+         i != exifEdits.end(); ++i)
+    {
+        exifData[i->key()].setValue(&i->value());
+    }
+
+    // Repeatable IPTC tags may have been staged several times, remove all the
+    // existing values once for each key before appending the new ones.
+    for (Exiv2::IptcMetadata::const_iterator i = iptcEdits.begin();
+         i != iptcEdits.end(); ++i)
+    {
+        if ((i == iptcEdits.begin()) || ((i - 1)->key() != i->key()))
+        {
+            Exiv2::IptcMetadata::iterator datum = iptcData.begin();
+            while (datum != iptcData.end())
+            {
+                if (datum->key() == i->key())
+                {
+                    datum = iptcData.erase(datum);
+                }
+                else
+                {
+                    ++datum;
+                }
+            }
+        }
+        iptcData.add(*i);
+    }
+
+    for (Exiv2::XmpMetadata::const_iterator i = xmpEdits.begin();
+         i != xmpEdits.end(); ++i)
+    {
+        findOrAddXmpDatum(xmpData, cachedXmpPropertyDetails<RegistryLock>(
+            i->key())->key).setValue(&i->value());
+    }
+}
+
+void Image::update(const boost::python::dict& edits,
+                   const boost::python::list& deletes)
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _checkExports();
+    _decodeXmpPacket();
+
+    // First pass: validate all the changes, staging the new values in
+    // temporary containers so that nothing is modified if one of them fails.
+    Exiv2::ExifData exifEdits;
+    Exiv2::IptcData iptcEdits;
+    Exiv2::XmpData xmpEdits;
+    stageEdits(edits, exifEdits, iptcEdits, xmpEdits, *_exifData, *_xmpData);
+
+    std::vector<std::string> deletedKeys;
+    for(boost::python::stl_input_iterator<std::string> iterator(deletes);
+        iterator != boost::python::stl_input_iterator<std::string>();
+        ++iterator)
+    {
+        const std::string key = *iterator;
+        if (std::find(deletedKeys.begin(), deletedKeys.end(), key) !=
+            deletedKeys.end())
+        {
+            continue;
+        }
+        bool found = false;
+        if (key.compare(0, 5, "Exif.") == 0)
+        {
+            found = (_exifData->findKey(Exiv2::ExifKey(key)) != _exifData->end());
+        }
+        else if (key.compare(0, 5, "Iptc.") == 0)
+        {
+            found = (_iptcData->findKey(Exiv2::IptcKey(key)) != _iptcData->end());
+        }
+        else if (key.compare(0, 4, "Xmp.") == 0)
+        {
+            found = (_xmpData->findKey(cachedXmpPropertyDetails<ReadLock>(key)->key) !=
+                     _xmpData->end());
+        }
+        if (!found)
+        {
+            throw Exiv2::Error(KEY_NOT_FOUND, key);
+        }
+        deletedKeys.push_back(key);
+    }
+
+    // Second pass: apply the changes, none of which may fail any longer.
+    for (std::vector<std::string>::const_iterator i = deletedKeys.begin();
+         i != deletedKeys.end(); ++i)
+    {
+        if (i->compare(0, 5, "Exif.") == 0)
+        {
+            _deleteExifTag(*i);
+        }
+        else if (i->compare(0, 5, "Iptc.") == 0)
+        {
+            _deleteIptcTag(*i);
+        }
+        else
+        {
+            _deleteXmpTag(*i);
+        }
+    }
+
+    applyEdits<ReadLock>(*_exifData, *_iptcData, *_xmpData,
+                         exifEdits, iptcEdits, xmpEdits);
+    ++_generation;
+    if (!iptcEdits.empty())
+    {
+        _iptcCharsetValid = false;
+    }
+    if (!xmpEdits.empty())
+    {
+        _xmpModified = true;
+    }
+}
+
+void Image::applyTemplate(const MetadataTemplate& metadataTemplate)
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _checkExports();
+    _decodeXmpPacket();
+
+    applyEdits<ReadLock>(*_exifData, *_iptcData, *_xmpData,
+                         metadataTemplate.exifData(),
+                         metadataTemplate.iptcData(),
+                         metadataTemplate.xmpData());
+    ++_generation;
+    if (!metadataTemplate.iptcData().empty())
+    {
+        _iptcCharsetValid = false;
+    }
+    if (!metadataTemplate.xmpData().empty())
+    {
+        _xmpModified = true;
+    }
+}
+
+// Return a value of the same type and size as the one passed, with all its
+// components set to zero.
+static Exiv2::Value::AutoPtr blankValue(const Exiv2::Value& value)
+{
+    Exiv2::Value::AutoPtr blank = Exiv2::Value::create(value.typeId());
+    if ((value.typeId() == Exiv2::unsignedRational) ||
+        (value.typeId() == Exiv2::signedRational))
+    {
+        // 0/0 is not a valid rational, use 0/1 instead.
+        std::string zeroes;
+        for (long i = 0; i < value.count(); ++i)
+        {
+            zeroes += (i == 0) ? "0/1" : " 0/1";
+        }
+        blank->read(zeroes);
+    }
+    else
+    {
+        Exiv2::DataBuf buffer(value.size());
+        if (buffer.size_ > 0)
+        {
+            std::memset(buffer.pData_, 0, buffer.size_);
+        }
+        blank->read(buffer.pData_, buffer.size_, Exiv2::littleEndian);
+    }
+    return blank;
+}
+
+boost::python::list Image::redact(const RedactionPolicy& policy)
+{
+    WriteLock lock(_mutex);
+    CHECK_METADATA_READ
+    _checkExports();
+    _decodeXmpPacket();
+
+    std::vector<std::string> patterns;
+    {
+        ReadLock registryLock(xmpRegistryMutex);
+        patterns = policy.patterns();
+    }
+
+    boost::python::list keys;
+
+    Exiv2::ExifMetadata::iterator exifIterator = _exifData->begin();
+    while (exifIterator != _exifData->end())
+    {
+        const std::string key = exifIterator->key();
+        if (!RedactionPolicy::matches(patterns, key))
+        {
+            ++exifIterator;
+            continue;
+        }
+        if (policy.inPlace())
+        {
+            Exiv2::Value::AutoPtr blank = blankValue(exifIterator->value());
+            exifIterator->setValue(blank.get());
+            ++exifIterator;
+        }
+        else
+        {
+            exifIterator = _exifData->erase(exifIterator);
+        }
+        keys.append(key);
+    }
+
+    // IPTC and XMP data is always rewritten as a whole by libexiv2, there is
+    // nothing to gain in blanking out values instead of erasing them.
+    Exiv2::IptcMetadata::iterator iptcIterator = _iptcData->begin();
+    while (iptcIterator != _iptcData->end())
+    {
+        const std::string key = iptcIterator->key();
+        if (RedactionPolicy::matches(patterns, key))
+        {
+            iptcIterator = _iptcData->erase(iptcIterator);
+            _iptcCharsetValid = false;
+            // Repeatable tags are reported only once.
+            if (keys.count(key) == 0)
+            {
+                keys.append(key);
+            }
+        }
+        else
+        {
+            ++iptcIterator;
+        }
+    }
+
+    Exiv2::XmpMetadata::iterator xmpIterator = _xmpData->begin();
+    while (xmpIterator != _xmpData->end())
+    {
+        const std::string key = xmpIterator->key();
+        if (RedactionPolicy::matches(patterns, key))
+        {
+            xmpIterator = _xmpData->erase(xmpIterator);
+            _xmpModified = true;
+            keys.append(key);
+        }
+        else
+        {
+            ++xmpIterator;
+        }
+    }
+
+    if (boost::python::len(keys) > 0)
+    {
+        ++_generation;
+    }
+    return keys;
+}
+
+Exiv2::ByteOrder Image::getByteOrder() const
+{
+    CHECK_METADATA_READ
+    return _image->byteOrder();
+}
+
+Exiv2::ExifThumb* Image::_getExifThumbnail()
+{
+    CHECK_METADATA_READ
+    _detach();
+    if (_exifThumbnail == 0)
+    {
+        _exifThumbnail = new Exiv2::ExifThumb(*_exifData);
+    }
+    return _exifThumbnail;
+}
+
+const std::string Image::getExifThumbnailMimeType()
+{
+    WriteLock lock(_mutex);
+    return std::string(_getExifThumbnail()->mimeType());
+}
+
+const std::string Image::getExifThumbnailExtension()
+{
+    WriteLock lock(_mutex);
+    return std::string(_getExifThumbnail()->extension());
+}
+
+void Image::writeExifThumbnailToFile(const std::string& path)
+{
+    WriteLock lock(_mutex);
+    _getExifThumbnail()->writeFile(path);
+}
+
+const std::string Image::getExifThumbnailData()
+{
+    WriteLock lock(_mutex);
+    Exiv2::DataBuf buffer = _getExifThumbnail()->copy();
+    // Copy the data buffer in a string. Since the data buffer can contain null
+    // characters ('\x00'), the string cannot be simply constructed like that:
+    //     data = std::string((char*) buffer.pData_);
+    // because it would be truncated after the first occurence of a null
+    // character. Therefore, it has to be copied character by character.
+    // First allocate the memory for the whole string...
+    std::string data = std::string(buffer.size_, ' ');
+    // ... then fill it with the raw data.
+    for(unsigned int i = 0; i < buffer.size_; ++i)
+    {
+        data[i] = buffer.pData_[i];
+    }
+    return data;
+}
+
+void Image::eraseExifThumbnail()
+{
+    WriteLock lock(_mutex);
+    _checkExports();
+    _getExifThumbnail()->erase();
+    ++_generation;
+}
+
+void Image::setExifThumbnailFromFile(const std::string& path)
+{
+    WriteLock lock(_mutex);
+    _checkExports();
+    _getExifThumbnail()->setJpegThumbnail(path);
+    ++_generation;
+}
+
+void Image::setExifThumbnailFromData(const std::string& data)
+{
+    WriteLock lock(_mutex);
+    _checkExports();
+    const Exiv2::byte* buffer = (const Exiv2::byte*) data.c_str();
+    _getExifThumbnail()->setJpegThumbnail(buffer, data.size());
+    ++_generation;
+}
+
+// Return the charset libexiv2 detects in IPTC data, empty if unknown.
+static std::string detectIptcCharset(const Exiv2::IptcData& data)
+{
+    const char* charset = data.detectCharset();
+    if (charset != 0)
+    {
+        return std::string(charset);
+    }
+    else
+    {
+        return std::string();
+    }
+}
+
+const std::string Image::getIptcCharset() const
+{
+    {
+        ReadLock lock(_mutex);
+        CHECK_METADATA_READ
+        if (_iptcCharsetValid)
+        {
+            return _iptcCharset;
+        }
+    }
+
+    // Detecting the charset scans all the IPTC data: do it once and for all
+    // until the data is modified.
+    WriteLock lock(_mutex);
+    if (!_iptcCharsetValid)
+    {
+        _iptcCharset = detectIptcCharset(*_iptcData);
+        _iptcCharsetValid = true;
+    }
+    return _iptcCharset;
+}
+
+
+// Return true for the JSON format of human-readable dumps, false for the
+// text format. Throw an exception if the format is unknown.
+static bool isJsonDumpFormat(const std::string& format)
+{
+    if (format == "json")
+    {
+        return true;
+    }
+    else if (format == "text")
+    {
+        return false;
+    }
+    throw Exiv2::Error(INVALID_VALUE, format);
+}
+
+// Scratch buffer for the output built without the GIL, one per thread. It
+// is cleared but keeps its capacity from one call to the next, so that once
+// it has grown, dumping batches of images doesn't go through the allocator
+// (and its locks, contended by the other worker threads) for every image.
+// Buffers grown larger than SCRATCH_BUFFER_SIZE (e.g. by a large batch)
+// are released after use rather than kept for the lifetime of the thread.
+#define SCRATCH_BUFFER_SIZE (1 << 20)
+static boost::thread_specific_ptr<std::string> scratchBuffer;
+
+static std::string& getScratchBuffer()
+{
+    std::string* buffer = scratchBuffer.get();
+    if (buffer == 0)
+    {
+        buffer = new std::string();
+        scratchBuffer.reset(buffer);
+    }
+    buffer->clear();
+    return *buffer;
+}
+
+static void trimScratchBuffer()
+{
+    std::string* buffer = scratchBuffer.get();
+    if ((buffer != 0) && (buffer->capacity() > SCRATCH_BUFFER_SIZE))
+    {
+        std::string().swap(*buffer);
+    }
+}
+
+// Return the length of the well-formed UTF-8 sequence value starts with at
+// offset i, or 0 if it doesn't start a well-formed sequence there (stray
+// continuation byte, truncated, overlong or surrogate sequence).
+static std::string::size_type utf8SequenceLength(const std::string& value,
+                                                 std::string::size_type i)
+{
+    const unsigned char c = value[i];
+    std::string::size_type length;
+    // Range of the byte following the first one.
+    unsigned char low = 0x80;
+    unsigned char high = 0xbf;
+    if ((c >= 0xc2) && (c <= 0xdf))
+    {
+        length = 2;
+    }
+    else if ((c >= 0xe0) && (c <= 0xef))
+    {
+        length = 3;
+        if (c == 0xe0) low = 0xa0;
+        else if (c == 0xed) high = 0x9f;
+    }
+    else if ((c >= 0xf0) && (c <= 0xf4))
+    {
+        length = 4;
+        if (c == 0xf0) low = 0x90;
+        else if (c == 0xf4) high = 0x8f;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (length > value.size() - i)
+    {
+        return 0;
+    }
+    for (std::string::size_type n = 1; n < length; ++n)
+    {
+        const unsigned char next = value[i + n];
+        if ((next < low) || (next > high))
+        {
+            return 0;
+        }
+        low = 0x80;
+        high = 0xbf;
+    }
+    return length;
+}
+
+// Append a field of a human-readable dump, as a JSON string or as text on a
+// single line.
+// Values are not guaranteed to be valid UTF-8: in JSON strings, the bytes
+// that are not part of a well-formed UTF-8 sequence are escaped as the
+// Latin-1 characters they stand for.
+static void dumpField(std::string& out, const std::string& value, bool json)
+{
+    if (!json)
+    {
+        for (std::string::const_iterator i = value.begin(); i != value.end(); ++i)
+        {
+            out += ((*i == '\n') || (*i == '\r') || (*i == '\t')) ? ' ' : *i;
+        }
+        return;
+    }
+
+    const char* digits = "0123456789abcdef";
+    out += '"';
+    for (std::string::size_type i = 0; i < value.size(); ++i)
+    {
+        const unsigned char c = value[i];
+        if ((c == '"') || (c == '\\'))
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c == '\n')
+        {
+            out += "\\n";
+        }
+        else if (c == '\t')
+        {
+            out += "\\t";
+        }
+        else if (c < 0x80)
+        {
+            if (c < 0x20)
+            {
+                out += "\\u00";
+                out += digits[c >> 4];
+                out += digits[c & 0x0f];
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        else
+        {
+            const std::string::size_type length = utf8SequenceLength(value, i);
+            if (length > 0)
+            {
+                out.append(value, i, length);
+                i += length - 1;
+            }
+            else
+            {
+                out += "\\u00";
+                out += digits[c >> 4];
+                out += digits[c & 0x0f];
+            }
+        }
+    }
+    out += '"';
+}
+
+template <class Data>
+static void dumpData(std::string& out, const Data& data,
+                     const Exiv2::ExifData* exifData, bool json, bool& first)
+{
+    for (typename Data::const_iterator i = data.begin(); i != data.end(); ++i)
+    {
+        if (json)
+        {
+            out += first ? "\n" : ",\n";
+            out += "{\"key\": ";
+            dumpField(out, i->key(), true);
+            out += ", \"label\": ";
+            dumpField(out, i->tagLabel(), true);
+            out += ", \"value\": ";
+            dumpField(out, i->print(exifData), true);
+            out += "}";
+        }
+        else
+        {
+            out += i->key();
+            out += '\t';
+            dumpField(out, i->tagLabel(), false);
+            out += '\t';
+            dumpField(out, i->print(exifData), false);
+            out += '\n';
+        }
+        first = false;
+    }
+}
+
+// Append a human-readable dump of all the metadata, to be called without
+// the GIL and with the XMP namespace registry unlocked.
+static void dumpMetadata(std::string& out, const Exiv2::ExifData& exifData,
+                         const Exiv2::IptcData& iptcData,
+                         const Exiv2::XmpData& xmpData, bool json)
+{
+    bool first = true;
+    if (json)
+    {
+        out += '[';
+    }
+    dumpData(out, exifData, &exifData, json, first);
+    dumpData(out, iptcData, &exifData, json, first);
+    {
+        XmpRegistryReadLock registryLock(xmpRegistryMutex);
+        dumpData(out, xmpData, &exifData, json, first);
+    }
+    if (json)
+    {
+        out += first ? "]" : "\n]";
+    }
+}
+
+boost::python::str Image::humanDump(const std::string& format)
+{
+    const bool json = isJsonDumpFormat(format);
+
+    bool pending;
+    {
+        ReadLock lock(_mutex);
+        CHECK_METADATA_READ
+        pending = _xmpPacketPending;
+    }
+    if (pending)
+    {
+        WriteLock lock(_mutex);
+        _decodeXmpPacket();
+    }
+
+    ReadLock lock(_mutex);
+    std::string& out = getScratchBuffer();
+
+    // If an exception is thrown, it has to be done outside of the
+    // Py_{BEGIN,END}_ALLOW_THREADS block.
+    Exiv2::Error error(0);
+
+    // Release the GIL to allow other python threads to run
+    // while dumping the metadata.
+    Py_BEGIN_ALLOW_THREADS
+
+    try
+    {
+        dumpMetadata(out, *_exifData, *_iptcData, *_xmpData, json);
+    }
+    catch (Exiv2::Error& err)
+    {
+        error = err;
+    }
+
+    // Re-acquire the GIL
+    Py_END_ALLOW_THREADS
+
+    if (error.code() != 0)
+    {
+        throw error;
+    }
+
+    // Copied once, straight from the scratch buffer to the python string.
+    boost::python::str dump(out.data(), out.size());
+    trimScratchBuffer();
+    return dump;
+}
+
+ExifTag::ExifTag(const std::string& key,
+                 Exiv2::Exifdatum* datum, Exiv2::ExifData* data,
+                 Exiv2::ByteOrder byteOrder, bool copy, Image* parent):
+    _key(key), _byteOrder(byteOrder), _parent(copy ? 0 : parent),
+    _generation((_parent != 0) ? _parent->_generation : 0), _writable(false),
+    _exports(0)
+{
+    if (datum != 0 && copy)
+    {
+        _datum = new Exiv2::Exifdatum(*datum);
+        _data = 0;
+    }
+    else if (datum != 0 && data != 0)
+    {
+        _datum = datum;
+        _data = data;
+    }
+    else
+    {
+        _datum = new Exiv2::Exifdatum(_key);
+        _data = 0;
+    }
+
+// Conditional code, exiv2 0.21 changed APIs we need
+// (see https://bugs.launchpad.net/pyexiv2/+bug/684177).
+#if EXIV2_TEST_VERSION(0,21,0)
+    _type = Exiv2::TypeInfo::typeName(_key.defaultTypeId());
+#else
+    _type = Exiv2::TypeInfo::typeName(
+        Exiv2::ExifTags::tagType(_key.tag(), _key.ifdId()));
+#endif
+    // Where available, extract the type from the metadata, it is more reliable
+    // than static type information. The exception is for user comments, for
+    // which we’d rather keep the 'Comment' type instead of 'Undefined'.
+    if ((datum != 0) && (getType() != "Comment"))
+    {
+        const char* typeName = _datum->typeName();
+        if (typeName != 0)
+        {
+            _type = typeName;
+        }
+    }
+}
+
+ExifTag::ExifTag(const ExifTag& other):
+    _key(other._key), _datum(other._datum), _data(other._data),
+    _type(other._type), _byteOrder(other._byteOrder), _parent(other._parent),
+    _generation(other._generation), _writable(other._writable), _exports(0)
+{
+    if (_data == 0)
+    {
+        _datum = new Exiv2::Exifdatum(*other._datum);
+    }
+}
+
+ExifTag& ExifTag::operator=(const ExifTag& other)
+{
+    if (this == &other)
+    {
+        return *this;
+    }
+    _checkExports();
+    Exiv2::Exifdatum* datum = other._datum;
+    if (other._data == 0)
+    {
+        datum = new Exiv2::Exifdatum(*other._datum);
+    }
+    if (_data == 0)
+    {
+        delete _datum;
+    }
+    _key = other._key;
+    _datum = datum;
+    _data = other._data;
+    _type = other._type;
+    _byteOrder = other._byteOrder;
+    _parent = other._parent;
+    _generation = other._generation;
+    _writable = other._writable;
+    return *this;
+}
+
+ExifTag::~ExifTag()
+{
+    if (_data == 0)
+    {
+        delete _datum;
+    }
+}
+
+bool ExifTag::_revalidate(bool write)
+{
+    if ((_parent == 0) ||
+        ((_generation == _parent->_generation) && (_writable || !write)))
+    {
+        return true;
+    }
+
+    // Other threads may be using the image.
+    if (write)
+    {
+        WriteLock lock(_parent->getMutex());
+        return _lookUpDatum(true);
+    }
+    ReadLock lock(_parent->getMutex());
+    return _lookUpDatum(false);
+}
+
+bool ExifTag::_lookUpDatum(bool write)
+{
+    if ((_parent == 0) ||
+        ((_generation == _parent->_generation) && (_writable || !write)))
+    {
+        return true;
+    }
+
+    if (write)
+    {
+        // The image may share its metadata with a clone.
+        _parent->_detach();
+    }
+    _data = _parent->_exifData;
+    _generation = _parent->_generation;
+    _writable = write;
+    Exiv2::ExifMetadata::iterator i = _data->findKey(_key);
+    if (i != _data->end())
+    {
+        _datum = &(*i);
+        return true;
+    }
+
+    // The tag was removed from the image, and its datum with it.
+    _datum = new Exiv2::Exifdatum(_key);
+    _data = 0;
+    _parent = 0;
+    return false;
+}
+
+void ExifTag::_checkHandle(bool write)
+{
+    if (!_revalidate(write))
+    {
+        throw Exiv2::Error(KEY_NOT_FOUND, _key.key());
+    }
+}
+
+void ExifTag::_checkExports()
+{
+    if (_exports > 0)
+    {
+        throw Exiv2::Error(BUFFER_EXPORTED);
+    }
+}
+
+void ExifTag::setRawValue(const std::string& value)
+{
+    _checkHandle(true);
+    _checkExports();
+    int result = _datum->setValue(value);
+    if (result != 0)
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+}
+
+// Whether values of a type are sequences of bytes.
+static bool isByteType(Exiv2::TypeId type)
+{
+    return (type == Exiv2::undefined) || (type == Exiv2::unsignedByte) ||
+           (type == Exiv2::signedByte);
+}
+
+void ExifTag::setRawBytes(const boost::python::object& bytes)
+{
+    _checkHandle(true);
+    _checkExports();
+    Exiv2::TypeId type = _datum->typeId();
+    if (!isByteType(type))
+    {
+        type = Exiv2::TypeInfo::typeId(getType());
+        if (!isByteType(type))
+        {
+            throw Exiv2::Error(INVALID_VALUE);
+        }
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(bytes.ptr(), &view, PyBUF_SIMPLE) != 0)
+    {
+        boost::python::throw_error_already_set();
+    }
+    Exiv2::DataValue value(type);
+    value.read(static_cast<const Exiv2::byte*>(view.buf), view.len);
+    PyBuffer_Release(&view);
+    _datum->setValue(&value);
+}
+
+// Return the name of the codec for the text of a comment in a charset, or 0
+// if the charset doesn't define an encoding. The byte order of the tag only
+// matters to unicode comments before libexiv2 0.20.
+static const char* commentEncoding(Exiv2::CommentValue::CharsetId charset,
+#if EXIV2_TEST_VERSION(0,20,0)
+                                   int /* byteOrder */)
+#else
+                                   int byteOrder)
+#endif
+{
+    switch (charset)
+    {
+        case Exiv2::CommentValue::ascii:
+            return "ascii";
+        case Exiv2::CommentValue::jis:
+            return "shift_jis";
+        case Exiv2::CommentValue::unicode:
+#if EXIV2_TEST_VERSION(0,20,0)
+            // Starting from 0.20, libexiv2 converts unicode comments to UTF-8.
+            return "utf-8";
+#else
+            return (byteOrder == Exiv2::bigEndian) ? "utf-16be" : "utf-16le";
+#endif
+        default:
+            return 0;
+    }
+}
+
+void ExifTag::setComment(const boost::python::object& value)
+{
+    _checkHandle(true);
+    _checkExports();
+    boost::python::object text = value;
+    if (PyString_Check(value.ptr()))
+    {
+        PyObject* decoded = PyUnicode_DecodeUTF8(PyString_AS_STRING(value.ptr()),
+                                                 PyString_GET_SIZE(value.ptr()),
+                                                 "strict");
+        if (decoded == 0)
+        {
+            // Not UTF-8, store the bytes as is, without a charset.
+            PyErr_Clear();
+            setRawValue(boost::python::extract<std::string>(value));
+            return;
+        }
+        text = boost::python::object(boost::python::handle<>(decoded));
+    }
+    else if (!PyUnicode_Check(value.ptr()))
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+
+    Exiv2::CommentValue::CharsetId charset = Exiv2::CommentValue::undefined;
+    if (_datum->count() > 0)
+    {
+        const Exiv2::CommentValue* comment =
+            dynamic_cast<const Exiv2::CommentValue*>(&_datum->value());
+        if (comment != 0)
+        {
+            charset = comment->charsetId();
+        }
+    }
+
+    const char* encoding = commentEncoding(charset, _byteOrder);
+    if (encoding != 0)
+    {
+        PyObject* encoded = PyUnicode_AsEncodedString(text.ptr(), encoding,
+                                                      "strict");
+        if (encoded != 0)
+        {
+            boost::python::object bytes((boost::python::handle<>(encoded)));
+            setRawValue(std::string("charset=\"") +
+                        Exiv2::CommentValue::CharsetInfo::name(charset) +
+                        "\" " +
+                        std::string(PyString_AS_STRING(encoded),
+                                    PyString_GET_SIZE(encoded)));
+            return;
+        }
+        // Best effort, do not fail just because the original charset of the
+        // tag cannot encode the new value.
+        PyErr_Clear();
+    }
+
+    PyObject* encoded = PyUnicode_AsUTF8String(text.ptr());
+    if (encoded == 0)
+    {
+        boost::python::throw_error_already_set();
+    }
+    boost::python::object bytes((boost::python::handle<>(encoded)));
+    setRawValue(std::string(PyString_AS_STRING(encoded),
+                            PyString_GET_SIZE(encoded)));
+}
+
+void ExifTag::setParentImage(Image& image)
+{
+    _checkExports();
+    if (_parent != &image)
+    {
+        // Not with the lock of the new parent image held.
+        _revalidate(false);
+    }
+    WriteLock lock(image.getMutex());
+    Exiv2::ExifData* data = image.getExifData();
+    if (_parent == &image)
+    {
+        _lookUpDatum(true);
+    }
+    if (data == _data)
+    {
+        // The parent image is already the one passed as a parameter.
+        // This happens when replacing a tag by itself. In this case, don’t do
+        // anything (see https://bugs.launchpad.net/pyexiv2/+bug/622739).
+        _generation = image._generation;
+        _writable = true;
+        return;
+    }
+    Exiv2::Value::AutoPtr value = _datum->getValue();
+    if (_data == 0)
+    {
+        delete _datum;
+    }
+    _data = data;
+    _datum = &(*_data)[_key.key()];
+    _datum->setValue(value.get());
+    _parent = &image;
+    _generation = image._generation;
+    _writable = true;
+
+    _byteOrder = image.getByteOrder();
+}
+
+const std::string ExifTag::getKey()
+{
+    return _key.key();
+}
+
+const std::string ExifTag::getType()
+{
+    return (_type != 0) ? _type : "";
+}
+
+// Conditional code, exiv2 0.21 changed APIs we need
+// (see https://bugs.launchpad.net/pyexiv2/+bug/684177).
+#if EXIV2_TEST_VERSION(0,21,0)
+const std::string ExifTag::getName()
+{
+    return _key.tagName();
+}
+
+const std::string ExifTag::getLabel()
+{
+    return _key.tagLabel();
+}
+
+const std::string ExifTag::getDescription()
+{
+    return _key.tagDesc();
+}
+
+const std::string ExifTag::getSectionName()
+{
+    return Exiv2::ExifTags::sectionName(_key);
+}
+
+const std::string ExifTag::getSectionDescription()
+{
+    // The section description is not exposed in the API any longer
+    // (see http://dev.exiv2.org/issues/744). For want of anything better,
+    // fall back on the section’s name.
+    return getSectionName();
+}
+#else
+const std::string ExifTag::getName()
+{
+    return Exiv2::ExifTags::tagName(_key.tag(), _key.ifdId());
+}
+
+const std::string ExifTag::getLabel()
+{
+    return Exiv2::ExifTags::tagLabel(_key.tag(), _key.ifdId());
+}
+
+const std::string ExifTag::getDescription()
+{
+    return Exiv2::ExifTags::tagDesc(_key.tag(), _key.ifdId());
+}
+
+const std::string ExifTag::getSectionName()
+{
+    return Exiv2::ExifTags::sectionName(_key.tag(), _key.ifdId());
+}
+
+const std::string ExifTag::getSectionDescription()
+{
+    return Exiv2::ExifTags::sectionDesc(_key.tag(), _key.ifdId());
+}
+#endif
+
+const std::string ExifTag::getRawValue()
+{
+    _checkHandle(false);
+    return _datum->toString();
+}
+
+boost::python::object ExifTag::getRawBytes()
+{
+    _checkHandle(false);
+    const long size = _datum->size();
+    if ((size > 0) && !isByteType(_datum->typeId()))
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+
+    // Copy the bytes directly into the storage of the resulting string.
+    boost::python::object bytes(boost::python::handle<>(
+        PyString_FromStringAndSize(0, size)));
+    if (size > 0)
     {
-        io.open();
+        _datum->copy(reinterpret_cast<Exiv2::byte*>(PyString_AS_STRING(bytes.ptr())),
+                     Exiv2::invalidByteOrder);
     }
+    return bytes;
+}
 
-    // Copy the data buffer in a string. Since the data buffer can contain null
-    // characters ('\x00'), the string cannot be simply constructed like that:
-    //     _data = std::string((char*) previewImage.pData());
-    // because it would be truncated after the first occurence of a null
-    // character. Therefore, it has to be copied character by character.
-    // First allocate the memory for the whole string...
-    buffer.resize(size, ' ');
-    // ... then fill it with the raw data.
-    for (unsigned long i = 0; i < size; ++i)
+boost::python::object ExifTag::getComment()
+{
+    _checkHandle(false);
+    if (_datum->count() == 0)
     {
-        io.read((Exiv2::byte*) &buffer[i], 1);
+        return boost::python::object();
     }
 
-    if (pos == -1)
+    Exiv2::CommentValue::CharsetId charset = Exiv2::CommentValue::undefined;
+    std::string text;
+    const Exiv2::CommentValue* comment =
+        dynamic_cast<const Exiv2::CommentValue*>(&_datum->value());
+    if (comment != 0)
     {
-        // The stream was initially closed
-        io.close();
+        charset = comment->charsetId();
+        text = comment->comment();
     }
     else
     {
-        // Reset to the initial position in the stream
-        io.seek(pos, Exiv2::BasicIo::beg);
+        text = _datum->toString();
     }
 
-    // Re-acquire the GIL
-    Py_END_ALLOW_THREADS
+    PyObject* decoded;
+    const char* encoding = commentEncoding(charset, _byteOrder);
+    if (encoding != 0)
+    {
+        decoded = PyUnicode_Decode(text.data(), text.size(), encoding,
+                                   "replace");
+    }
+    else if (charset == Exiv2::CommentValue::undefined)
+    {
+        // No charset, try UTF-8.
+        decoded = PyUnicode_DecodeUTF8(text.data(), text.size(), "strict");
+        if (decoded == 0)
+        {
+            PyErr_Clear();
+            return boost::python::str(text);
+        }
+    }
+    else
+    {
+        decoded = PyUnicode_Decode(text.data(), text.size(),
+                                   PyUnicode_GetDefaultEncoding(), "replace");
+    }
+    if (decoded == 0)
+    {
+        boost::python::throw_error_already_set();
+    }
+    return boost::python::object(boost::python::handle<>(decoded));
+}
 
-    return buffer;
+const std::string ExifTag::getHumanValue()
+{
+    _checkHandle(false);
+    return _datum->print(_data);
 }
 
-Exiv2::ByteOrder Image::getByteOrder() const
+int ExifTag::getByteOrder()
 {
-    CHECK_METADATA_READ
-    return _image->byteOrder();
+    return _byteOrder;
 }
 
-Exiv2::ExifThumb* Image::_getExifThumbnail()
+// Whether values of a type can be viewed as an array of numbers.
+static bool isArrayType(Exiv2::TypeId type)
 {
-    CHECK_METADATA_READ
-    if (_exifThumbnail == 0)
+    switch (type)
     {
-        _exifThumbnail = new Exiv2::ExifThumb(*_exifData);
+        case Exiv2::unsignedShort:
+        case Exiv2::signedShort:
+        case Exiv2::unsignedLong:
+        case Exiv2::signedLong:
+        case Exiv2::unsignedRational:
+        case Exiv2::signedRational:
+            return true;
+        default:
+            return false;
     }
-    return _exifThumbnail;
 }
 
-const std::string Image::getExifThumbnailMimeType()
+// Return the list of values of a value of a numeric type.
+template <typename T>
+static std::vector<T>& arrayValues(Exiv2::Value& value)
 {
-    return std::string(_getExifThumbnail()->mimeType());
+    Exiv2::ValueType<T>* array = dynamic_cast<Exiv2::ValueType<T>*>(&value);
+    if (array == 0)
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+    return array->value_;
 }
 
-const std::string Image::getExifThumbnailExtension()
+template <typename T>
+static boost::python::object arrayItemToPython(const T& item)
 {
-    return std::string(_getExifThumbnail()->extension());
+    return boost::python::object(item);
 }
 
-void Image::writeExifThumbnailToFile(const std::string& path)
+template <typename T>
+static boost::python::object arrayItemToPython(const std::pair<T, T>& item)
 {
-    _getExifThumbnail()->writeFile(path);
+    return boost::python::make_tuple(item.first, item.second);
 }
 
-const std::string Image::getExifThumbnailData()
+template <typename T>
+static T arrayItemFromPython(const boost::python::object& object, const T*)
 {
-    Exiv2::DataBuf buffer = _getExifThumbnail()->copy();
-    // Copy the data buffer in a string. Since the data buffer can contain null
-    // characters ('\x00'), the string cannot be simply constructed like that:
-    //     data = std::string((char*) buffer.pData_);
-    // because it would be truncated after the first occurence of a null
-    // character. Therefore, it has to be copied character by character.
-    // First allocate the memory for the whole string...
-    std::string data = std::string(buffer.size_, ' ');
-    // ... then fill it with the raw data.
-    for(unsigned int i = 0; i < buffer.size_; ++i)
+    boost::python::extract<long long> number(object);
+    if (!number.check())
     {
-        data[i] = buffer.pData_[i];
+        throw Exiv2::Error(INVALID_VALUE);
     }
-    return data;
+    const long long value = number();
+    if ((value < static_cast<long long>(std::numeric_limits<T>::min())) ||
+        (value > static_cast<long long>(std::numeric_limits<T>::max())))
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+    return static_cast<T>(value);
 }
 
-void Image::eraseExifThumbnail()
+template <typename T>
+static std::pair<T, T> arrayItemFromPython(const boost::python::object& object,
+                                           const std::pair<T, T>*)
 {
-    _getExifThumbnail()->erase();
+    if (!PyTuple_Check(object.ptr()) || (boost::python::len(object) != 2))
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
+    const T* type = 0;
+    return std::make_pair(arrayItemFromPython(object[0], type),
+                          arrayItemFromPython(object[1], type));
 }
 
-void Image::setExifThumbnailFromFile(const std::string& path)
+// Check that [start, stop) is a valid range of indexes in an array.
+static void checkArrayRange(std::size_t size, long start, long stop)
 {
-    _getExifThumbnail()->setJpegThumbnail(path);
+    if ((start < 0) || (stop < start) || (stop > static_cast<long>(size)))
+    {
+        throw Exiv2::Error(INVALID_VALUE);
+    }
 }
 
-void Image::setExifThumbnailFromData(const std::string& data)
+template <typename T>
+static boost::python::object getArrayItem(const std::vector<T>& values,
+                                          long index)
 {
-    const Exiv2::byte* buffer = (const Exiv2::byte*) data.c_str();
-    _getExifThumbnail()->setJpegThumbnail(buffer, data.size());
+    checkArrayRange(values.size(), index, index + 1);
+    return arrayItemToPython(values[index]);
 }
 
-const std::string Image::getIptcCharset() const
+template <typename T>
+static void setArrayItem(std::vector<T>& values, long index,
+                         const boost::python::object& item)
 {
-    CHECK_METADATA_READ
-    const char* charset = _iptcData->detectCharset();
-    if (charset != 0)
-    {
-        return std::string(charset);
-    }
-    else
-    {
-        return std::string();
-    }
+    checkArrayRange(values.size(), index, index + 1);
+    values[index] = arrayItemFromPython(item, static_cast<const T*>(0));
 }
 
-
-ExifTag::ExifTag(const std::string& key,
-                 Exiv2::Exifdatum* datum, Exiv2::ExifData* data,
-                 Exiv2::ByteOrder byteOrder):
-    _key(key), _byteOrder(byteOrder)
+template <typename T>
+static boost::python::list getArrayItems(const std::vector<T>& values,
+                                         long start, long stop)
 {
-    if (datum != 0 && data != 0)
+    checkArrayRange(values.size(), start, stop);
+    boost::python::list items;
+    for (long i = start; i < stop; ++i)
     {
-        _datum = datum;
-        _data = data;
+        items.append(arrayItemToPython(values[i]));
     }
-    else
+    return items;
+}
+
+template <typename T>
+static void setArrayItems(std::vector<T>& values, long start, long stop,
+                          const boost::python::object& items, bool resizable)
+{
+    checkArrayRange(values.size(), start, stop);
+    // Convert all the items first, so that the values are left untouched if
+    // one of them is invalid.
+    std::vector<T> converted;
+    const long length = boost::python::len(items);
+    converted.reserve(length);
+    for (long i = 0; i < length; ++i)
     {
-        _datum = new Exiv2::Exifdatum(_key);
-        _data = 0;
+        converted.push_back(arrayItemFromPython(items[i],
+                                                static_cast<const T*>(0)));
     }
 
-// Conditional code, exiv2 0.21 changed APIs we need
-// (see https://bugs.launchpad.net/pyexiv2/+bug/684177).
-#if EXIV2_TEST_VERSION(0,21,0)
-    Exiv2::ExifKey exifKey(key);
-    _type = Exiv2::TypeInfo::typeName(exifKey.defaultTypeId());
-    // Where available, extract the type from the metadata, it is more reliable
-    // than static type information. The exception is for user comments, for
-    // which we’d rather keep the 'Comment' type instead of 'Undefined'.
-    if ((_data != 0) && (_type != "Comment"))
+    if (length == stop - start)
     {
-        const char* typeName = _datum->typeName();
-        if (typeName != 0)
-        {
-            _type = typeName;
-        }
+        std::copy(converted.begin(), converted.end(), values.begin() + start);
+        return;
     }
-    _name = exifKey.tagName();
-    _label = exifKey.tagLabel();
-    _description = exifKey.tagDesc();
-    _sectionName = Exiv2::ExifTags::sectionName(exifKey);
-    // The section description is not exposed in the API any longer
-    // (see http://dev.exiv2.org/issues/744). For want of anything better,
-    // fall back on the section’s name.
-    _sectionDescription = _sectionName;
-#else
-    const uint16_t tag = _datum->tag();
-    const Exiv2::IfdId ifd = _datum->ifdId();
-    _type = Exiv2::TypeInfo::typeName(Exiv2::ExifTags::tagType(tag, ifd));
-    // Where available, extract the type from the metadata, it is more reliable
-    // than static type information. The exception is for user comments, for
-    // which we’d rather keep the 'Comment' type instead of 'Undefined'.
-    if ((_data != 0) && (_type != "Comment"))
+    if (!resizable)
     {
-        const char* typeName = _datum->typeName();
-        if (typeName != 0)
-        {
-            _type = typeName;
-        }
+        throw Exiv2::Error(BUFFER_EXPORTED);
     }
-    _name = Exiv2::ExifTags::tagName(tag, ifd);
-    _label = Exiv2::ExifTags::tagLabel(tag, ifd);
-    _description = Exiv2::ExifTags::tagDesc(tag, ifd);
-    _sectionName = Exiv2::ExifTags::sectionName(tag, ifd);
-    _sectionDescription = Exiv2::ExifTags::sectionDesc(tag, ifd);
-#endif
+    values.erase(values.begin() + start, values.begin() + stop);
+    values.insert(values.begin() + start, converted.begin(), converted.end());
 }
 
-ExifTag::~ExifTag()
+template <typename T>
+static void* arrayData(std::vector<T>& values, Py_ssize_t& count)
 {
-    if (_data == 0)
-    {
-        delete _datum;
-    }
+    // An empty buffer still needs a valid address.
+    static T empty;
+    count = values.size();
+    return values.empty() ? &empty : &values[0];
 }
 
-void ExifTag::setRawValue(const std::string& value)
+// Evaluate a statement on the values of the array, bound to "values" with
+// their actual type. write tells whether the statement modifies the values.
+#define ON_ARRAY_VALUES(write, statement) \
+    switch (_type) \
+    { \
+        case Exiv2::unsignedShort: \
+        { \
+            std::vector<uint16_t>& values = arrayValues<uint16_t>(_getValue(write)); \
+            statement; \
+            break; \
+        } \
+        case Exiv2::signedShort: \
+        { \
+            std::vector<int16_t>& values = arrayValues<int16_t>(_getValue(write)); \
+            statement; \
+            break; \
+        } \
+        case Exiv2::unsignedLong: \
+        { \
+            std::vector<uint32_t>& values = arrayValues<uint32_t>(_getValue(write)); \
+            statement; \
+            break; \
+        } \
+        case Exiv2::signedLong: \
+        { \
+            std::vector<int32_t>& values = arrayValues<int32_t>(_getValue(write)); \
+            statement; \
+            break; \
+        } \
+        case Exiv2::unsignedRational: \
+        { \
+            std::vector<Exiv2::URational>& values = \
+                arrayValues<Exiv2::URational>(_getValue(write)); \
+            statement; \
+            break; \
+        } \
+        case Exiv2::signedRational: \
+        { \
+            std::vector<Exiv2::Rational>& values = \
+                arrayValues<Exiv2::Rational>(_getValue(write)); \
+            statement; \
+            break; \
+        } \
+        default: \
+            throw Exiv2::Error(INVALID_VALUE); \
+    }
+
+ExifArray::ExifArray(ExifTag& tag):
+    _tag(&tag), _type(Exiv2::TypeInfo::typeId(tag.getType())), _exports(0)
 {
-    int result = _datum->setValue(value);
-    if (result != 0)
+    if (!isArrayType(_type))
     {
         throw Exiv2::Error(INVALID_VALUE);
     }
 }
 
-void ExifTag::setParentImage(Image& image)
+Exiv2::Value& ExifArray::_getValue(bool write)
 {
-    Exiv2::ExifData* data = image.getExifData();
-    if (data == _data)
+    if (_tag == 0)
     {
-        // The parent image is already the one passed as a parameter.
-        // This happens when replacing a tag by itself. In this case, don’t do
-        // anything (see https://bugs.launchpad.net/pyexiv2/+bug/622739).
-        return;
+        return *_value;
     }
-    _data = data;
-    Exiv2::Value::AutoPtr value = _datum->getValue();
-    delete _datum;
-    _datum = &(*_data)[_key.key()];
-    _datum->setValue(value.get());
 
-    _byteOrder = image.getByteOrder();
+    _tag->_checkHandle(write);
+    Exiv2::Exifdatum* datum = _tag->_datum;
+    if (datum->typeId() != _type)
+    {
+        if (datum->count() > 0)
+        {
+            // The tag was given values of another type in the meantime.
+            throw Exiv2::Error(INVALID_VALUE);
+        }
+        if (!write)
+        {
+            // Which modifies the datum.
+            _tag->_checkHandle(true);
+            datum = _tag->_datum;
+        }
+        // No values yet, start from an empty array.
+        Exiv2::Value::AutoPtr value = Exiv2::Value::create(_type);
+        datum->setValue(value.get());
+    }
+    // The value is owned by the datum, which is not const.
+    return const_cast<Exiv2::Value&>(datum->value());
 }
 
-const std::string ExifTag::getKey()
+long ExifArray::getLength()
 {
-    return _key.key();
+    ON_ARRAY_VALUES(false, return static_cast<long>(values.size()))
 }
 
-const std::string ExifTag::getType()
+boost::python::object ExifArray::getItem(long index)
 {
-    return _type;
+    ON_ARRAY_VALUES(false, return getArrayItem(values, index))
 }
 
-const std::string ExifTag::getName()
+void ExifArray::setItem(long index, const boost::python::object& item)
 {
-    return _name;
+    ON_ARRAY_VALUES(true, setArrayItem(values, index, item))
 }
 
-const std::string ExifTag::getLabel()
+boost::python::list ExifArray::getItems(long start, long stop)
 {
-    return _label;
+    ON_ARRAY_VALUES(false, return getArrayItems(values, start, stop))
 }
 
-const std::string ExifTag::getDescription()
+void ExifArray::setItems(long start, long stop,
+                         const boost::python::object& items)
 {
-    return _description;
+    ON_ARRAY_VALUES(true, setArrayItems(values, start, stop, items, _exports == 0))
 }
 
-const std::string ExifTag::getSectionName()
+void ExifArray::detach()
 {
-    return _sectionName;
+    if (_tag == 0)
+    {
+        return;
+    }
+    if (_exports > 0)
+    {
+        throw Exiv2::Error(BUFFER_EXPORTED);
+    }
+    Exiv2::Value::AutoPtr value = _getValue(false).clone();
+    _value = value;
+    _tag = 0;
 }
 
-const std::string ExifTag::getSectionDescription()
+void ExifArray::_exportBuffer(PyObject* self, Py_buffer* view, int flags)
 {
-    return _sectionDescription;
-}
+    void* data;
+    Py_ssize_t count;
+    // The buffer is writable.
+    ON_ARRAY_VALUES(true, data = arrayData(values, count))
+
+    const bool rational = (_type == Exiv2::unsignedRational) ||
+                          (_type == Exiv2::signedRational);
+    const char* format;
+    switch (_type)
+    {
+        case Exiv2::unsignedShort:
+            format = "H";
+            break;
+        case Exiv2::signedShort:
+            format = "h";
+            break;
+        case Exiv2::unsignedLong:
+        case Exiv2::unsignedRational:
+            format = "I";
+            break;
+        default:
+            format = "i";
+    }
 
-const std::string ExifTag::getRawValue()
-{
-    return _datum->toString();
+    view->buf = data;
+    view->obj = self;
+    view->itemsize = ((_type == Exiv2::unsignedShort) ||
+                      (_type == Exiv2::signedShort)) ? 2 : 4;
+    view->len = count * (rational ? 2 : 1) * view->itemsize;
+    view->readonly = 0;
+    view->ndim = rational ? 2 : 1;
+    view->format = ((flags & PyBUF_FORMAT) == PyBUF_FORMAT) ?
+                   const_cast<char*>(format) : 0;
+    _shape[0] = count;
+    _shape[1] = 2;
+    view->shape = ((flags & PyBUF_ND) == PyBUF_ND) ? _shape : 0;
+    _strides[0] = rational ? 2 * view->itemsize : view->itemsize;
+    _strides[1] = view->itemsize;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? _strides : 0;
+    view->suboffsets = 0;
+    view->internal = 0;
+
+    Py_INCREF(self);
+    ++_exports;
+    if (_tag != 0)
+    {
+        ++_tag->_exports;
+        if (_tag->_parent != 0)
+        {
+            ++_tag->_parent->_exports;
+        }
+    }
 }
 
-const std::string ExifTag::getHumanValue()
+int ExifArray::getBuffer(PyObject* self, Py_buffer* view, int flags)
 {
-    return _datum->print(_data);
+    try
+    {
+        ExifArray& array = boost::python::extract<ExifArray&>(self);
+        array._exportBuffer(self, view, flags);
+        return 0;
+    }
+    catch (Exiv2::Error& error)
+    {
+        translateExiv2Error(error);
+    }
+    catch (boost::python::error_already_set&)
+    {
+    }
+    view->obj = 0;
+    return -1;
 }
 
-int ExifTag::getByteOrder()
+void ExifArray::releaseBuffer(PyObject* self, Py_buffer* view)
 {
-    return _byteOrder;
+    ExifArray& array = boost::python::extract<ExifArray&>(self);
+    --array._exports;
+    if (array._tag != 0)
+    {
+        --array._tag->_exports;
+        // The tag cannot be bound to another image, nor removed from its
+        // image, while the buffer is exported.
+        if (array._tag->_parent != 0)
+        {
+            --array._tag->_parent->_exports;
+        }
+    }
 }
 
 
-IptcTag::IptcTag(const std::string& key, Exiv2::IptcData* data): _key(key)
+IptcTag::IptcTag(const std::string& key, Exiv2::IptcData* data, bool copy,
+                 Image* parent):
+    _key(key), _parent(copy ? 0 : parent),
+    _generation((_parent != 0) ? _parent->_generation : 0), _writable(false)
 {
-    _from_data = (data != 0);
+    _from_data = (data != 0) && !copy;
 
     if (_from_data)
     {
         _data = data;
     }
+    else if (data != 0)
+    {
+        _data = new Exiv2::IptcData();
+        for (Exiv2::IptcMetadata::const_iterator i = data->begin();
+             i != data->end(); ++i)
+        {
+            if (i->key() == key)
+            {
+                _data->add(*i);
+            }
+        }
+    }
     else
     {
         _data = new Exiv2::IptcData();
         _data->add(Exiv2::Iptcdatum(_key));
     }
 
-    Exiv2::IptcMetadata::iterator iterator = _data->findKey(_key);
-    const uint16_t tag = iterator->tag();
-    const uint16_t record = iterator->record();
-    _type = Exiv2::TypeInfo::typeName(Exiv2::IptcDataSets::dataSetType(tag, record));
-    _name = Exiv2::IptcDataSets::dataSetName(tag, record);
-    _title = Exiv2::IptcDataSets::dataSetTitle(tag, record);
-    _description = Exiv2::IptcDataSets::dataSetDesc(tag, record);
-    // What is the photoshop name anyway? Where is it used?
-    _photoshopName = Exiv2::IptcDataSets::dataSetPsName(tag, record);
-    _repeatable = Exiv2::IptcDataSets::dataSetRepeatable(tag, record);
-    _recordName = Exiv2::IptcDataSets::recordName(record);
-    _recordDescription = Exiv2::IptcDataSets::recordDesc(record);
-
     if (_from_data)
     {
         // Check that we are not trying to assign multiple values to a tag that
         // is not repeatable.
+        const bool repeatable = isRepeatable();
         unsigned int nb_values = 0;
         for(Exiv2::IptcMetadata::iterator iterator = _data->begin();
             iterator != _data->end(); ++iterator)
@@ -721,7 +3416,7 @@ IptcTag::IptcTag(const std::string& key, Exiv2::IptcData* data): _key(key)
             if (iterator->key() == key)
             {
                 ++nb_values;
-                if (!_repeatable && (nb_values > 1))
+                if (!repeatable && (nb_values > 1))
                 {
                     throw Exiv2::Error(NON_REPEATABLE);
                 }
@@ -730,6 +3425,41 @@ IptcTag::IptcTag(const std::string& key, Exiv2::IptcData* data): _key(key)
     }
 }
 
+IptcTag::IptcTag(const IptcTag& other):
+    _key(other._key), _from_data(other._from_data), _data(other._data),
+    _parent(other._parent), _generation(other._generation),
+    _writable(other._writable)
+{
+    if (!_from_data)
+    {
+        _data = new Exiv2::IptcData(*other._data);
+    }
+}
+
+IptcTag& IptcTag::operator=(const IptcTag& other)
+{
+    if (this == &other)
+    {
+        return *this;
+    }
+    Exiv2::IptcData* data = other._data;
+    if (!other._from_data)
+    {
+        data = new Exiv2::IptcData(*other._data);
+    }
+    if (!_from_data)
+    {
+        delete _data;
+    }
+    _key = other._key;
+    _from_data = other._from_data;
+    _data = data;
+    _parent = other._parent;
+    _generation = other._generation;
+    _writable = other._writable;
+    return *this;
+}
+
 IptcTag::~IptcTag()
 {
     if (!_from_data)
@@ -738,15 +3468,60 @@ IptcTag::~IptcTag()
     }
 }
 
+void IptcTag::_revalidate(bool write)
+{
+    if ((_parent == 0) ||
+        ((_generation == _parent->_generation) && (_writable || !write)))
+    {
+        return;
+    }
+
+    // Other threads may be using the image.
+    if (write)
+    {
+        WriteLock lock(_parent->getMutex());
+        _lookUpData(true);
+    }
+    else
+    {
+        ReadLock lock(_parent->getMutex());
+        _lookUpData(false);
+    }
+}
+
+void IptcTag::_lookUpData(bool write)
+{
+    if ((_parent == 0) ||
+        ((_generation == _parent->_generation) && (_writable || !write)))
+    {
+        return;
+    }
+
+    if (write)
+    {
+        // The image may share its metadata with a clone.
+        _parent->_detach();
+    }
+    _data = _parent->_iptcData;
+    _generation = _parent->_generation;
+    _writable = write;
+}
+
 void IptcTag::setRawValues(const boost::python::list& values)
 {
-    if (!_repeatable && (boost::python::len(values) > 1))
+    _revalidate(true);
+    if (!isRepeatable() && (boost::python::len(values) > 1))
     {
         // The tag is not repeatable but we are trying to assign it more than
         // one value.
         throw Exiv2::Error(NON_REPEATABLE);
     }
 
+    if (_parent != 0)
+    {
+        _parent->invalidateIptcCharset();
+    }
+
     unsigned int index = 0;
     unsigned int max = boost::python::len(values);
     Exiv2::IptcMetadata::iterator iterator = _data->findKey(_key);
@@ -802,7 +3577,18 @@ void IptcTag::setRawValues(const boost::python::list& values)
 
 void IptcTag::setParentImage(Image& image)
 {
+    boost::python::list values;
+    if (_parent != &image)
+    {
+        // Not with the lock of the new parent image held.
+        values = getRawValues();
+    }
+    WriteLock lock(image.getMutex());
     Exiv2::IptcData* data = image.getIptcData();
+    if (_parent == &image)
+    {
+        _lookUpData(true);
+    }
     if (data == _data)
     {
         // The parent image is already the one passed as a parameter.
@@ -810,10 +3596,12 @@ void IptcTag::setParentImage(Image& image)
         // anything (see https://bugs.launchpad.net/pyexiv2/+bug/622739).
         return;
     }
-    const boost::python::list values = getRawValues();
     delete _data;
     _from_data = true;
     _data = data;
+    _parent = &image;
+    _generation = image._generation;
+    _writable = true;
     setRawValues(values);
 }
 
@@ -824,46 +3612,49 @@ const std::string IptcTag::getKey()
 
 const std::string IptcTag::getType()
 {
-    return _type;
+    return Exiv2::TypeInfo::typeName(
+        Exiv2::IptcDataSets::dataSetType(_key.tag(), _key.record()));
 }
 
 const std::string IptcTag::getName()
 {
-    return _name;
+    return Exiv2::IptcDataSets::dataSetName(_key.tag(), _key.record());
 }
 
 const std::string IptcTag::getTitle()
 {
-    return _title;
+    return Exiv2::IptcDataSets::dataSetTitle(_key.tag(), _key.record());
 }
 
 const std::string IptcTag::getDescription()
 {
-    return _description;
+    return Exiv2::IptcDataSets::dataSetDesc(_key.tag(), _key.record());
 }
 
 const std::string IptcTag::getPhotoshopName()
 {
-    return _photoshopName;
+    // What is the photoshop name anyway? Where is it used?
+    return Exiv2::IptcDataSets::dataSetPsName(_key.tag(), _key.record());
 }
 
 const bool IptcTag::isRepeatable()
 {
-    return _repeatable;
+    return Exiv2::IptcDataSets::dataSetRepeatable(_key.tag(), _key.record());
 }
 
 const std::string IptcTag::getRecordName()
 {
-    return _recordName;
+    return Exiv2::IptcDataSets::recordName(_key.record());
 }
 
 const std::string IptcTag::getRecordDescription()
 {
-    return _recordDescription;
+    return Exiv2::IptcDataSets::recordDesc(_key.record());
 }
 
 const boost::python::list IptcTag::getRawValues()
 {
+    _revalidate(false);
     boost::python::list values;
     for(Exiv2::IptcMetadata::iterator iterator = _data->begin();
         iterator != _data->end(); ++iterator)
@@ -876,40 +3667,130 @@ const boost::python::list IptcTag::getRawValues()
     return values;
 }
 
+std::string IptcTag::_charset()
+{
+    // The charset of the whole IPTC data is cached by the image, a
+    // standalone tag can only guess it from its own values.
+    return (_parent != 0) ? _parent->getIptcCharset() : detectIptcCharset(*_data);
+}
+
+const boost::python::list IptcTag::getStringValues()
+{
+    _revalidate(false);
+    const std::string charset = _charset();
+
+    boost::python::list values;
+    for(Exiv2::IptcMetadata::iterator iterator = _data->begin();
+        iterator != _data->end(); ++iterator)
+    {
+        if (iterator->key() != _key.key())
+        {
+            continue;
+        }
+        const std::string value = iterator->toString();
+        PyObject* decoded;
+        if (charset == "UTF-8")
+        {
+            decoded = PyUnicode_DecodeUTF8(value.data(), value.size(), "replace");
+        }
+        else if (charset == "ASCII")
+        {
+            decoded = PyUnicode_DecodeASCII(value.data(), value.size(), "replace");
+        }
+        else
+        {
+            // Legacy IPTC data without any charset information is most
+            // commonly Latin-1, which can decode any byte sequence.
+            decoded = PyUnicode_DecodeLatin1(value.data(), value.size(), "replace");
+        }
+        if (decoded == 0)
+        {
+            boost::python::throw_error_already_set();
+        }
+        values.append(boost::python::object(boost::python::handle<>(decoded)));
+    }
+    return values;
+}
+
+const std::string IptcTag::getStringEncoding()
+{
+    _revalidate(false);
+    const std::string charset = _charset();
+    if ((charset == "UTF-8") || (charset == "ASCII"))
+    {
+        return "utf-8";
+    }
+    return "latin-1";
+}
+
+
+// Build an XMP key, locking the namespace registry if needed.
+static Exiv2::XmpKey lockedXmpKey(const std::string& key)
+{
+    return cachedXmpPropertyDetails<ReadLock>(key)->key;
+}
 
-XmpTag::XmpTag(const std::string& key, Exiv2::Xmpdatum* datum): _key(key)
+XmpTag::XmpTag(const std::string& key, Exiv2::Xmpdatum* datum, bool copy,
+               Image* parent):
+    _key(lockedXmpKey(key)), _parent(copy ? 0 : parent),
+    _generation((_parent != 0) ? _parent->_generation : 0), _writable(false)
 {
-    _from_datum = (datum != 0);
+    _details = cachedXmpPropertyDetails<ReadLock>(key);
+    _from_datum = (datum != 0) && !copy;
 
     if (_from_datum)
     {
         _datum = datum;
         _exiv2_type = datum->typeName();
     }
+    else if (datum != 0)
+    {
+        _datum = new Exiv2::Xmpdatum(*datum);
+        _exiv2_type = datum->typeName();
+    }
     else
     {
         _datum = new Exiv2::Xmpdatum(_key);
-        _exiv2_type = Exiv2::TypeInfo::typeName(Exiv2::XmpProperties::propertyType(_key));
+        _exiv2_type = Exiv2::TypeInfo::typeName(_details->type);
     }
+}
 
-    const char* title = Exiv2::XmpProperties::propertyTitle(_key);
-    if (title != 0)
+XmpTag::XmpTag(const XmpTag& other):
+    _key(other._key), _from_datum(other._from_datum), _datum(other._datum),
+    _exiv2_type(other._exiv2_type), _details(other._details),
+    _parent(other._parent), _generation(other._generation),
+    _writable(other._writable)
+{
+    if (!_from_datum)
     {
-        _title = title;
+        _datum = new Exiv2::Xmpdatum(*other._datum);
     }
+}
 
-    const char* description = Exiv2::XmpProperties::propertyDesc(_key);
-    if (description != 0)
+XmpTag& XmpTag::operator=(const XmpTag& other)
+{
+    if (this == &other)
     {
-        _description = description;
+        return *this;
     }
-
-    const Exiv2::XmpPropertyInfo* info = Exiv2::XmpProperties::propertyInfo(_key);
-    if (info != 0)
+    Exiv2::Xmpdatum* datum = other._datum;
+    if (!other._from_datum)
+    {
+        datum = new Exiv2::Xmpdatum(*other._datum);
+    }
+    if (!_from_datum)
     {
-        _name = info->name_;
-        _type = info->xmpValueType_;
+        delete _datum;
     }
+    _key = other._key;
+    _from_datum = other._from_datum;
+    _datum = datum;
+    _exiv2_type = other._exiv2_type;
+    _details = other._details;
+    _parent = other._parent;
+    _generation = other._generation;
+    _writable = other._writable;
+    return *this;
 }
 
 XmpTag::~XmpTag()
@@ -920,13 +3801,83 @@ XmpTag::~XmpTag()
     }
 }
 
+bool XmpTag::_revalidate(bool write)
+{
+    if ((_parent == 0) ||
+        ((_generation == _parent->_generation) && (_writable || !write)))
+    {
+        return true;
+    }
+
+    // Other threads may be using the image. Parsing a pending XMP packet
+    // restructures the metadata, which requires the lock exclusively.
+    if (!write)
+    {
+        ReadLock lock(_parent->getMutex());
+        if (!_parent->_xmpPacketPending)
+        {
+            return _lookUpDatum(false);
+        }
+    }
+    WriteLock lock(_parent->getMutex());
+    return _lookUpDatum(write);
+}
+
+bool XmpTag::_lookUpDatum(bool write)
+{
+    if ((_parent == 0) ||
+        ((_generation == _parent->_generation) && (_writable || !write)))
+    {
+        return true;
+    }
+
+    if (write)
+    {
+        // The image may share its metadata with a clone.
+        _parent->_detach();
+    }
+    if (_parent->_xmpPacketPending)
+    {
+        _parent->_decodeXmpPacket();
+    }
+    _generation = _parent->_generation;
+    _writable = write;
+    Exiv2::XmpMetadata::iterator i = _parent->_xmpData->findKey(_key);
+    if (i != _parent->_xmpData->end())
+    {
+        _datum = &(*i);
+        if (write)
+        {
+            // The XMP data has to be serialized again when written.
+            _parent->_xmpModified = true;
+        }
+        return true;
+    }
+
+    // The tag was removed from the image, and its datum with it.
+    _datum = new Exiv2::Xmpdatum(_key);
+    _from_datum = false;
+    _parent = 0;
+    return false;
+}
+
+void XmpTag::_checkHandle(bool write)
+{
+    if (!_revalidate(write))
+    {
+        throw Exiv2::Error(KEY_NOT_FOUND, _key.key());
+    }
+}
+
 void XmpTag::setTextValue(const std::string& value)
 {
+    _checkHandle(true);
     _datum->setValue(value);
 }
 
 void XmpTag::setArrayValue(const boost::python::list& values)
 {
+    _checkHandle(true);
     // Reset the value
     _datum->setValue(0);
 
@@ -940,6 +3891,7 @@ void XmpTag::setArrayValue(const boost::python::list& values)
 
 void XmpTag::setLangAltValue(const boost::python::dict& values)
 {
+    _checkHandle(true);
     // Reset the value
     _datum->setValue(0);
 
@@ -953,9 +3905,40 @@ void XmpTag::setLangAltValue(const boost::python::dict& values)
     }
 }
 
+void XmpTag::setLangAltItem(const std::string& lang, const std::string& value)
+{
+    _checkHandle(true);
+    if (_datum->typeId() == Exiv2::langAlt)
+    {
+        // The datum owns its value, update it in place rather than
+        // formatting and parsing it again.
+        Exiv2::LangAltValue& langAlt = const_cast<Exiv2::LangAltValue&>(
+            dynamic_cast<const Exiv2::LangAltValue&>(_datum->value()));
+        langAlt.value_[lang] = value;
+    }
+    else
+    {
+        Exiv2::LangAltValue langAlt;
+        langAlt.value_[lang] = value;
+        _datum->setValue(&langAlt);
+    }
+}
+
 void XmpTag::setParentImage(Image& image)
 {
-    Exiv2::Xmpdatum* datum = &(*image.getXmpData())[_key.key()];
+    if (_parent != &image)
+    {
+        // Not with the lock of the new parent image held.
+        _revalidate(false);
+    }
+    WriteLock lock(image.getMutex());
+    if (_parent == &image)
+    {
+        _lookUpDatum(true);
+    }
+    Exiv2::Xmpdatum* datum = &findOrAddXmpDatum(*image.getXmpData(), _key);
+    _generation = image._generation;
+    _writable = true;
     if (datum == _datum)
     {
         // The parent image is already the one passed as a parameter.
@@ -964,102 +3947,432 @@ void XmpTag::setParentImage(Image& image)
         return;
     }
     Exiv2::Value::AutoPtr value = _datum->getValue();
-    delete _datum;
+    if (!_from_datum)
+    {
+        delete _datum;
+    }
     _from_datum = true;
-    _datum = &(*image.getXmpData())[_key.key()];
+    _datum = datum;
     _datum->setValue(value.get());
+    _parent = &image;
+}
+
+const std::string XmpTag::getKey()
+{
+    return _key.key();
+}
+
+const std::string XmpTag::getExiv2Type()
+{
+    return (_exiv2_type != 0) ? _exiv2_type : "";
+}
+
+const std::string XmpTag::getType()
+{
+    return _details->xmpValueType;
+}
+
+const std::string XmpTag::getName()
+{
+    return _details->name;
+}
+
+const std::string XmpTag::getTitle()
+{
+    return _details->title;
+}
+
+const std::string XmpTag::getDescription()
+{
+    return _details->description;
+}
+
+const std::string XmpTag::getTextValue()
+{
+    _checkHandle(false);
+    return dynamic_cast<const Exiv2::XmpTextValue*>(&_datum->value())->value_;
+}
+
+const boost::python::list XmpTag::getArrayValue()
+{
+    _checkHandle(false);
+    const std::vector<std::string>& value =
+        dynamic_cast<const Exiv2::XmpArrayValue*>(&_datum->value())->value_;
+    boost::python::list rvalue;
+    for(std::vector<std::string>::const_iterator i = value.begin();
+        i != value.end(); ++i)
+    {
+        rvalue.append(*i);
+    }
+    return rvalue;
+}
+
+const boost::python::dict XmpTag::getLangAltValue()
+{
+    _checkHandle(false);
+    const Exiv2::LangAltValue::ValueType& value =
+        dynamic_cast<const Exiv2::LangAltValue*>(&_datum->value())->value_;
+    boost::python::dict rvalue;
+    for (Exiv2::LangAltValue::ValueType::const_iterator i = value.begin();
+         i != value.end(); ++i)
+    {
+        rvalue[i->first] = i->second;
+    }
+    return rvalue;
+}
+
+const std::string XmpTag::getLangAltItem(const std::string& lang,
+                                         const std::string& fallback)
+{
+    _checkHandle(false);
+    if (_datum->typeId() == Exiv2::langAlt)
+    {
+        const Exiv2::LangAltValue::ValueType& value =
+            dynamic_cast<const Exiv2::LangAltValue*>(&_datum->value())->value_;
+        Exiv2::LangAltValue::ValueType::const_iterator i = value.find(lang);
+        if ((i == value.end()) && !fallback.empty())
+        {
+            i = value.find(fallback);
+        }
+        if (i != value.end())
+        {
+            return i->second;
+        }
+    }
+    throw Exiv2::Error(KEY_NOT_FOUND, lang);
+}
+
+
+Preview::Preview(const Exiv2::PreviewImage& previewImage)
+{
+    _mimeType = previewImage.mimeType();
+    _extension = previewImage.extension();
+    _size = previewImage.size();
+    _dimensions = boost::python::make_tuple(previewImage.width(),
+                                            previewImage.height());
+    // Copy the data buffer in a string. Since the data buffer can contain null
+    // characters ('\x00'), the string cannot be simply constructed like that:
+    //     _data = std::string((char*) previewImage.pData());
+    // because it would be truncated after the first occurence of a null
+    // character. Therefore, it has to be copied character by character.
+    const Exiv2::byte* pData = previewImage.pData();
+    // First allocate the memory for the whole string...
+    _data = std::string(_size, ' ');
+    // ... then fill it with the raw data.
+    for(unsigned int i = 0; i < _size; ++i)
+    {
+        _data[i] = pData[i];
+    }
+}
+
+void Preview::writeToFile(const std::string& path) const
+{
+    std::string filename = path + _extension;
+    std::ofstream fd(filename.c_str(), std::ios::out | std::ios::binary);
+    fd << _data;
+    fd.close();
+}
+
+
+ImageSnapshot::ImageSnapshot(const boost::shared_ptr<Exiv2::Image>& image):
+    _image(image)
+{
+}
+
+boost::python::list ImageSnapshot::exifKeys() const
+{
+    boost::python::list keys;
+    const Exiv2::ExifData& exifData = _image->exifData();
+    for(Exiv2::ExifMetadata::const_iterator i = exifData.begin();
+        i != exifData.end();
+        ++i)
+    {
+        keys.append(i->key());
+    }
+    return keys;
+}
+
+boost::python::list ImageSnapshot::iptcKeys() const
+{
+    boost::python::list keys;
+    const Exiv2::IptcData& iptcData = _image->iptcData();
+    for(Exiv2::IptcMetadata::const_iterator i = iptcData.begin();
+        i != iptcData.end();
+        ++i)
+    {
+        // The key is appended to the list if and only if it is not already
+        // present.
+        if (keys.count(i->key()) == 0)
+        {
+            keys.append(i->key());
+        }
+    }
+    return keys;
+}
+
+boost::python::list ImageSnapshot::xmpKeys() const
+{
+    boost::python::list keys;
+    const Exiv2::XmpData& xmpData = _image->xmpData();
+    for(Exiv2::XmpMetadata::const_iterator i = xmpData.begin();
+        i != xmpData.end();
+        ++i)
+    {
+        keys.append(i->key());
+    }
+    return keys;
+}
+
+const ExifTag ImageSnapshot::getExifTag(std::string key) const
+{
+    Exiv2::ExifKey exifKey = Exiv2::ExifKey(key);
+    const Exiv2::ExifData& exifData = _image->exifData();
+    Exiv2::ExifMetadata::const_iterator datum = exifData.findKey(exifKey);
+    if(datum == exifData.end())
+    {
+        throw Exiv2::Error(KEY_NOT_FOUND, key);
+    }
+
+    // The tag copies the datum, it is never modified through the pointer.
+    return ExifTag(key, const_cast<Exiv2::Exifdatum*>(&(*datum)), 0,
+                   _image->byteOrder(), true);
+}
+
+const IptcTag ImageSnapshot::getIptcTag(std::string key) const
+{
+    Exiv2::IptcKey iptcKey = Exiv2::IptcKey(key);
+    const Exiv2::IptcData& iptcData = _image->iptcData();
+    if(iptcData.findKey(iptcKey) == iptcData.end())
+    {
+        throw Exiv2::Error(KEY_NOT_FOUND, key);
+    }
+
+    // The tag copies the data, it is never modified through the pointer.
+    return IptcTag(key, const_cast<Exiv2::IptcData*>(&iptcData), true);
+}
+
+const XmpTag ImageSnapshot::getXmpTag(std::string key) const
+{
+    const Exiv2::XmpData& xmpData = _image->xmpData();
+    Exiv2::XmpMetadata::const_iterator datum;
+    datum = xmpData.findKey(cachedXmpPropertyDetails<ReadLock>(key)->key);
+    if(datum == xmpData.end())
+    {
+        throw Exiv2::Error(KEY_NOT_FOUND, key);
+    }
+
+    // The tag copies the datum, it is never modified through the pointer.
+    return XmpTag(key, const_cast<Exiv2::Xmpdatum*>(&(*datum)), true);
 }
 
-const std::string XmpTag::getKey()
+const std::string ImageSnapshot::getComment() const
 {
-    return _key.key();
+    return _image->comment();
 }
 
-const std::string XmpTag::getExiv2Type()
+
+MetadataTemplate::MetadataTemplate(const boost::python::dict& values)
 {
-    return _exiv2_type;
+    stageEdits(values, _exifData, _iptcData, _xmpData);
 }
 
-const std::string XmpTag::getType()
+// Return the python exception an error translates to, with the path of the
+// file it occurred on prepended to its message and set as its filename
+// attribute. To be called with the GIL held.
+static boost::python::object fileError(const Exiv2::Error& error,
+                                       const std::string& path)
 {
-    return _type;
+    translateExiv2Error(error);
+    PyObject* type;
+    PyObject* value;
+    PyObject* traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    boost::python::object exceptionType((boost::python::handle<>(type)));
+    boost::python::object original((boost::python::handle<>(value)));
+    Py_XDECREF(traceback);
+
+    std::string message = boost::python::extract<std::string>(
+        boost::python::str(original));
+    boost::python::object exception = exceptionType(path + ": " + message);
+    exception.attr("filename") = path;
+    return exception;
 }
 
-const std::string XmpTag::getName()
+boost::python::list MetadataTemplate::applyToFiles(
+    const boost::python::list& paths) const
 {
-    return _name;
+    std::vector<std::string> filenames;
+    for(boost::python::stl_input_iterator<std::string> iterator(paths);
+        iterator != boost::python::stl_input_iterator<std::string>();
+        ++iterator)
+    {
+        filenames.push_back(*iterator);
+    }
+
+    // The error of each file, if any. Exceptions have to be built outside of
+    // the Py_{BEGIN,END}_ALLOW_THREADS block.
+    std::vector<Exiv2::Error> errors(filenames.size(), Exiv2::Error(0));
+
+    // Release the GIL to allow other python threads to run
+    // while processing the files.
+    Py_BEGIN_ALLOW_THREADS
+
+    for (std::vector<std::string>::size_type i = 0; i < filenames.size(); ++i)
+    {
+        try
+        {
+            Exiv2::Image::AutoPtr image =
+                Exiv2::ImageFactory::open(filenames[i]);
+            readImageMetadata(*image);
+            applyEdits<XmpRegistryReadLock>(image->exifData(),
+                                            image->iptcData(),
+                                            image->xmpData(),
+                                            _exifData, _iptcData, _xmpData);
+            {
+                XmpRegistryReadLock registryLock(xmpRegistryMutex);
+#if EXIV2_TEST_VERSION(0,22,0)
+                image->writeXmpFromPacket(_xmpData.empty());
+#endif
+                image->writeMetadata();
+            }
+        }
+        catch (Exiv2::Error& err)
+        {
+            // Carry on with the other files.
+            errors[i] = err;
+        }
+    }
+
+    // Re-acquire the GIL
+    Py_END_ALLOW_THREADS
+
+    boost::python::list result;
+    for (std::vector<std::string>::size_type i = 0; i < filenames.size(); ++i)
+    {
+        if (errors[i].code() != 0)
+        {
+            result.append(fileError(errors[i], filenames[i]));
+        }
+        else
+        {
+            result.append(boost::python::object());
+        }
+    }
+    return result;
 }
 
-const std::string XmpTag::getTitle()
+const Exiv2::ExifData& MetadataTemplate::exifData() const
 {
-    return _title;
+    return _exifData;
 }
 
-const std::string XmpTag::getDescription()
+const Exiv2::IptcData& MetadataTemplate::iptcData() const
 {
-    return _description;
+    return _iptcData;
 }
 
-const std::string XmpTag::getTextValue()
+const Exiv2::XmpData& MetadataTemplate::xmpData() const
 {
-    return dynamic_cast<const Exiv2::XmpTextValue*>(&_datum->value())->value_;
+    return _xmpData;
 }
 
-const boost::python::list XmpTag::getArrayValue()
+
+// Match a key against a pattern in which '*' matches any sequence of
+// characters and '?' matches any single character.
+static bool matchPattern(const char* pattern, const char* key)
 {
-    std::vector<std::string> value =
-        dynamic_cast<const Exiv2::XmpArrayValue*>(&_datum->value())->value_;
-    boost::python::list rvalue;
-    for(std::vector<std::string>::const_iterator i = value.begin();
-        i != value.end(); ++i)
+    // Position of the last '*' seen in the pattern and of the character of
+    // the key it is being matched against, to backtrack on a mismatch.
+    const char* star = 0;
+    const char* backtrack = 0;
+    while (*key != '\0')
     {
-        rvalue.append(*i);
+        if ((*pattern == '?') || (*pattern == *key))
+        {
+            ++pattern;
+            ++key;
+        }
+        else if (*pattern == '*')
+        {
+            star = pattern++;
+            backtrack = key;
+        }
+        else if (star != 0)
+        {
+            pattern = star + 1;
+            key = ++backtrack;
+        }
+        else
+        {
+            return false;
+        }
     }
-    return rvalue;
+    while (*pattern == '*')
+    {
+        ++pattern;
+    }
+    return (*pattern == '\0');
 }
 
-const boost::python::dict XmpTag::getLangAltValue()
+RedactionPolicy::RedactionPolicy(const boost::python::list& patterns,
+                                 const boost::python::list& namespaces,
+                                 bool inPlace):
+    _inPlace(inPlace)
 {
-    Exiv2::LangAltValue::ValueType value =
-        dynamic_cast<const Exiv2::LangAltValue*>(&_datum->value())->value_;
-    boost::python::dict rvalue;
-    for (Exiv2::LangAltValue::ValueType::const_iterator i = value.begin();
-         i != value.end(); ++i)
+    for(boost::python::stl_input_iterator<std::string> iterator(patterns);
+        iterator != boost::python::stl_input_iterator<std::string>();
+        ++iterator)
     {
-        rvalue[i->first] = i->second;
+        _patterns.push_back(*iterator);
     }
-    return rvalue;
+
+    // Namespaces are resolved to key patterns when the policy is applied, as
+    // their prefixes may change in the meantime. Check that they are
+    // registered right away nonetheless.
+    for(boost::python::stl_input_iterator<std::string> iterator(namespaces);
+        iterator != boost::python::stl_input_iterator<std::string>();
+        ++iterator)
+    {
+        _namespaces.push_back(*iterator);
+    }
+    ReadLock registryLock(xmpRegistryMutex);
+    patterns();
 }
 
+std::vector<std::string> RedactionPolicy::patterns() const
+{
+    std::vector<std::string> patterns(_patterns);
+    for (std::vector<std::string>::const_iterator i = _namespaces.begin();
+         i != _namespaces.end(); ++i)
+    {
+        const std::string prefix = Exiv2::XmpProperties::prefix(*i);
+        if (prefix == "")
+        {
+            throw Exiv2::Error(NOT_REGISTERED, *i);
+        }
+        patterns.push_back("Xmp." + prefix + ".*");
+    }
+    return patterns;
+}
 
-Preview::Preview(const Exiv2::PreviewImage& previewImage)
+bool RedactionPolicy::matches(const std::vector<std::string>& patterns,
+                              const std::string& key)
 {
-    _mimeType = previewImage.mimeType();
-    _extension = previewImage.extension();
-    _size = previewImage.size();
-    _dimensions = boost::python::make_tuple(previewImage.width(),
-                                            previewImage.height());
-    // Copy the data buffer in a string. Since the data buffer can contain null
-    // characters ('\x00'), the string cannot be simply constructed like that:
-    //     _data = std::string((char*) previewImage.pData());
-    // because it would be truncated after the first occurence of a null
-    // character. Therefore, it has to be copied character by character.
-    const Exiv2::byte* pData = previewImage.pData();
-    // First allocate the memory for the whole string...
-    _data = std::string(_size, ' ');
-    // ... then fill it with the raw data.
-    for(unsigned int i = 0; i < _size; ++i)
+    for (std::vector<std::string>::const_iterator i = patterns.begin();
+         i != patterns.end(); ++i)
     {
-        _data[i] = pData[i];
+        if (matchPattern(i->c_str(), key.c_str()))
+        {
+            return true;
+        }
     }
+    return false;
 }
 
-void Preview::writeToFile(const std::string& path) const
+bool RedactionPolicy::inPlace() const
 {
-    std::string filename = path + _extension;
-    std::ofstream fd(filename.c_str(), std::ios::out | std::ios::binary);
-    fd << _data;
-    fd.close();
+    return _inPlace;
 }
 
 
@@ -1327,6 +4640,15 @@ void translateExiv2Error(Exiv2::Error const& error)
         case NOT_REGISTERED:
             PyErr_SetString(PyExc_KeyError, "No namespace registered under this name");
             break;
+        case TRANSACTION_IN_PROGRESS:
+            PyErr_SetString(PyExc_RuntimeError, "A transaction is already in progress");
+            break;
+        case NO_TRANSACTION:
+            PyErr_SetString(PyExc_RuntimeError, "No transaction in progress");
+            break;
+        case BUFFER_EXPORTED:
+            PyErr_SetString(PyExc_BufferError, "Cannot change the values while a buffer on them is exported");
+            break;
 
         // Default handler
         default:
@@ -1334,8 +4656,10 @@ void translateExiv2Error(Exiv2::Error const& error)
     }
 }
 
+// The namespace registry is modified with the GIL released, so that
+// readers holding the registry lock never wait for the GIL.
 
-void registerXmpNs(const std::string& name, const std::string& prefix)
+static void doRegisterXmpNs(const std::string& name, const std::string& prefix)
 {
     try
     {
@@ -1351,7 +4675,7 @@ void registerXmpNs(const std::string& name, const std::string& prefix)
     throw Exiv2::Error(EXISTING_PREFIX, prefix);
 }
 
-void unregisterXmpNs(const std::string& name)
+static void doUnregisterXmpNs(const std::string& name)
 {
     const std::string& prefix = Exiv2::XmpProperties::prefix(name);
     if (prefix != "")
@@ -1375,10 +4699,282 @@ void unregisterXmpNs(const std::string& name)
     } 
 }
 
+void registerXmpNs(const std::string& name, const std::string& prefix)
+{
+    Exiv2::Error error(0);
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try
+    {
+        XmpRegistryWriteLock registryLock(xmpRegistryMutex);
+        clearXmpPropertyCache();
+        doRegisterXmpNs(name, prefix);
+    }
+    catch (Exiv2::Error& err)
+    {
+        error = err;
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (error.code() != 0)
+    {
+        throw error;
+    }
+}
+
+void unregisterXmpNs(const std::string& name)
+{
+    Exiv2::Error error(0);
+
+    Py_BEGIN_ALLOW_THREADS
+
+    try
+    {
+        XmpRegistryWriteLock registryLock(xmpRegistryMutex);
+        clearXmpPropertyCache();
+        doUnregisterXmpNs(name);
+    }
+    catch (Exiv2::Error& err)
+    {
+        error = err;
+    }
+
+    Py_END_ALLOW_THREADS
+
+    if (error.code() != 0)
+    {
+        throw error;
+    }
+}
+
 void unregisterAllXmpNs()
 {
-    // Unregister all custom namespaces.
-    Exiv2::XmpProperties::unregisterNs();
+    Py_BEGIN_ALLOW_THREADS
+
+    {
+        XmpRegistryWriteLock registryLock(xmpRegistryMutex);
+        clearXmpPropertyCache();
+        // Unregister all custom namespaces.
+        Exiv2::XmpProperties::unregisterNs();
+    }
+
+    Py_END_ALLOW_THREADS
+}
+
+boost::python::list humanDumpFiles(const boost::python::list& paths,
+                                   const std::string& format)
+{
+    const bool json = isJsonDumpFormat(format);
+
+    std::vector<std::string> filenames;
+    for(boost::python::stl_input_iterator<std::string> iterator(paths);
+        iterator != boost::python::stl_input_iterator<std::string>();
+        ++iterator)
+    {
+        filenames.push_back(*iterator);
+    }
+    // The dumps are appended to the scratch buffer one after the other, the
+    // offsets of their ends are recorded to split them afterwards.
+    std::string& out = getScratchBuffer();
+    std::vector<std::string::size_type> ends;
+    ends.reserve(filenames.size());
+
+    // The error of each file, if any. Exceptions have to be built outside of
+    // the Py_{BEGIN,END}_ALLOW_THREADS block.
+    std::vector<Exiv2::Error> errors(filenames.size(), Exiv2::Error(0));
+
+    // Release the GIL to allow other python threads to run
+    // while processing the files.
+    Py_BEGIN_ALLOW_THREADS
+
+    for (std::vector<std::string>::size_type i = 0; i < filenames.size(); ++i)
+    {
+        const std::string::size_type start = out.size();
+        try
+        {
+            Exiv2::Image::AutoPtr image =
+                Exiv2::ImageFactory::open(filenames[i]);
+            readImageMetadata(*image);
+            dumpMetadata(out, image->exifData(), image->iptcData(),
+                         image->xmpData(), json);
+        }
+        catch (Exiv2::Error& err)
+        {
+            // Drop the partial dump and carry on with the other files.
+            out.resize(start);
+            errors[i] = err;
+        }
+        ends.push_back(out.size());
+    }
+
+    // Re-acquire the GIL
+    Py_END_ALLOW_THREADS
+
+    boost::python::list result;
+    std::string::size_type start = 0;
+    for (std::vector<std::string>::size_type i = 0; i < filenames.size(); ++i)
+    {
+        if (errors[i].code() != 0)
+        {
+            result.append(fileError(errors[i], filenames[i]));
+        }
+        else
+        {
+            result.append(boost::python::str(out.data() + start,
+                                             ends[i] - start));
+        }
+        start = ends[i];
+    }
+    trimScratchBuffer();
+    return result;
+}
+
+// Append the description of a known tag to a list.
+static void appendKnownTag(boost::python::list& tags, const std::string& key,
+                           const char* type, const char* label,
+                           const char* description)
+{
+    tags.append(boost::python::make_tuple(key,
+                                          std::string(type != 0 ? type : ""),
+                                          std::string(label != 0 ? label : ""),
+                                          std::string(description != 0 ? description : "")));
+}
+
+static void appendExifTags(boost::python::list& tags, const std::string& group,
+                           const Exiv2::TagInfo* info)
+{
+    for (; (info != 0) && (info->tag_ != 0xffff); ++info)
+    {
+        appendKnownTag(tags, "Exif." + group + "." + info->name_,
+                       Exiv2::TypeInfo::typeName(info->typeId_),
+                       info->title_, info->desc_);
+    }
+}
+
+static void appendIptcTags(boost::python::list& tags, const std::string& group,
+                           const Exiv2::DataSet* info)
+{
+    for (; (info != 0) && (info->number_ != 0xffff); ++info)
+    {
+        appendKnownTag(tags, "Iptc." + group + "." + info->name_,
+                       Exiv2::TypeInfo::typeName(info->type_),
+                       info->title_, info->desc_);
+    }
+}
+
+// The prefixes of the XMP schemas built in libexiv2. libexiv2 doesn't expose
+// the list, prefixes unknown to the version in use are skipped.
+static const char* builtinXmpPrefixes[] = {
+    "dc", "xmp", "xmpRights", "xmpMM", "xmpBJ", "xmpTPg", "xmpDM", "pdf",
+    "photoshop", "crs", "tiff", "exif", "aux", "iptc", "iptcExt", "plus",
+    "mwg-rs", "mwg-kw", "dwc", "dcterms", "digiKam", "kipi", "GPano", "lr",
+    "MicrosoftPhoto", "MP", "acdsee", "mediapro", "expressionmedia", 0
+};
+
+static void appendXmpTags(boost::python::list& tags, const std::string& prefix)
+{
+    const Exiv2::XmpPropertyInfo* info = Exiv2::XmpProperties::propertyList(prefix);
+    for (; (info != 0) && (info->name_ != 0); ++info)
+    {
+        appendKnownTag(tags, "Xmp." + prefix + "." + info->name_,
+                       info->xmpValueType_, info->title_, info->desc_);
+    }
+}
+
+boost::python::tuple knownTags(const std::string& family,
+                               const std::string& group)
+{
+    boost::python::list tags;
+    bool found = group.empty();
+
+    if (family == "exif")
+    {
+// Conditional code, exiv2 0.21 changed APIs we need
+// (see https://bugs.launchpad.net/pyexiv2/+bug/684177).
+#if EXIV2_TEST_VERSION(0,21,0)
+        for (const Exiv2::GroupInfo* info = Exiv2::ExifTags::groupList();
+             std::string(info->groupName_) != "(Last IFD item)"; ++info)
+        {
+            if ((info->tagList_ != 0) && (group.empty() || (group == info->groupName_)))
+            {
+                appendExifTags(tags, info->groupName_, info->tagList_());
+                found = true;
+            }
+        }
+#else
+        const std::string groups[] = {"Image", "Photo", "GPSInfo", "Iop"};
+        const Exiv2::TagInfo* lists[] = {Exiv2::ExifTags::ifdTagList(),
+                                         Exiv2::ExifTags::exifTagList(),
+                                         Exiv2::ExifTags::gpsTagList(),
+                                         Exiv2::ExifTags::iopTagList()};
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            if (group.empty() || (group == groups[i]))
+            {
+                appendExifTags(tags, groups[i], lists[i]);
+                found = true;
+            }
+        }
+#endif
+    }
+    else if (family == "iptc")
+    {
+        if (group.empty() || (group == "Envelope"))
+        {
+            appendIptcTags(tags, "Envelope",
+                           Exiv2::IptcDataSets::envelopeRecordList());
+            found = true;
+        }
+        if (group.empty() || (group == "Application2"))
+        {
+            appendIptcTags(tags, "Application2",
+                           Exiv2::IptcDataSets::application2RecordList());
+            found = true;
+        }
+    }
+    else if (family == "xmp")
+    {
+        ReadLock registryLock(xmpRegistryMutex);
+        for (const char** prefix = builtinXmpPrefixes; *prefix != 0; ++prefix)
+        {
+            if (group.empty() || (group == *prefix))
+            {
+                try
+                {
+                    appendXmpTags(tags, *prefix);
+                    found = true;
+                }
+                catch (Exiv2::Error& error)
+                {
+                    // Not built in this version of libexiv2.
+                }
+            }
+        }
+        if (!found)
+        {
+            // A custom namespace, which has no known properties.
+            try
+            {
+                appendXmpTags(tags, group);
+                found = true;
+            }
+            catch (Exiv2::Error& error)
+            {
+            }
+        }
+    }
+    else
+    {
+        throw Exiv2::Error(INVALID_VALUE, family);
+    }
+
+    if (!found)
+    {
+        throw Exiv2::Error(KEY_NOT_FOUND, group);
+    }
+    return boost::python::tuple(tags);
 }
 
 } // End of namespace exiv2wrapper
@@ -27,28 +27,53 @@
 #define __exiv2wrapper__
 
 #include <string>
+#include <vector>
 
 #include "exiv2/image.hpp"
 #include "exiv2/preview.hpp"
 
 #include "boost/python.hpp"
+#include "boost/shared_array.hpp"
+#include "boost/shared_ptr.hpp"
+#include "boost/thread/shared_mutex.hpp"
 
 namespace exiv2wrapper
 {
 
+class ExifArray;
 class Image;
+class ImageSnapshot;
+class MetadataTemplate;
+class RedactionPolicy;
+struct XmpPropertyDetails;
 
 class ExifTag
 {
 public:
     // Constructor
+    // If copy is true, the tag holds a private copy of datum instead of
+    // referring to it.
+    // If parent is not 0, datum belongs to its EXIF data (see _revalidate()).
     ExifTag(const std::string& key,
             Exiv2::Exifdatum* datum=0, Exiv2::ExifData* data=0,
-            Exiv2::ByteOrder byteOrder=Exiv2::invalidByteOrder);
+            Exiv2::ByteOrder byteOrder=Exiv2::invalidByteOrder,
+            bool copy=false, Image* parent=0);
+
+    // Copies of a standalone tag hold a private copy of its datum, copies of
+    // a tag bound to an image refer to the same datum.
+    ExifTag(const ExifTag& other);
+    ExifTag& operator=(const ExifTag& other);
 
     ~ExifTag();
 
     void setRawValue(const std::string& value);
+    // Set the value of a byte-valued tag (Undefined, Byte or SByte) from any
+    // object exposing a buffer (str, bytearray, memoryview).
+    void setRawBytes(const boost::python::object& bytes);
+    // Set the value of a comment tag (e.g. Exif.Photo.UserComment) from a
+    // unicode (or UTF-8 encoded) string, encoded with the charset of its
+    // current value if possible, as UTF-8 without a charset otherwise.
+    void setComment(const boost::python::object& value);
     void setParentImage(Image& image);
 
     const std::string getKey();
@@ -59,20 +84,102 @@ public:
     const std::string getSectionName();
     const std::string getSectionDescription();
     const std::string getRawValue();
+    // Return the value of a byte-valued tag as a string of bytes, copied
+    // straight from the datum.
+    // Throw an exception if the tag is not byte-valued.
+    boost::python::object getRawBytes();
+    // Return the value of a comment tag decoded according to its charset as
+    // a unicode string (or as a string of bytes if it has no charset and is
+    // not valid UTF-8), or None if it is not set.
+    boost::python::object getComment();
     const std::string getHumanValue();
     int getByteOrder();
 
 private:
+    // Tags are kept small: only the type, which may depend on the datum, is
+    // stored, the other details are looked up in the static tables of
+    // libexiv2 by the getters.
     Exiv2::ExifKey _key;
     Exiv2::Exifdatum* _datum;
     Exiv2::ExifData* _data;
-    std::string _type;
-    std::string _name;
-    std::string _label;
-    std::string _description;
-    std::string _sectionName;
-    std::string _sectionDescription;
+    const char* _type;
     int _byteOrder;
+
+    // Handle on the datum of a tag bound to an image: the image it belongs
+    // to (0 for a standalone tag or a copy) and the generation of its
+    // metadata when the datum was looked up.
+    Image* _parent;
+    unsigned long _generation;
+    // Whether the datum was looked up for writing, that is in metadata that
+    // the parent image doesn't share with clones (see Image::_detach()).
+    bool _writable;
+    // Look the datum up again if the metadata of the parent image was
+    // restructured since, or, before a write (if write is true), if it was
+    // only looked up for reading. If the tag was removed from it in the
+    // meantime, the tag becomes standalone (without any value) and false is
+    // returned.
+    // The lock of the parent image is taken (exclusively for a write) if the
+    // datum has to be looked up again, _lookUpDatum() does the same with the
+    // lock already held.
+    bool _revalidate(bool write);
+    bool _lookUpDatum(bool write);
+    // Same as _revalidate(), but throw an exception if the tag was removed.
+    void _checkHandle(bool write);
+
+    // Number of buffers currently exported by arrays on the values of the tag
+    // (see ExifArray). The values must not be reallocated in the meantime.
+    int _exports;
+    // Throw an exception if a buffer on the values of the tag is exported.
+    void _checkExports();
+
+    friend class ExifArray;
+};
+
+
+// A view on the values of a numeric EXIF tag (Short, SShort, Long, SLong,
+// Rational or SRational), that reads and writes them in place in the
+// Exiv2::Value of the tag instead of going through its string representation.
+// Rationals are represented as (numerator, denominator) tuples.
+// The values are also exposed through the buffer protocol, as native
+// integers (with a shape of (n, 2) for rationals). While a buffer is
+// exported, neither the array nor the tag can be resized or set another
+// value, and the metadata of the image the tag is bound to cannot be
+// restructured (see Image::_checkExports()).
+class ExifArray
+{
+public:
+    // Throw an exception if the tag is not numeric.
+    ExifArray(ExifTag& tag);
+
+    long getLength();
+    boost::python::object getItem(long index);
+    void setItem(long index, const boost::python::object& item);
+    // Slices, with start <= stop. Setting a slice to a sequence of a
+    // different length resizes the array.
+    boost::python::list getItems(long start, long stop);
+    void setItems(long start, long stop, const boost::python::object& items);
+
+    // Stop writing to the tag: keep a private copy of its current values.
+    void detach();
+
+    // Implementation of the buffer protocol, to be installed on the python
+    // type of the arrays.
+    static int getBuffer(PyObject* self, Py_buffer* view, int flags);
+    static void releaseBuffer(PyObject* self, Py_buffer* view);
+
+private:
+    // The tag whose values are viewed, or 0 once detached.
+    ExifTag* _tag;
+    // The private copy of the values once detached.
+    Exiv2::Value::AutoPtr _value;
+    Exiv2::TypeId _type;
+
+    int _exports;
+    Py_ssize_t _shape[2];
+    Py_ssize_t _strides[2];
+
+    Exiv2::Value& _getValue(bool write);
+    void _exportBuffer(PyObject* self, Py_buffer* view, int flags);
 };
 
 
@@ -80,7 +187,15 @@ class IptcTag
 {
 public:
     // Constructor
-    IptcTag(const std::string& key, Exiv2::IptcData* data=0);
+    // If copy is true, the tag holds a private copy of its values in data
+    // instead of referring to them.
+    IptcTag(const std::string& key, Exiv2::IptcData* data=0, bool copy=false,
+            Image* parent=0);
+
+    // Copies of a standalone tag hold a private copy of its values, copies of
+    // a tag bound to an image refer to the same data.
+    IptcTag(const IptcTag& other);
+    IptcTag& operator=(const IptcTag& other);
 
     ~IptcTag();
 
@@ -97,19 +212,31 @@ public:
     const std::string getRecordName();
     const std::string getRecordDescription();
     const boost::python::list getRawValues();
+    // Return the values decoded into unicode strings from the charset of the
+    // IPTC data they belong to (Latin-1 if it cannot be detected).
+    // Only relevant for tags of type String.
+    const boost::python::list getStringValues();
+    // Return the name of the python codec to encode string values back with,
+    // so that they stay consistent with the charset they were decoded from.
+    const std::string getStringEncoding();
 
 private:
     Exiv2::IptcKey _key;
     bool _from_data; // whether the tag is built from an existing IptcData
     Exiv2::IptcData* _data;
-    std::string _type;
-    std::string _name;
-    std::string _title;
-    std::string _description;
-    std::string _photoshopName;
-    bool _repeatable;
-    std::string _recordName;
-    std::string _recordDescription;
+    // The image the data belongs to, 0 for a standalone tag or a copy, and
+    // the generation of its metadata when the data was looked up.
+    Image* _parent;
+    unsigned long _generation;
+    bool _writable;
+    // Look the data up again if the parent image replaced it since, or
+    // before a write, as for EXIF tags, with its lock taken (or already held
+    // for _lookUpData()).
+    void _revalidate(bool write);
+    void _lookUpData(bool write);
+    // The charset of the IPTC data the tag belongs to, empty if unknown.
+    std::string _charset();
+    // The details of the dataset are looked up by the getters.
 };
 
 
@@ -117,13 +244,24 @@ class XmpTag
 {
 public:
     // Constructor
-    XmpTag(const std::string& key, Exiv2::Xmpdatum* datum=0);
+    // If copy is true, the tag holds a private copy of datum instead of
+    // referring to it.
+    // If parent is not 0, datum belongs to its XMP data (see _revalidate()).
+    XmpTag(const std::string& key, Exiv2::Xmpdatum* datum=0, bool copy=false,
+           Image* parent=0);
+
+    // Copies of a standalone tag hold a private copy of its datum, copies of
+    // a tag bound to an image refer to the same datum.
+    XmpTag(const XmpTag& other);
+    XmpTag& operator=(const XmpTag& other);
 
     ~XmpTag();
 
     void setTextValue(const std::string& value);
     void setArrayValue(const boost::python::list& values);
     void setLangAltValue(const boost::python::dict& values);
+    // Set the value for one language of a LangAlt value in place.
+    void setLangAltItem(const std::string& lang, const std::string& value);
     void setParentImage(Image& image);
 
     const std::string getKey();
@@ -135,16 +273,31 @@ public:
     const std::string getTextValue();
     const boost::python::list getArrayValue();
     const boost::python::dict getLangAltValue();
+    // Return the value for one language of a LangAlt value, or for the
+    // fallback language if it is not set (an empty fallback means none).
+    // Throw an exception if neither is set.
+    const std::string getLangAltItem(const std::string& lang,
+                                     const std::string& fallback);
 
 private:
     Exiv2::XmpKey _key;
     bool _from_datum; // whether the tag is built from an existing Xmpdatum
     Exiv2::Xmpdatum* _datum;
-    std::string _exiv2_type;
-    std::string _type;
-    std::string _name;
-    std::string _title;
-    std::string _description;
+    const char* _exiv2_type;
+    // The details of the property, resolved through the namespace registry
+    // when the tag is built and shared with the other tags of the property.
+    // They remain valid if its namespace is unregistered afterwards.
+    boost::shared_ptr<const XmpPropertyDetails> _details;
+
+    // Handle on the datum of a tag bound to an image, as for EXIF tags.
+    // Looking it up for writing also flags the XMP data of the image as
+    // modified.
+    Image* _parent;
+    unsigned long _generation;
+    bool _writable;
+    bool _revalidate(bool write);
+    bool _lookUpDatum(bool write);
+    void _checkHandle(bool write);
 };
 
 
@@ -163,6 +316,14 @@ public:
 };
 
 
+// Concurrency contract: all the methods of an Image can be called from
+// several threads at once. Methods that only read the metadata share a
+// per-instance lock, methods that modify it or access the underlying image
+// file or buffer hold it exclusively. The GIL is released while waiting for
+// the lock. Tags bound to an image (returned by getXxxTag() or attached with
+// setParentImage()) refer to its metadata and keep the image alive. They only
+// take its lock to look their datum up again after it was restructured, and
+// must not be used while another thread modifies the image.
 class Image
 {
 public:
@@ -173,8 +334,26 @@ public:
 
     ~Image();
 
+    // Return a copy of the image that shares its parsed metadata instead of
+    // reading it again. Each image takes a private copy of the metadata the
+    // first time it modifies it (or gives write access to it). The tags
+    // already bound to this image look their datum up again in its private
+    // copy the next time they are used.
+    Image* clone();
+
+    // Return a read-only view of the metadata as it is now. The image
+    // takes a private copy of the metadata before its next modification, so
+    // the snapshot is never modified and can be read from any thread.
+    ImageSnapshot snapshot();
+
     void readMetadata();
-    void writeMetadata();
+
+    // Write the metadata back to the image.
+    // If xmpFormat is not negative, the XMP data is serialized with the
+    // Exiv2::XmpParser format flags it holds and xmpPadding bytes of padding
+    // (0 for the default padding) instead of libexiv2's default layout.
+    // Requires libexiv2 >= 0.22, ignored otherwise.
+    void writeMetadata(int xmpFormat=-1, unsigned int xmpPadding=0);
 
     // Read-only access to the dimensions of the picture.
     unsigned int pixelWidth() const;
@@ -226,6 +405,39 @@ public:
     // Throw an exception if the tag was not set.
     void deleteXmpTag(std::string key);
 
+    // Return a whole XMP structure (a struct, an array of structs, or any
+    // nesting thereof) as nested dicts and lists. Struct fields are keyed by
+    // their qualified name (e.g. "stDim:w"), simple values are raw strings,
+    // simple arrays are lists and language alternatives are dicts.
+    // Throw an exception if the structure is not set.
+    boost::python::object getXmpStruct(std::string key);
+
+    // Replace a whole XMP structure by the nested dicts and lists passed.
+    // A dict whose keys are not qualified names is a language alternative.
+    void setXmpStruct(std::string key, const boost::python::object& value);
+
+    // Raw access to the XMP packet.
+    // getXmpPacket() returns the packet as read from the image, or serializes
+    // the XMP data if it was modified since.
+    // setXmpPacket() embeds a packet that will be written as is. It is only
+    // parsed when the XMP data is next accessed, or right away if check is
+    // true, in which case an exception is thrown if it is not well-formed.
+    const std::string getXmpPacket() const;
+    void setXmpPacket(const std::string& packet, bool check=false);
+
+    // Merge the XMP data of a sidecar file into the XMP data of the image.
+    // Properties (with all their members for structures) are taken from the
+    // sidecar if sidecarWins is true, otherwise only those missing from the
+    // image are. The merged data is meant for the sidecar only:
+    // writeMetadata() then leaves the XMP packet embedded in the image as it
+    // was, until the metadata is read again.
+    void readSidecar(const std::string& path, bool sidecarWins);
+
+    // Write the XMP data of the image to a sidecar file, replacing it if it
+    // exists. A pending XMP packet is parsed first if it has to be
+    // serialized again.
+    void writeSidecar(const std::string& path);
+
     // Comment
     const std::string getComment() const;
     void setComment(const std::string& comment);
@@ -243,37 +455,228 @@ public:
     void setExifThumbnailFromFile(const std::string& path);
     void setExifThumbnailFromData(const std::string& data);
 
+    // Transactional edits: begin() saves the current state of the metadata,
+    // rollback() restores it and commit() discards it. The state saved is
+    // that of the in-memory metadata, writing it to the image is not undone.
+    // The edits are not journaled: begin() copies the EXIF, IPTC and XMP
+    // containers as a whole, which costs as much memory as the metadata
+    // itself (including the EXIF thumbnail and makernotes) for the duration
+    // of the transaction, however few tags are then modified.
+    // Throw an exception if begin() is called while a transaction is already
+    // in progress, or commit() or rollback() while none is.
+    void begin();
+    void commit();
+    void rollback();
+
     // Copy the metadata to another image.
     void copyMetadata(Image& other, bool exif=true, bool iptc=true, bool xmp=true) const;
 
     // Return the image data buffer.
-    std::string getDataBuffer() const;
-
-    // Accessors
-    Exiv2::ExifData* getExifData() { return _exifData; };
-    Exiv2::IptcData* getIptcData() { return _iptcData; };
-    Exiv2::XmpData* getXmpData() { return _xmpData; };
+    std::string getDataBuffer();
+
+    // Set and delete several tags in one go.
+    // edits maps keys to raw values: a string for EXIF tags, a list of strings
+    // for IPTC tags, a string, a list of strings or a dictionary of strings
+    // (language alternatives) for XMP tags.
+    // All the values are validated before the image is modified: if one of
+    // them is invalid or one of the keys to delete is not set, an exception is
+    // thrown and the image is left untouched.
+    // Deletions are applied before edits.
+    void update(const boost::python::dict& edits,
+                const boost::python::list& deletes);
+
+    // Set all the tags of a template.
+    void applyTemplate(const MetadataTemplate& metadataTemplate);
+
+    // Remove all the tags matched by a redaction policy.
+    // Return the list of the keys of the tags removed (or blanked out).
+    boost::python::list redact(const RedactionPolicy& policy);
+
+    // Return a human-readable dump of all the tags, in one pass over the
+    // metadata with the GIL released. format is "text" (one line per tag:
+    // key, label and printed value separated by tabs) or "json" (an array of
+    // objects with the same three members).
+    // Throw an exception if the format is unknown.
+    boost::python::str humanDump(const std::string& format);
+
+    // Accessors (giving write access to the metadata), to be called with the
+    // lock returned by getMutex() held exclusively.
+    boost::shared_mutex& getMutex() const { return _mutex; };
+    Exiv2::ExifData* getExifData() { _detach(); return _exifData; };
+    Exiv2::IptcData* getIptcData() { _detach(); _iptcCharsetValid = false; return _iptcData; };
+    Exiv2::XmpData* getXmpData() { _decodeXmpPacket(); _xmpModified = true; ++_generation; return _xmpData; };
 
     Exiv2::ByteOrder getByteOrder() const;
 
     const std::string getIptcCharset() const;
 
 private:
+    // Copy on write constructor: share the underlying image of another one.
+    Image(const Image& image, const boost::shared_ptr<Exiv2::Image>& shared);
+
     std::string _filename;
-    Exiv2::byte* _data;
+    boost::shared_array<Exiv2::byte> _data;
     long _size;
-    Exiv2::Image::AutoPtr _image;
+    // The underlying image, shared with clones until one of them modifies
+    // its metadata.
+    boost::shared_ptr<Exiv2::Image> _image;
+    boost::shared_ptr<Exiv2::Image> _open() const;
+    void _detach();
+    unsigned int _pixelWidth;
+    unsigned int _pixelHeight;
     Exiv2::ExifData* _exifData;
     Exiv2::IptcData* _iptcData;
     Exiv2::XmpData* _xmpData;
     Exiv2::ExifThumb* _exifThumbnail;
     Exiv2::ExifThumb* _getExifThumbnail();
 
+    // Copies of the metadata saved by begin(), 0 if no transaction is in
+    // progress.
+    Exiv2::ExifData* _savedExifData;
+    Exiv2::IptcData* _savedIptcData;
+    Exiv2::XmpData* _savedXmpData;
+    std::string _savedComment;
+    void _endTransaction();
+
+    // Protect the image from concurrent access.
+    mutable boost::shared_mutex _mutex;
+
+    // Implementations of the public methods, with the lock already held.
+    void _deleteExifTag(const std::string& key);
+    void _deleteIptcTag(const std::string& key);
+    void _deleteXmpTag(const std::string& key);
+    void _copyMetadata(Image& other, bool exif, bool iptc, bool xmp) const;
+    boost::python::list _xmpKeys() const;
+    void _writeSidecar(const std::string& path) const;
+    const XmpTag _getXmpTag(const std::string& key);
+    boost::python::object _getXmpStruct(const std::string& key) const;
+
     // true if the image's internal metadata has already been read,
     // false otherwise
     bool _dataRead;
 
+    // true if the XMP data may have been modified since it was read. If it
+    // wasn't, the original XMP packet is written back as is.
+    bool _xmpModified;
+
+    // true if the XMP packet was set but not parsed yet. To be called with
+    // the lock held exclusively, _decodeXmpPacket() parses it into the XMP
+    // data.
+    bool _xmpPacketPending;
+    void _decodeXmpPacket();
+
+    // true if the XMP data was merged with a sidecar by readSidecar(), in
+    // which case _embeddedXmpPacket holds the packet written to the image.
+    bool _xmpFromSidecar;
+    std::string _embeddedXmpPacket;
+
+    // The charset detected in the IPTC data, cached until the IPTC data is
+    // next modified (see invalidateIptcCharset()).
+    mutable std::string _iptcCharset;
+    mutable bool _iptcCharsetValid;
+
     void _instantiate_image();
+
+    // Incremented whenever the metadata is restructured (datums erased,
+    // containers replaced or reallocated), which invalidates the pointers
+    // held by the tags bound to the image. Tags compare it to the generation
+    // they looked their datum up at before using it.
+    unsigned long _generation;
+
+    // Number of buffers currently exported on the values of the EXIF tags
+    // bound to the image (see ExifArray), updated with the GIL held. The
+    // metadata must not be restructured (nor shared, or unshared) in the
+    // meantime: _checkExports() throws an exception if a buffer is exported.
+    int _exports;
+    void _checkExports() const;
+
+    // Tags modify the metadata without going through the image.
+    friend class ExifArray;
+    friend class ExifTag;
+    friend class IptcTag;
+    friend class XmpTag;
+    void invalidateIptcCharset() { _iptcCharsetValid = false; };
+};
+
+
+class ImageSnapshot
+{
+public:
+    ImageSnapshot(const boost::shared_ptr<Exiv2::Image>& image);
+
+    boost::python::list exifKeys() const;
+    boost::python::list iptcKeys() const;
+    boost::python::list xmpKeys() const;
+
+    // Return a copy of the required tag, which can be modified without
+    // affecting the snapshot.
+    // Throw an exception if the tag is not set.
+    const ExifTag getExifTag(std::string key) const;
+    const IptcTag getIptcTag(std::string key) const;
+    const XmpTag getXmpTag(std::string key) const;
+
+    const std::string getComment() const;
+
+private:
+    boost::shared_ptr<const Exiv2::Image> _image;
+};
+
+
+class MetadataTemplate
+{
+public:
+    // Compile a template from a dictionary of raw values, in the same format
+    // as for Image::update(). Keys are resolved and values parsed once and
+    // for all.
+    MetadataTemplate(const boost::python::dict& values);
+
+    // Apply the template to a batch of image files: open each of them, read
+    // its metadata, set all the tags and write it back.
+    // The GIL is released for the whole batch. A file that fails doesn't stop
+    // the others: return, for each file, None or the exception it raised
+    // (naming the file).
+    boost::python::list applyToFiles(const boost::python::list& paths) const;
+
+    const Exiv2::ExifData& exifData() const;
+    const Exiv2::IptcData& iptcData() const;
+    const Exiv2::XmpData& xmpData() const;
+
+private:
+    Exiv2::ExifData _exifData;
+    Exiv2::IptcData _iptcData;
+    Exiv2::XmpData _xmpData;
+};
+
+
+class RedactionPolicy
+{
+public:
+    // Patterns are keys in which '*' matches any sequence of characters and
+    // '?' matches any single character (e.g. 'Exif.GPSInfo.*').
+    // All the XMP tags in one of the namespaces (given by their name, not by
+    // their prefix) are matched as well.
+    // If inPlace is true, matching EXIF tags are not erased but have their
+    // value overwritten with zeroes, which leaves the structure of the EXIF
+    // data untouched and allows libexiv2 to patch TIFF-based images in place
+    // instead of rewriting them.
+    // Throw an exception if one of the namespaces is not registered.
+    RedactionPolicy(const boost::python::list& patterns,
+                    const boost::python::list& namespaces,
+                    bool inPlace=false);
+
+    // Return the patterns, with the namespaces resolved to key patterns
+    // through their current prefixes, to be called whenever the policy is
+    // applied. To be called with the namespace registry locked.
+    // Throw an exception if one of the namespaces was unregistered since.
+    std::vector<std::string> patterns() const;
+    static bool matches(const std::vector<std::string>& patterns,
+                        const std::string& key);
+    bool inPlace() const;
+
+private:
+    std::vector<std::string> _patterns;
+    std::vector<std::string> _namespaces;
+    bool _inPlace;
 };
 
 
@@ -286,6 +689,23 @@ void registerXmpNs(const std::string& name, const std::string& prefix);
 void unregisterXmpNs(const std::string& name);
 void unregisterAllXmpNs();
 
+
+// Read the metadata of a batch of image files and return a human-readable
+// dump of each of them (see Image::humanDump()), with the GIL released for
+// the whole batch. A file that fails doesn't stop the others: its dump is
+// replaced with the exception it raised (naming the file).
+boost::python::list humanDumpFiles(const boost::python::list& paths,
+                                   const std::string& format);
+
+
+// Return the tags known to libexiv2 for a family of metadata ("exif", "iptc"
+// or "xmp"), optionally restricted to one group (an IFD, an IPTC record or
+// the prefix of an XMP namespace), as a tuple of (key, type, label,
+// description) tuples read from its static tables.
+// Throw an exception if the family or the group is unknown.
+boost::python::tuple knownTags(const std::string& family,
+                               const std::string& group);
+
 } // End of namespace exiv2wrapper
 
 #endif
@@ -34,6 +34,11 @@ using namespace boost::python;
 
 using namespace exiv2wrapper;
 
+// Image::writeMetadata() has default arguments for the XMP serialization
+// options, expose them to python as optional arguments.
+BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(writeMetadataOverloads,
+                                       Image::writeMetadata, 0, 2)
+
 BOOST_PYTHON_MODULE(libexiv2python)
 {
     scope().attr("exiv2_version_info") = \
@@ -41,6 +46,14 @@ BOOST_PYTHON_MODULE(libexiv2python)
                                   EXIV2_MINOR_VERSION,
                                   EXIV2_PATCH_VERSION);
 
+    // Format flags for the serialization of XMP packets.
+    scope().attr("_XMP_OMIT_PACKET_WRAPPER") = \
+        int(Exiv2::XmpParser::omitPacketWrapper);
+    scope().attr("_XMP_USE_COMPACT_FORMAT") = \
+        int(Exiv2::XmpParser::useCompactFormat);
+    scope().attr("_XMP_OMIT_ALL_FORMATTING") = \
+        int(Exiv2::XmpParser::omitAllFormatting);
+
     register_exception_translator<Exiv2::Error>(&translateExiv2Error);
 
     // Swallow all warnings and error messages written by libexiv2 to stderr
@@ -51,7 +64,11 @@ BOOST_PYTHON_MODULE(libexiv2python)
     class_<ExifTag>("_ExifTag", init<std::string>())
 
         .def("_setRawValue", &ExifTag::setRawValue)
-        .def("_setParentImage", &ExifTag::setParentImage)
+        .def("_setRawBytes", &ExifTag::setRawBytes)
+        .def("_setComment", &ExifTag::setComment)
+        // The tag refers to the image, which has to outlive it.
+        .def("_setParentImage", &ExifTag::setParentImage,
+             with_custodian_and_ward<1, 2>())
 
         .def("_getKey", &ExifTag::getKey)
         .def("_getType", &ExifTag::getType)
@@ -61,14 +78,38 @@ BOOST_PYTHON_MODULE(libexiv2python)
         .def("_getSectionName", &ExifTag::getSectionName)
         .def("_getSectionDescription", &ExifTag::getSectionDescription)
         .def("_getRawValue", &ExifTag::getRawValue)
+        .def("_getRawBytes", &ExifTag::getRawBytes)
+        .def("_getComment", &ExifTag::getComment)
         .def("_getHumanValue", &ExifTag::getHumanValue)
         .def("_getByteOrder", &ExifTag::getByteOrder)
     ;
 
+    object exifArray = class_<ExifArray, boost::noncopyable>(
+            "_ExifArray", init<ExifTag&>()[with_custodian_and_ward<1, 2>()])
+
+        .def("__len__", &ExifArray::getLength)
+        .def("_getItem", &ExifArray::getItem)
+        .def("_setItem", &ExifArray::setItem)
+        .def("_getItems", &ExifArray::getItems)
+        .def("_setItems", &ExifArray::setItems)
+        .def("_detach", &ExifArray::detach)
+    ;
+    // Expose the values of the arrays through the (new-style) buffer
+    // protocol, which boost.python doesn't wrap.
+    static PyBufferProcs exifArrayBufferProcs;
+    exifArrayBufferProcs.bf_getbuffer = &ExifArray::getBuffer;
+    exifArrayBufferProcs.bf_releasebuffer = &ExifArray::releaseBuffer;
+    PyTypeObject* exifArrayType = \
+        reinterpret_cast<PyTypeObject*>(exifArray.ptr());
+    exifArrayType->tp_as_buffer = &exifArrayBufferProcs;
+    exifArrayType->tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+
     class_<IptcTag>("_IptcTag", init<std::string>())
 
         .def("_setRawValues", &IptcTag::setRawValues)
-        .def("_setParentImage", &IptcTag::setParentImage)
+        // The tag refers to the image, which has to outlive it.
+        .def("_setParentImage", &IptcTag::setParentImage,
+             with_custodian_and_ward<1, 2>())
 
         .def("_getKey", &IptcTag::getKey)
         .def("_getType", &IptcTag::getType)
@@ -80,6 +121,8 @@ BOOST_PYTHON_MODULE(libexiv2python)
         .def("_getRecordName", &IptcTag::getRecordName)
         .def("_getRecordDescription", &IptcTag::getRecordDescription)
         .def("_getRawValues", &IptcTag::getRawValues)
+        .def("_getStringValues", &IptcTag::getStringValues)
+        .def("_getStringEncoding", &IptcTag::getStringEncoding)
     ;
 
     class_<XmpTag>("_XmpTag", init<std::string>())
@@ -87,7 +130,10 @@ BOOST_PYTHON_MODULE(libexiv2python)
         .def("_setTextValue", &XmpTag::setTextValue)
         .def("_setArrayValue", &XmpTag::setArrayValue)
         .def("_setLangAltValue", &XmpTag::setLangAltValue)
-        .def("_setParentImage", &XmpTag::setParentImage)
+        .def("_setLangAltItem", &XmpTag::setLangAltItem)
+        // The tag refers to the image, which has to outlive it.
+        .def("_setParentImage", &XmpTag::setParentImage,
+             with_custodian_and_ward<1, 2>())
 
         .def("_getKey", &XmpTag::getKey)
         .def("_getExiv2Type", &XmpTag::getExiv2Type)
@@ -98,6 +144,7 @@ BOOST_PYTHON_MODULE(libexiv2python)
         .def("_getTextValue", &XmpTag::getTextValue)
         .def("_getArrayValue", &XmpTag::getArrayValue)
         .def("_getLangAltValue", &XmpTag::getLangAltValue)
+        .def("_getLangAltItem", &XmpTag::getLangAltItem)
     ;
 
     class_<Preview>("_Preview", init<Exiv2::PreviewImage>())
@@ -111,11 +158,32 @@ BOOST_PYTHON_MODULE(libexiv2python)
         .def("write_to_file", &Preview::writeToFile)
     ;
 
+    class_<ImageSnapshot>("_ImageSnapshot", no_init)
+        .def("_exifKeys", &ImageSnapshot::exifKeys)
+        .def("_getExifTag", &ImageSnapshot::getExifTag)
+        .def("_iptcKeys", &ImageSnapshot::iptcKeys)
+        .def("_getIptcTag", &ImageSnapshot::getIptcTag)
+        .def("_xmpKeys", &ImageSnapshot::xmpKeys)
+        .def("_getXmpTag", &ImageSnapshot::getXmpTag)
+        .def("_getComment", &ImageSnapshot::getComment)
+    ;
+
+    class_<MetadataTemplate>("_MetadataTemplate", init<dict>())
+        .def("_applyToFiles", &MetadataTemplate::applyToFiles)
+    ;
+
+    class_<RedactionPolicy>("_RedactionPolicy", init<list, list, bool>())
+    ;
+
     class_<Image>("_Image", init<std::string>())
         .def(init<std::string, long>())
 
+        .def("_clone", &Image::clone, return_value_policy<manage_new_object>())
+        .def("_snapshot", &Image::snapshot)
+
         .def("_readMetadata", &Image::readMetadata)
-        .def("_writeMetadata", &Image::writeMetadata)
+        .def("_writeMetadata", &Image::writeMetadata,
+             writeMetadataOverloads())
 
         .def("_getPixelWidth", &Image::pixelWidth)
         .def("_getPixelHeight", &Image::pixelHeight)
@@ -123,16 +191,27 @@ BOOST_PYTHON_MODULE(libexiv2python)
         .def("_getMimeType", &Image::mimeType)
 
         .def("_exifKeys", &Image::exifKeys)
-        .def("_getExifTag", &Image::getExifTag)
+        .def("_getExifTag", &Image::getExifTag,
+             with_custodian_and_ward_postcall<0, 1>())
         .def("_deleteExifTag", &Image::deleteExifTag)
 
         .def("_iptcKeys", &Image::iptcKeys)
-        .def("_getIptcTag", &Image::getIptcTag)
+        .def("_getIptcTag", &Image::getIptcTag,
+             with_custodian_and_ward_postcall<0, 1>())
         .def("_deleteIptcTag", &Image::deleteIptcTag)
 
         .def("_xmpKeys", &Image::xmpKeys)
-        .def("_getXmpTag", &Image::getXmpTag)
+        .def("_getXmpTag", &Image::getXmpTag,
+             with_custodian_and_ward_postcall<0, 1>())
         .def("_deleteXmpTag", &Image::deleteXmpTag)
+        .def("_getXmpStruct", &Image::getXmpStruct)
+        .def("_setXmpStruct", &Image::setXmpStruct)
+
+        .def("_getXmpPacket", &Image::getXmpPacket)
+        .def("_setXmpPacket", &Image::setXmpPacket)
+
+        .def("_readSidecar", &Image::readSidecar)
+        .def("_writeSidecar", &Image::writeSidecar)
 
         .def("_getComment", &Image::getComment)
         .def("_setComment", &Image::setComment)
@@ -140,10 +219,22 @@ BOOST_PYTHON_MODULE(libexiv2python)
 
         .def("_previews", &Image::previews)
 
+        .def("_begin", &Image::begin)
+        .def("_commit", &Image::commit)
+        .def("_rollback", &Image::rollback)
+
         .def("_copyMetadata", &Image::copyMetadata)
 
         .def("_getDataBuffer", &Image::getDataBuffer)
 
+        .def("_update", &Image::update)
+
+        .def("_applyTemplate", &Image::applyTemplate)
+
+        .def("_redact", &Image::redact)
+
+        .def("_humanDump", &Image::humanDump)
+
         .def("_getExifThumbnailMimeType", &Image::getExifThumbnailMimeType)
         .def("_getExifThumbnailExtension", &Image::getExifThumbnailExtension)
         .def("_writeExifThumbnailToFile", &Image::writeExifThumbnailToFile)
@@ -158,5 +249,9 @@ BOOST_PYTHON_MODULE(libexiv2python)
     def("_registerXmpNs", registerXmpNs, args("name", "prefix"));
     def("_unregisterXmpNs", unregisterXmpNs, args("name"));
     def("_unregisterAllXmpNs", unregisterAllXmpNs);
+
+    def("_humanDumpFiles", humanDumpFiles, args("paths", "format"));
+
+    def("_knownTags", knownTags, args("family", "group"));
 }
 
@@ -0,0 +1,313 @@
+# -*- coding: utf-8 -*-
+
+# ******************************************************************************
+#
+# Copyright (C) 2012 Olivier Tilloy <olivier@tilloy.net>
+#
+# This file is part of the pyexiv2 distribution.
+#
+# pyexiv2 is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# pyexiv2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with pyexiv2; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, 5th Floor, Boston, MA 02110-1301 USA.
+#
+# Author: Olivier Tilloy <olivier@tilloy.net>
+#
+# ******************************************************************************
+
+"""
+Crash-resumable bulk edition of the metadata of image files.
+"""
+
+import hashlib
+import os
+import sys
+
+from pyexiv2.metadata import ImageMetadata, sidecar_filename, \
+                             _to_raw_values, _SIDECAR_MODES
+
+
+class BatchEditor(object):
+
+    """
+    A runner applying the same set of edits to a large number of image files,
+    recording its progress in an append-only journal so that an interrupted
+    run can be resumed without processing again the files already edited.
+
+    Each run starts by recording in the journal a digest of its edits. Each
+    following line records a state change for a file: ``begin`` before it is
+    edited, ``done`` once its metadata was written back (or found to be
+    already up to date) and ``failed`` if it could not be edited.
+    The journal is flushed and synced to disk every *sync_interval* completed
+    files and at the end of each run.
+
+    When resuming, files recorded as ``done`` by a run of the same edits whose
+    size and modification time still match are skipped without being opened. The other files are read and
+    only written back if their metadata doesn't already match the edits.
+
+    In the ``'only'`` sidecar mode, the XMP sidecars of the image files are
+    edited instead of the files themselves, which are never opened.
+    """
+
+    def __init__(self, journal, edits=(), deletes=(), sync_interval=100,
+                 preserve_timestamps=False, sidecar=None):
+        """
+        :param journal: the path to the journal file (created if needed)
+        :type journal: string
+        :param edits: a mapping (or a sequence of (key, tag or value) pairs)
+                      of the tags to set, with the same semantics as
+                      :meth:`pyexiv2.metadata.ImageMetadata.__setitem__`
+        :type edits: dict
+        :param deletes: the keys of the tags to delete
+        :type deletes: list of strings
+        :param sync_interval: the number of files completed between two syncs
+                              of the journal
+        :type sync_interval: int
+        :param preserve_timestamps: whether to preserve the files' original
+                                    timestamps
+        :type preserve_timestamps: boolean
+        :param sidecar: the sidecar mode, as for
+                        :class:`pyexiv2.metadata.ImageMetadata`
+        :type sidecar: string
+
+        :raise KeyError: if one of the keys is invalid
+        :raise ValueError: if one of the values or the sidecar mode is invalid
+        """
+        self.journal = journal
+        self.edits = dict(edits)
+        self.deletes = list(deletes)
+        self.sync_interval = max(1, sync_interval)
+        self.preserve_timestamps = preserve_timestamps
+        if sidecar not in _SIDECAR_MODES:
+            raise ValueError('Invalid sidecar mode: %r' % sidecar)
+        self.sidecar = sidecar
+        # Validate the edits once and for all
+        self._raw_values = _to_raw_values(self.edits)[0]
+        #: The digest of the edits, recorded in the journal
+        self.digest = _digest(self._raw_values, self.deletes, self.sidecar)
+        #: The exception raised for each file that failed during the last run
+        self.errors = {}
+
+    def completed(self):
+        """
+        Read the journal.
+
+        :return: a dictionary mapping the path of each file recorded as
+                 ``done`` by a run of the same edits, and not edited since by
+                 a run of other edits, to its fingerprint (size and
+                 modification time) after it was edited
+        :rtype: dict
+        """
+        completed = {}
+        if not os.path.exists(self.journal):
+            return completed
+        # Entries are only relevant if they follow the digest of the same
+        # edits (journals without digests are not trusted).
+        relevant = False
+        fd = open(self.journal, 'rb')
+        try:
+            for line in fd:
+                if not line.endswith('\n'):
+                    # Truncated last entry, written by an interrupted run
+                    break
+                try:
+                    state, fingerprint, path = line[:-1].split('\t', 2)
+                    path = path.decode('string_escape')
+                except ValueError:
+                    continue
+                if state == 'edits':
+                    relevant = (fingerprint == self.digest)
+                    if not relevant:
+                        completed.clear()
+                    continue
+                if not relevant:
+                    continue
+                if state == 'done':
+                    completed[path] = fingerprint
+                else:
+                    completed.pop(path, None)
+        finally:
+            fd.close()
+        return completed
+
+    def run(self, filenames):
+        """
+        Apply the edits to a batch of image files, resuming from the journal
+        if it exists. A file that can't be edited is recorded as ``failed`` in
+        the journal and doesn't stop the run, the exception raised is stored
+        in :attr:`errors`, a dictionary mapping the path of each file that
+        failed during the last run to its exception.
+
+        :param filenames: paths to image files
+        :type filenames: list of strings
+
+        :return: the number of files edited, skipped (already up to date) and
+                 failed
+        :rtype: tuple (int, int, int)
+        """
+        encoding = sys.getfilesystemencoding()
+        completed = self.completed()
+        edited = skipped = failed = 0
+        self.errors = {}
+        _drop_truncated_entry(self.journal)
+        journal = open(self.journal, 'ab')
+        try:
+            self._record(journal, 'edits', self.digest, '-')
+            pending = 0
+            for filename in filenames:
+                if isinstance(filename, unicode):
+                    filename = filename.encode(encoding)
+                fingerprint = completed.get(filename)
+                if fingerprint is not None and \
+                        fingerprint == self._fingerprint(filename):
+                    skipped += 1
+                    continue
+                self._record(journal, 'begin', '-', filename)
+                try:
+                    modified = self._edit(filename)
+                except Exception, error:
+                    self._record(journal, 'failed', '-', filename)
+                    self.errors[filename] = error
+                    failed += 1
+                else:
+                    self._record(journal, 'done',
+                                 self._fingerprint(filename) or '-', filename)
+                    if modified:
+                        edited += 1
+                    else:
+                        skipped += 1
+                pending += 1
+                if pending >= self.sync_interval:
+                    _sync(journal)
+                    pending = 0
+            _sync(journal)
+        finally:
+            journal.close()
+        return (edited, skipped, failed)
+
+    def run_directory(self, directory, extensions=None, recursive=False):
+        """
+        Apply the edits to all the image files in a directory, as
+        :meth:`run` does. XMP sidecars are not considered image files.
+
+        :param directory: path to the directory
+        :type directory: string
+        :param extensions: if not None, only the files with one of these
+                           extensions (e.g. ``'.nef'``, case insensitive) are
+                           edited
+        :type extensions: list of strings
+        :param recursive: whether to also edit the files in subdirectories
+        :type recursive: boolean
+
+        :return: the number of files edited, skipped (already up to date) and
+                 failed
+        :rtype: tuple (int, int, int)
+        """
+        if extensions is not None:
+            extensions = set(extension.lower() for extension in extensions)
+        filenames = []
+        for root, dirs, files in os.walk(directory):
+            if not recursive:
+                del dirs[:]
+            dirs.sort()
+            for name in sorted(files):
+                extension = os.path.splitext(name)[1].lower()
+                if extension == '.xmp':
+                    continue
+                if extensions is not None and extension not in extensions:
+                    continue
+                filenames.append(os.path.join(root, name))
+        return self.run(filenames)
+
+    def _fingerprint(self, filename):
+        # Fingerprint the file actually written for an image file.
+        if self.sidecar == 'only':
+            return _fingerprint(sidecar_filename(filename))
+        return _fingerprint(filename)
+
+    def _record(self, journal, state, fingerprint, filename):
+        journal.write('%s\t%s\t%s\n' %
+                      (state, fingerprint, filename.encode('string_escape')))
+
+    def _edit(self, filename):
+        # Apply the edits to a file, return False if its metadata was already
+        # up to date.
+        metadata = ImageMetadata(filename, self.sidecar)
+        metadata.read()
+        if self._is_up_to_date(metadata):
+            return False
+        metadata.update(self.edits,
+                        [key for key in self.deletes if key in metadata])
+        metadata.write(self.preserve_timestamps)
+        return True
+
+    def _is_up_to_date(self, metadata):
+        for key in self.deletes:
+            if key in metadata:
+                return False
+        for key, raw_value in self._raw_values.iteritems():
+            try:
+                if metadata[key].raw_value != raw_value:
+                    return False
+            except KeyError:
+                return False
+        return True
+
+
+def _digest(raw_values, deletes, sidecar):
+    # Digest of a set of edits, independent of the order of the tags.
+    digest = hashlib.sha1()
+    for key in sorted(raw_values):
+        value = raw_values[key]
+        if isinstance(value, dict):
+            value = sorted(value.iteritems())
+        digest.update(repr((key, value)))
+    digest.update(repr(sorted(set(deletes))))
+    digest.update(repr(sidecar))
+    return digest.hexdigest()
+
+
+def _fingerprint(filename):
+    try:
+        stat = os.stat(filename)
+    except OSError:
+        return None
+    return '%d:%.6f' % (stat.st_size, stat.st_mtime)
+
+
+def _drop_truncated_entry(journal):
+    # Truncate a journal after its last complete entry, so that the entries of
+    # a new run are not appended to one left truncated by an interrupted run.
+    if not os.path.exists(journal):
+        return
+    fd = open(journal, 'r+b')
+    try:
+        fd.seek(0, os.SEEK_END)
+        size = end = fd.tell()
+        while end > 0:
+            start = max(0, end - 4096)
+            fd.seek(start)
+            newline = fd.read(end - start).rfind('\n')
+            if newline != -1:
+                end = start + newline + 1
+                break
+            end = start
+        if end != size:
+            fd.truncate(end)
+    finally:
+        fd.close()
+
+
+def _sync(journal):
+    journal.flush()
+    os.fsync(journal.fileno())
+
@@ -38,6 +38,8 @@ from pyexiv2.utils import is_fraction, make_fraction, fraction_to_string, \
 import time
 import datetime
 import sys
+import collections
+import operator
 
 
 class ExifValueError(ValueError):
@@ -60,6 +62,164 @@ class ExifValueError(ValueError):
                (self.type, self.value)
 
 
+class ExifArray(collections.MutableSequence):
+
+    """
+    The values of a multi-valued numeric EXIF tag (Short, SShort, Long, SLong,
+    Rational or SRational).
+
+    An array behaves like a list, but its values are read and written in place
+    in the tag, without converting the whole list to and from the raw value of
+    the tag on each change.
+
+    The values are also exposed as native integers through the buffer
+    protocol (see :attr:`buffer`), e.g. for use with numpy. Rationals are then
+    exposed as an array of (numerator, denominator) pairs. While a buffer is
+    exported, neither the array nor the tag can be resized or given another
+    value, and the metadata of the image the tag belongs to cannot be read
+    again, cloned or have tags removed (a :exc:`BufferError` is raised).
+    """
+
+    def __init__(self, tag):
+        """
+        :param tag: the tag whose values are viewed
+        :type tag: :class:`ExifTag`
+        """
+        self._tag = tag
+        self._type = tag.type
+        self._array = libexiv2python._ExifArray(tag._tag)
+
+    def _detach(self):
+        # Keep the current values, independently from the tag.
+        self._array._detach()
+        self._tag = None
+
+    def _changed(self):
+        # The raw value of the tag is only rebuilt when needed.
+        if self._tag is not None:
+            self._tag._raw_value_pending = True
+
+    def _item_to_python(self, item):
+        if self._type in ('Rational', 'SRational'):
+            try:
+                return make_fraction(*item)
+            except ZeroDivisionError:
+                raise ExifValueError('%d/%d' % item, self._type)
+        elif self._type in ('Long', 'SLong'):
+            return long(item)
+        else:
+            return item
+
+    def _item_from_python(self, value):
+        if self._type in ('Rational', 'SRational'):
+            if is_fraction(value):
+                return (value.numerator, value.denominator)
+        elif self._type in ('Short', 'SShort'):
+            if isinstance(value, int):
+                return value
+        elif isinstance(value, (int, long)):
+            return value
+        raise ExifValueError(value, self._type)
+
+    def _index(self, index):
+        index = operator.index(index)
+        length = len(self)
+        if index < 0:
+            index += length
+        if index < 0 or index >= length:
+            raise IndexError('array index out of range')
+        return index
+
+    def __len__(self):
+        return len(self._array)
+
+    def __iter__(self):
+        return iter(self[:])
+
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            start, stop, step = index.indices(len(self))
+            if step == 1:
+                items = self._array._getItems(start, max(start, stop))
+                return map(self._item_to_python, items)
+            return [self[i] for i in xrange(start, stop, step)]
+        return self._item_to_python(self._array._getItem(self._index(index)))
+
+    def _write(self, value, function, *args):
+        try:
+            function(*args)
+        except ValueError:
+            # Out of the range of the type of the tag.
+            raise ExifValueError(value, self._type)
+
+    def __setitem__(self, index, value):
+        if isinstance(index, slice):
+            items = map(self._item_from_python, value)
+            start, stop, step = index.indices(len(self))
+            if step == 1:
+                self._write(value, self._array._setItems,
+                            start, max(start, stop), items)
+            else:
+                indexes = xrange(start, stop, step)
+                if len(items) != len(indexes):
+                    raise ValueError('attempt to assign sequence of size %d ' \
+                                     'to extended slice of size %d' % \
+                                     (len(items), len(indexes)))
+                for i, item in zip(indexes, items):
+                    self._write(value, self._array._setItem, i, item)
+        else:
+            index = self._index(index)
+            self._write(value, self._array._setItem,
+                        index, self._item_from_python(value))
+        self._changed()
+
+    def __delitem__(self, index):
+        if isinstance(index, slice):
+            start, stop, step = index.indices(len(self))
+            if step == 1:
+                self._array._setItems(start, max(start, stop), [])
+            else:
+                indexes = xrange(start, stop, step)
+                for i in sorted(indexes, reverse=True):
+                    self._array._setItems(i, i + 1, [])
+        else:
+            index = self._index(index)
+            self._array._setItems(index, index + 1, [])
+        self._changed()
+
+    def insert(self, index, value):
+        """
+        Insert a value before index.
+        """
+        length = len(self)
+        if index < 0:
+            index = max(0, index + length)
+        index = min(index, length)
+        self._write(value, self._array._setItems,
+                    index, index, [self._item_from_python(value)])
+        self._changed()
+
+    @property
+    def buffer(self):
+        """A :class:`memoryview` on the values of the array, as native
+        integers (of shape (n, 2) for rationals), that reads and writes them
+        in place."""
+        return memoryview(self._array)
+
+    def __eq__(self, other):
+        if isinstance(other, ExifArray):
+            other = list(other)
+        return list(self) == other
+
+    def __ne__(self, other):
+        return not self == other
+
+    __hash__ = None
+
+    def __repr__(self):
+        return repr(list(self))
+
+
 class ExifTag(ListenerInterface):
 
     """
@@ -76,6 +236,9 @@ class ExifTag(ListenerInterface):
     - Rational, SRational: [list of] :class:`fractions.Fraction` if available
       (Python ≥ 2.6) or :class:`pyexiv2.utils.Rational`      
     - Undefined: string
+
+    Multiple values of the numeric types are an :class:`ExifArray`, which
+    writes its changes straight into the tag.
     """
 
     # According to the EXIF specification, the only accepted format for an Ascii
@@ -87,6 +250,9 @@ class ExifTag(ListenerInterface):
 
     _date_formats = ('%Y:%m:%d',)
 
+    # The types whose multiple values are an ExifArray.
+    _array_types = ('Short', 'SShort', 'Long', 'SLong', 'Rational', 'SRational')
+
     def __init__(self, key, value=None, _tag=None):
         """
         The tag can be initialized with an optional value which expected type
@@ -102,6 +268,9 @@ class ExifTag(ListenerInterface):
         else:
             self._tag = libexiv2python._ExifTag(key)
         self._raw_value = None
+        # Whether the raw value is to be fetched from _tag when needed
+        self._raw_value_pending = False
+        self._raw_bytes = None
         self._value = None
         self._value_cookie = False
         if value is not None:
@@ -116,7 +285,15 @@ class ExifTag(ListenerInterface):
         tag = ExifTag(_tag._getKey(), _tag=_tag)
         # Do not set the raw_value property, as it would call _tag._setRawValue
         # (see https://bugs.launchpad.net/pyexiv2/+bug/582445).
-        tag._raw_value = _tag._getRawValue()
+        type = _tag._getType()
+        if type in ('Undefined', 'Comment'):
+            # The value is decoded natively, the raw value is only built if
+            # needed.
+            if type == 'Undefined':
+                tag._raw_bytes = _tag._getRawBytes()
+            tag._raw_value_pending = True
+        else:
+            tag._raw_value = _tag._getRawValue()
         tag._value_cookie = True
         return tag
 
@@ -158,31 +335,64 @@ class ExifTag(ListenerInterface):
         return self._tag._getSectionDescription()
 
     def _get_raw_value(self):
+        if self._raw_value_pending:
+            self._raw_value = self._tag._getRawValue()
+            self._raw_value_pending = False
         return self._raw_value
 
     def _set_raw_value(self, value):
         self._tag._setRawValue(value)
         self._raw_value = value
+        self._raw_value_pending = False
+        self._raw_bytes = None
         self._value_cookie = True
 
     raw_value = property(fget=_get_raw_value, fset=_set_raw_value,
                          doc='The raw value of the tag as a string.')
 
+    def _get_raw_bytes(self):
+        if self._raw_bytes is None:
+            self._raw_bytes = self._tag._getRawBytes()
+        return self._raw_bytes
+
+    def _set_raw_bytes(self, value):
+        self._tag._setRawBytes(value)
+        if isinstance(value, str):
+            self._raw_bytes = value
+        else:
+            self._raw_bytes = memoryview(value).tobytes()
+        self._raw_value = None
+        self._raw_value_pending = True
+        self._value_cookie = True
+
+    raw_bytes = property(fget=_get_raw_bytes, fset=_set_raw_bytes,
+                         doc='The value of a byte-valued tag (Undefined, ' \
+                             'Byte or SByte) as a string of bytes, without ' \
+                             'conversion. It can be set from any object ' \
+                             'exposing a buffer (str, bytearray, ' \
+                             'memoryview).')
+
     def _compute_value(self):
         # Lazy computation of the value from the raw value.
-        if self.type in \
-            ('Short', 'SShort', 'Long', 'SLong', 'Rational', 'SRational'):
+        if self.type == 'Undefined' and self._raw_bytes is not None:
+            self._value = self._raw_bytes
+            self._value_cookie = False
+            return
+
+        if self.type == 'Comment':
+            self._value = self._tag._getComment()
+            self._value_cookie = False
+            return
+
+        if self.type in self._array_types:
             # May contain multiple values
-            values = self._raw_value.split()
+            values = ExifArray(self)
             if len(values) > 1:
-                # Make values a notifying list
-                values = map(self._convert_to_python, values)
-                self._value = NotifyingList(values)
-                self._value.register_listener(self)
+                self._value = values
                 self._value_cookie = False
                 return
 
-        self._value = self._convert_to_python(self._raw_value)
+        self._value = self._convert_to_python(self.raw_value)
         self._value_cookie = False
 
     def _get_value(self):
@@ -191,7 +401,39 @@ class ExifTag(ListenerInterface):
         return self._value
 
     def _set_value(self, value):
-        if isinstance(value, (list, tuple)):
+        if self.type == 'Undefined' and \
+                isinstance(value, (basestring, bytearray, memoryview)):
+            # Set the bytes directly, without converting them to a raw value.
+            if isinstance(value, unicode):
+                self.raw_bytes = value.encode('utf-8')
+            else:
+                self.raw_bytes = value
+            if isinstance(value, basestring):
+                self._value = value
+                self._value_cookie = False
+            return
+
+        if self.type == 'Comment' and isinstance(value, basestring):
+            # Encode the comment natively, according to its current charset.
+            self._tag._setComment(value)
+            self._raw_value = None
+            self._raw_value_pending = True
+            self._value = value
+            self._value_cookie = False
+            return
+
+        if isinstance(value, ExifArray) and value._tag is self:
+            # The array already reads and writes the values of the tag.
+            self._value = value
+            self._value_cookie = False
+            return
+
+        if isinstance(self._value, ExifArray):
+            # Keep the previous array from following the new values.
+            self._value._detach()
+            self._value_cookie = True
+
+        if isinstance(value, (list, tuple, ExifArray)):
             raw_values = map(self._convert_to_string, value)
             self.raw_value = ' '.join(raw_values)
         else:
@@ -200,7 +442,10 @@ class ExifTag(ListenerInterface):
         if isinstance(self._value, NotifyingList):
             self._value.unregister_listener(self)
 
-        if isinstance(value, NotifyingList):
+        if isinstance(value, (list, tuple, ExifArray)) and \
+                self.type in self._array_types:
+            self._value = ExifArray(self)
+        elif isinstance(value, NotifyingList):
             # Already a notifying list
             self._value = value
             self._value.register_listener(self)
@@ -346,11 +591,46 @@ class ExifTag(ListenerInterface):
 
         :raise ExifValueError: if the conversion fails
         """
-        if self.type == 'Ascii':
+        if self.type == 'Comment' and value is not None and \
+                self.raw_value is not None and \
+                self.raw_value.startswith('charset='):
+            charset, val = self.raw_value.split(' ', 1)
+            charset = charset.split('=')[1].strip('"')
+            encoding = self._match_encoding(charset)
+            try:
+                val = value.encode(encoding)
+            except UnicodeError:
+                # Best effort, do not fail just because the original
+                # encoding of the tag cannot encode the new value.
+                pass
+            else:
+                return 'charset="%s" %s' % (charset, val)
+
+        return ExifTag._value_to_string(value, self.type, self.key)
+
+    @staticmethod
+    def _value_to_string(value, type, key):
+        """
+        Convert one value to the string representation of a value of a given
+        type, without a tag (the charset of an existing comment is therefore
+        not taken into account).
+
+        :param value: the value to be converted
+        :param type: the EXIF type of the value
+        :type type: string
+        :param key: the key of the tag the value is meant for
+        :type key: string
+
+        :return: the value converted to its corresponding string representation
+        :rtype: string
+
+        :raise ExifValueError: if the conversion fails
+        """
+        if type == 'Ascii':
             if isinstance(value, datetime.datetime):
                 return DateTimeFormatter.exif(value)
             elif isinstance(value, datetime.date):
-                if self.key == 'Exif.GPSInfo.GPSDateStamp':
+                if key == 'Exif.GPSInfo.GPSDateStamp':
                     # Special case
                     return DateTimeFormatter.exif(value)
                 else:
@@ -359,96 +639,82 @@ class ExifTag(ListenerInterface):
                 try:
                     return value.encode('utf-8')
                 except UnicodeEncodeError:
-                    raise ExifValueError(value, self.type)
+                    raise ExifValueError(value, type)
             elif isinstance(value, str):
                 return value
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type in ('Byte', 'SByte'):
+        elif type in ('Byte', 'SByte'):
             if isinstance(value, unicode):
                 try:
                     return value.encode('utf-8')
                 except UnicodeEncodeError:
-                    raise ExifValueError(value, self.type)
+                    raise ExifValueError(value, type)
             elif isinstance(value, str):
                 return value
             else:
-                raise ExifValueError(value, self.type)
-
-        elif self.type == 'Comment':
-            if value is not None and self.raw_value is not None and \
-                self.raw_value.startswith('charset='):
-                charset, val = self.raw_value.split(' ', 1)
-                charset = charset.split('=')[1].strip('"')
-                encoding = self._match_encoding(charset)
-                try:
-                    val = value.encode(encoding)
-                except UnicodeError:
-                    # Best effort, do not fail just because the original
-                    # encoding of the tag cannot encode the new value.
-                    pass
-                else:
-                    return 'charset="%s" %s' % (charset, val)
+                raise ExifValueError(value, type)
 
+        elif type == 'Comment':
             if isinstance(value, unicode):
                 try:
                     return value.encode('utf-8')
                 except UnicodeEncodeError:
-                    raise ExifValueError(value, self.type)
+                    raise ExifValueError(value, type)
             elif isinstance(value, str):
                 return value
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type == 'Short':
+        elif type == 'Short':
             if isinstance(value, int) and value >= 0:
                 return str(value)
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type == 'SShort':
+        elif type == 'SShort':
             if isinstance(value, int):
                 return str(value)
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type == 'Long':
+        elif type == 'Long':
             if isinstance(value, (int, long)) and value >= 0:
                 return str(value)
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type == 'SLong':
+        elif type == 'SLong':
             if isinstance(value, (int, long)):
                 return str(value)
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type == 'Rational':
+        elif type == 'Rational':
             if is_fraction(value) and value.numerator >= 0:
                 return fraction_to_string(value)
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type == 'SRational':
+        elif type == 'SRational':
             if is_fraction(value):
                 return fraction_to_string(value)
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        elif self.type == 'Undefined':
+        elif type == 'Undefined':
             if isinstance(value, unicode):
                 try:
                     return string_to_undefined(value.encode('utf-8'))
                 except UnicodeEncodeError:
-                    raise ExifValueError(value, self.type)
+                    raise ExifValueError(value, type)
             elif isinstance(value, str):
                 return string_to_undefined(value)
             else:
-                raise ExifValueError(value, self.type)
+                raise ExifValueError(value, type)
 
-        raise ExifValueError(value, self.type)
+        raise ExifValueError(value, type)
 
     def __str__(self):
         """
@@ -456,12 +722,12 @@ class ExifTag(ListenerInterface):
         :rtype: string
         """
         left = '%s [%s]' % (self.key, self.type)
-        if self._raw_value is None:
+        if self._raw_value is None and not self._raw_value_pending:
             right = '(No value)'
-        elif self.type == 'Undefined' and len(self._raw_value) > 100:
+        elif self.type == 'Undefined' and len(self.raw_value) > 100:
             right = '(Binary value suppressed)'
         else:
-             right = self._raw_value
+             right = self.raw_value
         return '<%s = %s>' % (left, right)
 
     # Support for pickling.
@@ -70,7 +70,7 @@ class IptcTag(ListenerInterface):
     python types the value of a tag may take:
 
     - Short: int
-    - String: string
+    - String: unicode (decoded from the charset of the IPTC data)
     - Date: :class:`datetime.date`
     - Time: :class:`datetime.time`
     - Undefined: string
@@ -192,8 +192,12 @@ class IptcTag(ListenerInterface):
 
     def _compute_values(self):
         # Lazy computation of the values from the raw values
-        self._values = \
-            NotifyingList(map(self._convert_to_python, self._raw_values))
+        if self.type == 'String':
+            # Decoded natively from the charset of the IPTC data.
+            self._values = NotifyingList(self._tag._getStringValues())
+        else:
+            self._values = \
+                NotifyingList(map(self._convert_to_python, self._raw_values))
         self._values.register_listener(self)
         self._values_cookie = False
 
@@ -205,7 +209,14 @@ class IptcTag(ListenerInterface):
     def _set_values(self, values):
         if not isinstance(values, (list, tuple)):
             raise TypeError('Expecting a list of values')
-        self.raw_value = map(self._convert_to_string, values)
+        if self.type == 'String':
+            # Encode the values back into the charset they were decoded from.
+            encoding = self._tag._getStringEncoding()
+            self.raw_value = [IptcTag._value_to_string(value, self.type,
+                                                       encoding)
+                              for value in values]
+        else:
+            self.raw_value = map(self._convert_to_string, values)
 
         if isinstance(self._values, NotifyingList):
             self._values.unregister_listener(self)
@@ -262,9 +273,9 @@ class IptcTag(ListenerInterface):
                 raise IptcValueError(value, self.type)
 
         elif self.type == 'String':
-            # There is currently no charset conversion.
-            # TODO: guess the encoding and decode accordingly into unicode
-            # where relevant.
+            # The values of a tag are decoded natively from the charset of
+            # the IPTC data (see _compute_values), a single raw value is
+            # returned as is.
             return value
 
         elif self.type == 'Date':
@@ -317,42 +328,65 @@ class IptcTag(ListenerInterface):
 
         :raise IptcValueError: if the conversion fails
         """
-        if self.type == 'Short':
+        if self.type == 'String':
+            encoding = self._tag._getStringEncoding()
+        else:
+            encoding = 'utf-8'
+        return IptcTag._value_to_string(value, self.type, encoding)
+
+    @staticmethod
+    def _value_to_string(value, type, encoding='utf-8'):
+        """
+        Convert one value to the string representation of a value of a given
+        type, without a tag.
+
+        :param value: the value to be converted
+        :param type: the IPTC type of the value
+        :type type: string
+        :param encoding: the codec unicode strings are encoded with
+        :type encoding: string
+
+        :return: the value converted to its corresponding string representation
+        :rtype: string
+
+        :raise IptcValueError: if the conversion fails
+        """
+        if type == 'Short':
             if isinstance(value, int):
                 return str(value)
             else:
-                raise IptcValueError(value, self.type)
+                raise IptcValueError(value, type)
 
-        elif self.type == 'String':
+        elif type == 'String':
             if isinstance(value, unicode):
                 try:
-                    return value.encode('utf-8')
+                    return value.encode(encoding)
                 except UnicodeEncodeError:
-                    raise IptcValueError(value, self.type)
+                    raise IptcValueError(value, type)
             elif isinstance(value, str):
                 return value
             else:
-                raise IptcValueError(value, self.type)
+                raise IptcValueError(value, type)
 
-        elif self.type == 'Date':
+        elif type == 'Date':
             if isinstance(value, (datetime.date, datetime.datetime)):
                 return DateTimeFormatter.iptc_date(value)
             else:
-                raise IptcValueError(value, self.type)
+                raise IptcValueError(value, type)
 
-        elif self.type == 'Time':
+        elif type == 'Time':
             if isinstance(value, (datetime.time, datetime.datetime)):
                 return DateTimeFormatter.iptc_time(value)
             else:
-                raise IptcValueError(value, self.type)
+                raise IptcValueError(value, type)
 
-        elif self.type == 'Undefined':
+        elif type == 'Undefined':
             if isinstance(value, str):
                 return value
             else:
-                raise IptcValueError(value, self.type)
+                raise IptcValueError(value, type)
 
-        raise IptcValueError(value, self.type)
+        raise IptcValueError(value, type)
 
     def __str__(self):
         """
@@ -31,16 +31,220 @@ Provide the ImageMetadata class.
 import os
 import sys
 from errno import ENOENT
-from collections import MutableMapping
+from collections import Mapping, MutableMapping
 from itertools import chain
 import codecs
 
 import libexiv2python
 
-from pyexiv2.exif import ExifTag, ExifThumbnail
+from pyexiv2.exif import ExifTag, ExifThumbnail, ExifArray
 from pyexiv2.iptc import IptcTag
 from pyexiv2.xmp import XmpTag
 from pyexiv2.preview import Preview
+from pyexiv2.utils import map_in_threads
+
+
+def _to_raw_values(tags):
+    # Convert a mapping (or a sequence of pairs) of keys to tags or values
+    # into a dictionary of raw values suitable to pass to libexiv2, and return
+    # it together with the set of the families of metadata it touches.
+    raw_values = {}
+    families = set()
+    for key, tag_or_value in dict(tags).iteritems():
+        family = key.split('.')[0].lower()
+        if family == 'exif':
+            tag_class = ExifTag
+        elif family == 'iptc':
+            tag_class = IptcTag
+        elif family == 'xmp':
+            tag_class = XmpTag
+        else:
+            raise KeyError(key)
+        if isinstance(tag_or_value, tag_class):
+            raw_values[tag_or_value.key] = tag_or_value.raw_value
+        else:
+            raw_value = _to_raw_value(family, key, tag_or_value)
+            if raw_value is None:
+                tag = tag_class(key, tag_or_value)
+                raw_values[tag.key] = tag.raw_value
+            else:
+                raw_values[key] = raw_value
+        families.add(family)
+    return (raw_values, families)
+
+
+def _to_raw_value(family, key, value):
+    # Convert a plain value for a tag known to libexiv2 straight to its raw
+    # value, from the type of the tag, without building the tag.
+    # Return None if this requires the tag: for unknown keys, and for values
+    # that libexiv2 converts natively.
+    type = _known_tag_type(family, key)
+    if type is None or value is None:
+        return None
+    if family == 'exif':
+        if type in ('Comment', 'Undefined') or isinstance(value, ExifArray):
+            return None
+        if isinstance(value, (list, tuple)):
+            return ' '.join([ExifTag._value_to_string(item, type, key)
+                             for item in value])
+        return ExifTag._value_to_string(value, type, key)
+    elif family == 'iptc':
+        if not isinstance(value, (list, tuple)):
+            raise TypeError('Expecting a list of values')
+        return [IptcTag._value_to_string(item, type) for item in value]
+    else:
+        if type == 'Lang Alt':
+            exiv2_type = 'LangAlt'
+        else:
+            exiv2_type = {'alt ': 'XmpAlt', 'bag ': 'XmpBag',
+                          'seq ': 'XmpSeq'}.get(type[:4].lower(), 'XmpText')
+        return XmpTag._value_to_raw(value, type, exiv2_type)
+
+
+def _decode_xmp_struct(value):
+    # Decode the raw strings of an XMP structure returned by libexiv2.
+    if isinstance(value, dict):
+        return dict((name, _decode_xmp_struct(item))
+                    for name, item in value.iteritems())
+    elif isinstance(value, list):
+        return [_decode_xmp_struct(item) for item in value]
+    else:
+        return value.decode('utf-8')
+
+
+def _encode_xmp_struct(value):
+    # Convert an XMP structure into raw strings suitable to pass to libexiv2.
+    if isinstance(value, dict):
+        return dict((name, _encode_xmp_struct(item))
+                    for name, item in value.iteritems())
+    elif isinstance(value, (list, tuple)):
+        return [_encode_xmp_struct(item) for item in value]
+    elif isinstance(value, unicode):
+        return value.encode('utf-8')
+    else:
+        return str(value)
+
+
+# An empty XMP sidecar, to start from when it doesn't exist yet.
+_EMPTY_SIDECAR = '<?xpacket begin="\xef\xbb\xbf" ' \
+                 'id="W5M0MpCehiHzreSzNTczkc9d"?>\n' \
+                 '<x:xmpmeta xmlns:x="adobe:ns:meta/">\n' \
+                 ' <rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#"/>\n' \
+                 '</x:xmpmeta>\n' \
+                 '<?xpacket end="w"?>'
+
+_SIDECAR_MODES = (None, 'only', 'prefer', 'fallback')
+
+
+def sidecar_filename(filename):
+    """
+    Return the path to the XMP sidecar file of an image file (the same path
+    with a ``.xmp`` extension).
+
+    :param filename: path to an image file
+    :type filename: string
+
+    :rtype: string
+    """
+    return os.path.splitext(filename)[0] + '.xmp'
+
+
+def _write_dump(dump, output):
+    # Write a dump to a file-like object or to a file descriptor.
+    if isinstance(output, (int, long)):
+        while dump:
+            dump = dump[os.write(output, dump):]
+    else:
+        output.write(dump)
+
+
+def human_dump_files(filenames, format='text', workers=1):
+    """
+    Dump all the tags of a batch of image files with their human-readable
+    values (see :meth:`ImageMetadata.human_dump`).
+    Each worker thread processes its share of the files in a single call to
+    libexiv2, without holding the GIL.
+    A file that cannot be read doesn't stop the others: the exception it
+    raised, naming it in its message and in its ``filename`` attribute, is
+    returned in place of its dump.
+
+    :param filenames: paths to image files
+    :type filenames: list of strings
+    :param format: ``'text'`` or ``'json'``
+    :type format: string
+    :param workers: the number of worker threads
+    :type workers: int
+
+    :return: the dumps of the files (or their errors), in order
+    :rtype: list of strings (and exceptions)
+
+    :raise ValueError: if the format is unknown
+    """
+    encoding = sys.getfilesystemencoding()
+    filenames = [isinstance(filename, unicode) and \
+                 filename.encode(encoding) or filename \
+                 for filename in filenames]
+    workers = max(1, min(workers, len(filenames)))
+    batches = [filenames[i::workers] for i in xrange(workers)]
+    def dump(batch):
+        return libexiv2python._humanDumpFiles(batch, format)
+    results = map_in_threads(dump, batches, workers)
+    dumps = [None] * len(filenames)
+    for i, result in enumerate(results):
+        dumps[i::workers] = result
+    return dumps
+
+
+_KNOWN_TAGS = {}
+_KNOWN_TAG_TYPES = {}
+
+
+def _flush_known_xmp_tags():
+    # Drop the XMP tags from the cache of known tags, to be called whenever
+    # the custom XMP namespaces change.
+    for key in _KNOWN_TAGS.keys():
+        if key[0] == 'xmp':
+            _KNOWN_TAGS.pop(key, None)
+    _KNOWN_TAG_TYPES.pop('xmp', None)
+
+
+def _known_tag_type(family, key):
+    # The type of a tag known to libexiv2 (as returned by known_tags()), None
+    # for other keys.
+    types = _KNOWN_TAG_TYPES.get(family)
+    if types is None:
+        types = dict((tag[0], tag[1]) for tag in known_tags(family))
+        _KNOWN_TAG_TYPES[family] = types
+    return types.get(key)
+
+
+def known_tags(family, group=None):
+    """
+    Return the tags known to libexiv2 for a family of metadata, read from its
+    static tables in a single call and cached after the first one (until
+    custom XMP namespaces are registered or unregistered, for XMP).
+
+    :param family: ``'exif'``, ``'iptc'`` or ``'xmp'``
+    :type family: string
+    :param group: an optional group to restrict the tags to: the name of an
+                  IFD for EXIF (e.g. ``'Photo'``), of a record for IPTC (e.g.
+                  ``'Application2'``) or the prefix of a namespace for XMP
+                  (e.g. ``'dc'``)
+    :type group: string
+
+    :return: a (key, type, label, description) tuple for each tag
+    :rtype: tuple of tuples
+
+    :raise ValueError: if the family is unknown
+    :raise KeyError: if the group is unknown
+    """
+    family = family.lower()
+    try:
+        return _KNOWN_TAGS[(family, group)]
+    except KeyError:
+        tags = libexiv2python._knownTags(family, group or '')
+        _KNOWN_TAGS[(family, group)] = tags
+        return tags
 
 
 class ImageMetadata(MutableMapping):
@@ -52,16 +256,46 @@ class ImageMetadata(MutableMapping):
     metadata embedded in image files such as JPEG and TIFF files, using Python
     types.
     It also provides access to the previews embedded in an image.
+
+    An image container can be used from several threads at once: reads of the
+    metadata proceed concurrently, while modifications and accesses to the
+    image file or buffer are serialized. Tags obtained from a container are
+    not protected though, and must not be modified by one thread while
+    another one modifies the same container.
+
+    The XMP metadata may also be kept in a sidecar file next to the image
+    (see :func:`sidecar_filename`), depending on the sidecar mode:
+
+    * ``None``: the sidecar is ignored
+    * ``'only'``: only the sidecar is read and written, the image file is
+      never opened (a missing sidecar is created when writing)
+    * ``'prefer'``: the XMP properties of the sidecar take precedence over
+      those embedded in the image, and the XMP metadata is written to the
+      sidecar only (the XMP packet embedded in the image is left as it was)
+    * ``'fallback'``: the XMP properties embedded in the image take
+      precedence over those of the sidecar, and the XMP metadata is written
+      to the sidecar only
+
+    Sidecar modes other than ``None`` require the path to an image file.
     """
 
-    def __init__(self, filename):
+    def __init__(self, filename, sidecar=None):
         """
         :param filename: path to an image file
         :type filename: string
+        :param sidecar: the sidecar mode
+        :type sidecar: string
+
+        :raise ValueError: if the sidecar mode is invalid
         """
+        if sidecar not in _SIDECAR_MODES:
+            raise ValueError('Invalid sidecar mode: %r' % sidecar)
         self.filename = filename
         if filename is not None and isinstance(filename, unicode):
             self.filename = filename.encode(sys.getfilesystemencoding())
+        self.sidecar = sidecar
+        self._new_sidecar = False
+        self._sidecar_times = None
         self.__image = None
         self._keys = {'exif': None, 'iptc': None, 'xmp': None}
         self._tags = {'exif': {}, 'iptc': {}, 'xmp': {}}
@@ -90,12 +324,58 @@ class ImageMetadata(MutableMapping):
         obj.__image = libexiv2python._Image(buffer, len(buffer))
         return obj
 
+    def clone(self):
+        """
+        Return a copy of the image container that shares the metadata already
+        read instead of reading and parsing it again.
+        The metadata is copied the first time either container modifies it,
+        so that changes made to one of them are never seen by the other. Both containers write back to the same image
+        file, unless they were instantiated from a buffer.
+        Tags obtained from this container before cloning it keep modifying
+        this container only.
+
+        :return: a copy of the image container
+        :rtype: :class:`ImageMetadata`
+        """
+        obj = self.__class__(self.filename, self.sidecar)
+        obj.__image = self._image._clone()
+        obj._new_sidecar = self._new_sidecar
+        obj._sidecar_times = self._sidecar_times
+        if self.filename is not None and not self._new_sidecar:
+            obj._atime = self._atime
+            obj._mtime = self._mtime
+        # Tags cached before cloning refer to the shared metadata.
+        self._flush_cache('exif', 'iptc', 'xmp')
+        return obj
+
+    def snapshot(self):
+        """
+        Return a read-only view of the metadata as it is now.
+        Subsequent changes to the image metadata are not seen by the
+        snapshot, which can be read concurrently from other threads while
+        this container is being modified.
+
+        :return: a snapshot of the metadata
+        :rtype: :class:`MetadataSnapshot`
+        """
+        snapshot = MetadataSnapshot(self._image._snapshot())
+        # Tags cached before the snapshot refer to the shared metadata.
+        self._flush_cache('exif', 'iptc', 'xmp')
+        return snapshot
+
     @property
     def _image(self):
         if self.__image is None:
             raise IOError('Image metadata has not been read yet')
         return self.__image
 
+    def _flush_cache(self, *families):
+        # Empty the cache of keys and tags for the given families of metadata,
+        # to be called whenever the underlying image was modified behind it.
+        for family in families:
+            self._keys[family] = None
+            self._tags[family] = {}
+
     def read(self):
         """
         Read the metadata embedded in the associated image.
@@ -104,29 +384,119 @@ class ImageMetadata(MutableMapping):
         before calling this method).
         """
         if self.__image is None:
-            self.__image = self._instantiate_image(self.filename)
+            if self.sidecar == 'only':
+                path = self._sidecar_filename()
+                if os.path.exists(path):
+                    self.__image = self._instantiate_image(path)
+                else:
+                    self.__image = libexiv2python._Image(_EMPTY_SIDECAR,
+                                                         len(_EMPTY_SIDECAR))
+                    self._new_sidecar = True
+            else:
+                self.__image = self._instantiate_image(self.filename)
         self.__image._readMetadata()
+        if self.sidecar in ('prefer', 'fallback'):
+            path = self._sidecar_filename()
+            if os.path.exists(path):
+                stat = os.stat(path)
+                self._sidecar_times = (stat.st_atime, stat.st_mtime)
+                self.__image._readSidecar(path, self.sidecar == 'prefer')
+            else:
+                self._sidecar_times = None
 
-    def write(self, preserve_timestamps=False):
+    def _sidecar_filename(self):
+        # Return the path to the sidecar of the image file.
+        # Throw a ValueError if the image was not read from a file.
+        if self.filename is None:
+            raise ValueError('An image read from a buffer has no sidecar')
+        return sidecar_filename(self.filename)
+
+    def write(self, preserve_timestamps=False, xmp_compact=False,
+              xmp_rdf_attributes=None, xmp_packet_wrapper=True,
+              xmp_padding=None):
         """
         Write the metadata back to the image.
 
-        :param preserve_timestamps: whether to preserve the file's original
+        The XMP options control the layout of the XMP packet embedded in the
+        image. If none of them is passed, libexiv2's default layout is used
+        (and an XMP packet that was not modified is written back as is). They
+        require libexiv2 0.22 or later, and are ignored with earlier versions
+        and for sidecars.
+
+        :param preserve_timestamps: whether to preserve the original
                                     timestamps (access time and modification
-                                    time)
+                                    time) of the file and of its sidecar
         :type preserve_timestamps: boolean
+        :param xmp_compact: whether to omit all whitespace and newlines from
+                            the XMP packet
+        :type xmp_compact: boolean
+        :param xmp_rdf_attributes: whether to write simple XMP properties as
+                                   RDF attributes where possible (None for
+                                   libexiv2's default, which does)
+        :type xmp_rdf_attributes: boolean
+        :param xmp_packet_wrapper: whether to wrap the XMP packet in
+                                   ``<?xpacket?>`` processing instructions
+        :type xmp_packet_wrapper: boolean
+        :param xmp_padding: the number of bytes of padding to add to the XMP
+                            packet (None or 0 for the default padding)
+        :type xmp_padding: int
         """
-        self._image._writeMetadata()
-        if self.filename is None:
+        if self.sidecar == 'only':
+            # Write the XMP metadata alone, libexiv2 would otherwise convert
+            # back to XMP the EXIF and IPTC metadata it derived from it.
+            path = self._sidecar_filename()
+            self._image._writeSidecar(path)
+        else:
+            if xmp_compact or xmp_rdf_attributes is not None or \
+                    not xmp_packet_wrapper or xmp_padding is not None:
+                # Start from libexiv2's default layout.
+                xmp_format = libexiv2python._XMP_USE_COMPACT_FORMAT
+                if xmp_compact:
+                    xmp_format |= libexiv2python._XMP_OMIT_ALL_FORMATTING
+                if xmp_rdf_attributes is False:
+                    xmp_format &= ~libexiv2python._XMP_USE_COMPACT_FORMAT
+                if not xmp_packet_wrapper:
+                    xmp_format |= libexiv2python._XMP_OMIT_PACKET_WRAPPER
+                self._image._writeMetadata(xmp_format, xmp_padding or 0)
+            else:
+                self._image._writeMetadata()
+            if self.sidecar is not None:
+                sidecar = self._sidecar_filename()
+                self._image._writeSidecar(sidecar)
+                if preserve_timestamps and self._sidecar_times is not None:
+                    os.utime(sidecar, self._sidecar_times)
+                else:
+                    stat = os.stat(sidecar)
+                    self._sidecar_times = (stat.st_atime, stat.st_mtime)
+            path = self.filename
+        if path is None:
             return
-        if preserve_timestamps:
+        if preserve_timestamps and not self._new_sidecar:
             # Revert to the original timestamps
-            os.utime(self.filename, (self._atime, self._mtime))
+            os.utime(path, (self._atime, self._mtime))
         else:
             # Reset the reference timestamps
-            stat = os.stat(self.filename)
+            stat = os.stat(path)
             self._atime = stat.st_atime
             self._mtime = stat.st_mtime
+        self._new_sidecar = False
+
+    def write_sidecar(self, filename=None):
+        """
+        Write the XMP metadata to a sidecar file, replacing it if it exists.
+
+        :param filename: path to the sidecar file, defaults to the sidecar of
+                         the image file (see :func:`sidecar_filename`)
+        :type filename: string
+
+        :raise ValueError: if no filename is given and the image was read
+                           from a buffer
+        """
+        if filename is None:
+            filename = self._sidecar_filename()
+        elif isinstance(filename, unicode):
+            filename = filename.encode(sys.getfilesystemencoding())
+        self._image._writeSidecar(filename)
 
     @property
     def dimensions(self):
@@ -331,12 +701,143 @@ class ImageMetadata(MutableMapping):
         else:
             raise KeyError(key)
 
+    def update(self, edits=(), deletes=()):
+        """
+        Set and delete several metadata tags at once.
+        All the values are converted and validated before the image is
+        modified, then applied in a single call to libexiv2: if one of the
+        changes fails, the image is left untouched.
+
+        :param edits: a mapping (or a sequence of (key, tag or value) pairs)
+                      of the tags to set, with the same semantics as
+                      :meth:`.__setitem__`
+        :type edits: dict
+        :param deletes: the keys of the tags to delete (deletions are applied
+                        before edits)
+        :type deletes: list of strings
+
+        :raise KeyError: if one of the keys is invalid or one of the tags to
+                         delete doesn't exist
+        :raise ValueError: if one of the values is invalid
+        """
+        raw_values, families = _to_raw_values(edits)
+        deletes = list(deletes)
+        for key in deletes:
+            families.add(key.split('.')[0].lower())
+        self._image._update(raw_values, deletes)
+        self._flush_cache(*families)
+
+    def begin(self):
+        """
+        Start a transaction: all the changes made to the metadata from now on
+        can be undone at once by calling :meth:`.rollback`, until
+        :meth:`.commit` is called.
+        Only the in-memory metadata is concerned, a call to :meth:`.write`
+        during the transaction is not undone by :meth:`.rollback`.
+
+        The changes are not journaled: the whole metadata is copied when the
+        transaction starts, which takes as much memory as the metadata itself
+        (EXIF thumbnail and makernotes included) until the transaction ends,
+        however few tags are modified. On images with large metadata, prefer
+        :meth:`.update` to apply a set of changes atomically.
+
+        :raise RuntimeError: if a transaction is already in progress
+        """
+        self._image._begin()
+
+    def commit(self):
+        """
+        End the transaction in progress, keeping the changes made to the
+        metadata since :meth:`.begin` was called.
+
+        :raise RuntimeError: if no transaction is in progress
+        """
+        self._image._commit()
+
+    def rollback(self):
+        """
+        End the transaction in progress, restoring the metadata to the state
+        it was in when :meth:`.begin` was called.
+        Tags previously obtained from the metadata must not be used anymore.
+
+        :raise RuntimeError: if no transaction is in progress
+        """
+        self._image._rollback()
+        self._flush_cache('exif', 'iptc', 'xmp')
+
     def __iter__(self):
         return chain(self.exif_keys, self.iptc_keys, self.xmp_keys)
 
     def __len__(self):
         return len( [ x for x in self ] )
 
+    def get_xmp_struct(self, key):
+        """
+        Return a whole XMP structure (a struct, an array of structs, or any
+        nesting thereof, such as ``Xmp.mwg-rs.Regions``) in one call.
+        Structs are returned as dictionaries keyed by the qualified names of
+        their fields (e.g. ``stDim:w``), arrays as lists, language
+        alternatives as dictionaries keyed by language, and simple values as
+        unicode strings.
+
+        :param key: the key of the structure, or of a member of it (e.g.
+                    ``Xmp.mwg-rs.Regions/mwg-rs:RegionList``)
+        :type key: string
+
+        :return: the structure
+        :rtype: dict or list
+
+        :raise KeyError: if the structure is not set
+        """
+        return _decode_xmp_struct(self._image._getXmpStruct(key))
+
+    def set_xmp_struct(self, key, value):
+        """
+        Replace a whole XMP structure in one call.
+        The value is nested as returned by :meth:`get_xmp_struct`. Arrays keep
+        their type (bag, sequence or alternative) if they were already set,
+        and are unordered bags otherwise. A dictionary whose keys are not
+        qualified names is a language alternative.
+
+        :param key: the key of the structure, or of a member of it
+        :type key: string
+        :param value: the structure
+        :type value: dict or list
+
+        :raise ValueError: if the value is not a valid structure
+        """
+        self._image._setXmpStruct(key, _encode_xmp_struct(value))
+        self._flush_cache('xmp')
+
+    def get_xmp_packet(self):
+        """
+        Return the raw XMP packet of the image.
+        If the XMP metadata was not modified since it was read, this is the
+        packet exactly as embedded in the image, otherwise it is serialized
+        from the current XMP metadata.
+
+        :return: the XMP packet
+        :rtype: string
+        """
+        return self._image._getXmpPacket()
+
+    def set_xmp_packet(self, packet, check=False):
+        """
+        Embed a raw XMP packet in the image, replacing the current XMP
+        metadata. The packet is written back as is, and only parsed when the
+        XMP metadata is next accessed.
+
+        :param packet: the XMP packet
+        :type packet: string
+        :param check: whether to parse the packet right away to make sure it
+                      is well-formed
+        :type check: boolean
+
+        :raise ValueError: if check is True and the packet is not well-formed
+        """
+        self._image._setXmpPacket(packet, check)
+        self._flush_cache('xmp')
+
     def _get_comment(self):
         return self._image._getComment()
 
@@ -380,17 +881,39 @@ class ImageMetadata(MutableMapping):
         self._image._copyMetadata(other._image, exif, iptc, xmp)
         # Empty the cache where needed
         if exif:
-            other._keys['exif'] = None
-            other._tags['exif'] = {}
+            other._flush_cache('exif')
         if iptc:
-            other._keys['iptc'] = None
-            other._tags['iptc'] = {}
+            other._flush_cache('iptc')
         if xmp:
-            other._keys['xmp'] = None
-            other._tags['xmp'] = {}
+            other._flush_cache('xmp')
         if comment:
             other.comment = self.comment
 
+    def human_dump(self, format='text', output=None):
+        """
+        Dump all the tags with their human-readable values.
+        The metadata is walked in a single pass by libexiv2, without holding
+        the GIL.
+
+        :param format: ``'text'`` for one line per tag (key, label and
+                       human-readable value separated by tabs), or ``'json'``
+                       for an array of objects with ``key``, ``label`` and
+                       ``value`` members
+        :type format: string
+        :param output: an optional file-like object or file descriptor to
+                       write the dump to
+        :type output: file-like object or int
+
+        :return: the dump if no output was given, None otherwise
+        :rtype: string
+
+        :raise ValueError: if the format is unknown
+        """
+        dump = self._image._humanDump(format)
+        if output is None:
+            return dump
+        _write_dump(dump, output)
+
     @property
     def buffer(self):
         """
@@ -439,3 +962,137 @@ class ImageMetadata(MutableMapping):
                             fdel=_del_iptc_charset,
                             doc='An optional character set the IPTC data is encoded in.')
 
+
+
+class MetadataSnapshot(Mapping):
+
+    """
+    A read-only view of the metadata of an image at a given moment, as
+    returned by :meth:`ImageMetadata.snapshot`.
+
+    The tags it returns are copies: modifying them doesn't affect the
+    snapshot.
+    """
+
+    def __init__(self, _snapshot):
+        self._snapshot = _snapshot
+
+    @property
+    def exif_keys(self):
+        """Keys of the EXIF tags in the snapshot."""
+        return self._snapshot._exifKeys()
+
+    @property
+    def iptc_keys(self):
+        """Keys of the IPTC tags in the snapshot."""
+        return self._snapshot._iptcKeys()
+
+    @property
+    def xmp_keys(self):
+        """Keys of the XMP tags in the snapshot."""
+        return self._snapshot._xmpKeys()
+
+    @property
+    def comment(self):
+        """The image comment."""
+        return self._snapshot._getComment()
+
+    def __getitem__(self, key):
+        """
+        Get a copy of a metadata tag for a given key.
+
+        :param key: metadata key in the dotted form
+                    ``familyName.groupName.tagName`` where ``familyName`` may
+                    be one of ``exif``, ``iptc`` or ``xmp``.
+        :type key: string
+
+        :raise KeyError: if the tag doesn't exist
+        """
+        family = key.split('.')[0].lower()
+        if family == 'exif':
+            return ExifTag._from_existing_tag(self._snapshot._getExifTag(key))
+        elif family == 'iptc':
+            return IptcTag._from_existing_tag(self._snapshot._getIptcTag(key))
+        elif family == 'xmp':
+            return XmpTag._from_existing_tag(self._snapshot._getXmpTag(key))
+        else:
+            raise KeyError(key)
+
+    def __iter__(self):
+        return chain(self.exif_keys, self.iptc_keys, self.xmp_keys)
+
+    def __len__(self):
+        return len(self.exif_keys) + len(self.iptc_keys) + len(self.xmp_keys)
+
+
+class MetadataTemplate(object):
+
+    """
+    A set of tags to be stamped onto many images (e.g. copyright and creator
+    information).
+
+    The keys are resolved and the values converted once and for all when the
+    template is created.
+    """
+
+    def __init__(self, tags):
+        """
+        :param tags: a mapping (or a sequence of (key, tag or value) pairs) of
+                     the tags of the template, with the same semantics as
+                     :meth:`ImageMetadata.__setitem__`
+        :type tags: dict
+
+        :raise KeyError: if one of the keys is invalid
+        :raise ValueError: if one of the values is invalid
+        """
+        raw_values, self._families = _to_raw_values(tags)
+        self._template = libexiv2python._MetadataTemplate(raw_values)
+
+    def apply(self, metadata):
+        """
+        Set all the tags of the template on an image.
+        The changes are not written back to the image until
+        :meth:`ImageMetadata.write` is called.
+
+        :param metadata: the metadata to modify (it must have been
+                         :meth:`ImageMetadata.read` beforehand)
+        :type metadata: :class:`ImageMetadata`
+        """
+        metadata._image._applyTemplate(self._template)
+        metadata._flush_cache(*self._families)
+
+    def apply_to_files(self, filenames, workers=1):
+        """
+        Set all the tags of the template on a batch of image files and write
+        them back.
+        Each worker thread processes its share of the files in a single call
+        to libexiv2, without holding the GIL.
+        A file that cannot be processed doesn't stop the others.
+
+        :param filenames: paths to image files
+        :type filenames: list of strings
+        :param workers: the number of worker threads
+        :type workers: int
+
+        :raise IOError, ValueError, ...: once all the files are processed, the
+            error of the first file that failed, naming it. Its ``errors``
+            attribute lists the (filename, error) pairs of all the files that
+            failed.
+        """
+        encoding = sys.getfilesystemencoding()
+        filenames = [isinstance(filename, unicode) and \
+                     filename.encode(encoding) or filename \
+                     for filename in filenames]
+        workers = max(1, min(workers, len(filenames)))
+        batches = [filenames[i::workers] for i in xrange(workers)]
+        results = map_in_threads(self._template._applyToFiles, batches,
+                                 workers)
+        outcomes = [None] * len(filenames)
+        for i, result in enumerate(results):
+            outcomes[i::workers] = result
+        errors = [(filename, error) for filename, error \
+                  in zip(filenames, outcomes) if error is not None]
+        if errors:
+            error = errors[0][1]
+            error.errors = errors
+            raise error
@@ -0,0 +1,172 @@
+# -*- coding: utf-8 -*-
+
+# ******************************************************************************
+#
+# Copyright (C) 2012 Olivier Tilloy <olivier@tilloy.net>
+#
+# This file is part of the pyexiv2 distribution.
+#
+# pyexiv2 is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# pyexiv2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with pyexiv2; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, 5th Floor, Boston, MA 02110-1301 USA.
+#
+# Author: Olivier Tilloy <olivier@tilloy.net>
+#
+# ******************************************************************************
+
+"""
+Removal of sensitive metadata (location, personal data) from images.
+"""
+
+import libexiv2python
+
+from pyexiv2.metadata import ImageMetadata
+from pyexiv2.utils import map_in_threads
+
+
+#: Key patterns matching the location and personal data most commonly found
+#: in images: GPS coordinates, serial numbers, owner names and the location
+#: fields of IPTC and XMP metadata.
+PERSONAL_DATA_PATTERNS = ('Exif.GPSInfo.*',
+                          'Exif.*.*SerialNumber',
+                          'Exif.*.*OwnerName',
+                          'Iptc.Application2.City',
+                          'Iptc.Application2.SubLocation',
+                          'Iptc.Application2.ProvinceState',
+                          'Iptc.Application2.CountryCode',
+                          'Iptc.Application2.CountryName',
+                          'Xmp.exif.GPS*',
+                          'Xmp.aux.SerialNumber',
+                          'Xmp.aux.OwnerName',
+                          'Xmp.photoshop.City',
+                          'Xmp.photoshop.State',
+                          'Xmp.photoshop.Country',
+                          'Xmp.iptc.Location',
+                          'Xmp.iptc.CountryCode',
+                          'Xmp.iptcExt.Location*')
+
+
+class RedactionPolicy(object):
+
+    """
+    A set of rules describing which metadata tags to remove from images.
+
+    A policy is compiled once and can then be applied to any number of images.
+    """
+
+    def __init__(self, patterns=PERSONAL_DATA_PATTERNS, namespaces=(),
+                 in_place=False):
+        """
+        :param patterns: the keys of the tags to remove, in which ``*``
+                         matches any sequence of characters and ``?`` matches
+                         any single character (e.g. ``Exif.GPSInfo.*``)
+        :type patterns: list of strings
+        :param namespaces: names of XMP namespaces (e.g.
+                           ``http://ns.adobe.com/photoshop/1.0/``) all the tags
+                           of which are to be removed
+        :type namespaces: list of strings
+        :param in_place: if True, matching EXIF tags are not removed but their
+                         value is overwritten with zeroes, which allows TIFF
+                         based images to be patched in place instead of being
+                         rewritten
+        :type in_place: boolean
+
+        :raise KeyError: if one of the namespaces is not registered
+
+        Namespaces are resolved to their prefix each time the policy is
+        applied.
+        """
+        self.patterns = list(patterns)
+        self.namespaces = list(namespaces)
+        self.in_place = in_place
+        self._policy = libexiv2python._RedactionPolicy(self.patterns,
+                                                       self.namespaces,
+                                                       in_place)
+
+    def apply(self, metadata):
+        """
+        Redact the metadata of an image.
+        The changes are not written back to the image until
+        :meth:`pyexiv2.metadata.ImageMetadata.write` is called.
+
+        :param metadata: the metadata to redact (it must have been
+                         :meth:`pyexiv2.metadata.ImageMetadata.read`
+                         beforehand)
+        :type metadata: :class:`pyexiv2.metadata.ImageMetadata`
+
+        :return: the keys of the tags removed
+        :rtype: list of strings
+
+        :raise KeyError: if one of the namespaces was unregistered since the
+                         policy was created
+        """
+        keys = metadata._image._redact(self._policy)
+        if keys:
+            metadata._flush_cache('exif', 'iptc', 'xmp')
+        return keys
+
+
+def redact_buffer(policy, buffer):
+    """
+    Redact the metadata of an image buffer.
+
+    :param policy: the redaction policy to apply
+    :type policy: :class:`RedactionPolicy`
+    :param buffer: a buffer containing image data
+    :type buffer: string
+
+    :return: the redacted image buffer and the keys of the tags removed
+    :rtype: tuple (string, list of strings)
+    """
+    metadata = ImageMetadata.from_buffer(buffer)
+    metadata.read()
+    keys = policy.apply(metadata)
+    if not keys:
+        return (buffer, keys)
+    metadata.write()
+    return (metadata.buffer, keys)
+
+
+def redact_files(policy, filenames, workers=4, preserve_timestamps=False):
+    """
+    Redact the metadata of a batch of image files, using a pool of worker
+    threads. Files from which no tag was removed are not rewritten.
+    A file that cannot be read or written doesn't stop the others: the
+    exception it raised is returned in place of its keys.
+
+    :param policy: the redaction policy to apply
+    :type policy: :class:`RedactionPolicy`
+    :param filenames: paths to image files
+    :type filenames: list of strings
+    :param workers: the number of worker threads
+    :type workers: int
+    :param preserve_timestamps: whether to preserve the files' original
+                                timestamps
+    :type preserve_timestamps: boolean
+
+    :return: a dictionary mapping each path to the keys of the tags removed
+             (or to the exception raised)
+    :rtype: dict
+    """
+    def redact(filename):
+        try:
+            metadata = ImageMetadata(filename)
+            metadata.read()
+            keys = policy.apply(metadata)
+            if keys:
+                metadata.write(preserve_timestamps)
+        except Exception, error:
+            return (filename, error)
+        return (filename, keys)
+
+    return dict(map_in_threads(redact, filenames, workers))
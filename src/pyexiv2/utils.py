@@ -735,3 +735,35 @@ class DateTimeFormatter(object):
             raise TypeError('expecting an object of type '
                             'datetime.datetime or datetime.date')
 
+
+
+def map_in_threads(function, iterable, workers=4):
+    """
+    Apply a function to every item of an iterable using a pool of threads and
+    return the list of the results, in order.
+
+    libexiv2python releases the GIL while reading and writing metadata, so
+    batch operations on many files do run in parallel.
+
+    :param function: the function to apply, taking one item as parameter
+    :type function: callable
+    :param iterable: the items to process
+    :type iterable: iterable
+    :param workers: the number of threads in the pool
+    :type workers: int
+
+    :return: the results of the function applied to every item
+    :rtype: list
+    """
+    # Imported here as the multiprocessing module is not always available
+    # (e.g. on some embedded platforms).
+    from multiprocessing.pool import ThreadPool
+    items = list(iterable)
+    if workers <= 1 or len(items) <= 1:
+        return map(function, items)
+    pool = ThreadPool(min(workers, len(items)))
+    try:
+        return pool.map(function, items)
+    finally:
+        pool.close()
+        pool.join()
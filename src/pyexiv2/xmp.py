@@ -211,20 +211,45 @@ class XmpTag(object):
         return self._value
 
     def _set_value(self, value):
-        type = self._tag._getExiv2Type()
-        if type == 'XmpText':
-            stype = self.type
+        raw_value = XmpTag._value_to_raw(value, self.type,
+                                         self._tag._getExiv2Type())
+        if raw_value is not None:
+            self.raw_value = raw_value
+        self._value = value
+        self._value_cookie = False
+
+    @staticmethod
+    def _value_to_raw(value, type, exiv2_type):
+        """
+        Convert a value to the raw value of a tag of given types, without the
+        tag.
+
+        :param value: the value to be converted
+        :param type: the XMP type of the tag
+        :type type: string
+        :param exiv2_type: the type of the value in libexiv2 (one of XmpText,
+                           XmpAlt, XmpBag, XmpSeq, LangAlt)
+        :type exiv2_type: string
+
+        :return: the raw value: a string, a list of strings or a dictionary
+                 mapping language codes to strings (None for other types of
+                 values in libexiv2)
+
+        :raise XmpValueError: if the conversion fails
+        """
+        if exiv2_type == 'XmpText':
+            stype = type
             if stype.lower().startswith('closed choice of'):
                 stype = stype[17:]
-            self.raw_value = self._convert_to_string(value, stype)
-        elif type in ('XmpAlt', 'XmpBag', 'XmpSeq'):
+            return XmpTag._convert_to_string(value, stype)
+        elif exiv2_type in ('XmpAlt', 'XmpBag', 'XmpSeq'):
             if not isinstance(value, (list, tuple)):
                 raise TypeError('Expecting a list of values')
-            stype = self.type[4:]
+            stype = type[4:]
             if stype.lower().startswith('closed choice of'):
                 stype = stype[17:]
-            self.raw_value = map(lambda x: self._convert_to_string(x, stype), value)
-        elif type == 'LangAlt':
+            return map(lambda x: XmpTag._convert_to_string(x, stype), value)
+        elif exiv2_type == 'LangAlt':
             if isinstance(value, basestring):
                 value = {'x-default': value}
             if not isinstance(value, dict):
@@ -234,16 +259,60 @@ class XmpTag(object):
                 try:
                     raw_value[k.encode('utf-8')] = v.encode('utf-8')
                 except TypeError:
-                    raise XmpValueError(value, type)
-            self.raw_value = raw_value
-
-        self._value = value
-        self._value_cookie = False
+                    raise XmpValueError(value, exiv2_type)
+            return raw_value
 
     value = property(fget=_get_value, fset=_set_value,
                      doc='The value of the tag as a [list of] python ' \
                          'object(s).')
 
+    def get_lang_alt_item(self, lang, fallback='x-default'):
+        """
+        Return the value of a Lang Alt tag for one language, without
+        converting the values for all the other languages.
+
+        :param lang: the language code
+        :type lang: string
+        :param fallback: the language code to fall back to if there is no
+                         value for lang, or None
+        :type fallback: string
+
+        :return: the value for lang, or for the fallback language
+        :rtype: unicode
+
+        :raise KeyError: if neither language has a value
+        :raise TypeError: if the tag is not a Lang Alt tag
+        """
+        if self._tag._getExiv2Type() != 'LangAlt':
+            raise TypeError('Not a Lang Alt tag')
+        if fallback is None:
+            fallback = ''
+        value = self._tag._getLangAltItem(lang.encode('utf-8'),
+                                          fallback.encode('utf-8'))
+        return unicode(value, 'utf-8')
+
+    def set_lang_alt_item(self, lang, value):
+        """
+        Set the value of a Lang Alt tag for one language, leaving the values
+        for the other languages untouched.
+
+        :param lang: the language code
+        :type lang: string
+        :param value: the value for lang
+        :type value: string
+
+        :raise TypeError: if the tag is not a Lang Alt tag
+        """
+        if self._tag._getExiv2Type() != 'LangAlt':
+            raise TypeError('Not a Lang Alt tag')
+        lang = lang.encode('utf-8')
+        value = value.encode('utf-8')
+        self._tag._setLangAltItem(lang, value)
+        if self._raw_value is None:
+            self._raw_value = {}
+        self._raw_value[lang] = value
+        self._value_cookie = True
+
     def _convert_to_python(self, value, type):
         """
         Convert a raw value to its corresponding python type.
@@ -373,7 +442,8 @@ class XmpTag(object):
 
         raise NotImplementedError('XMP conversion for type [%s]' % type)
 
-    def _convert_to_string(self, value, type):
+    @staticmethod
+    def _convert_to_string(value, type):
         """
         Convert a value to its corresponding string representation, suitable to
         pass to libexiv2.
@@ -490,6 +560,7 @@ def register_namespace(name, prefix):
     if not name.endswith('/'):
         raise ValueError('Name should end with a /')
     libexiv2python._registerXmpNs(name, prefix)
+    _flush_known_tags()
 
 
 def unregister_namespace(name):
@@ -511,6 +582,7 @@ def unregister_namespace(name):
     if not name.endswith('/'):
         raise ValueError('Name should end with a /')
     libexiv2python._unregisterXmpNs(name)
+    _flush_known_tags()
 
 
 def unregister_namespaces():
@@ -522,4 +594,13 @@ def unregister_namespaces():
     This function always succeeds.
     """
     libexiv2python._unregisterAllXmpNs()
+    _flush_known_tags()
+
+
+def _flush_known_tags():
+    # The known XMP tags cached by pyexiv2.metadata.known_tags() depend on the
+    # registered namespaces. pyexiv2.metadata imports this module, hence the
+    # deferred import.
+    from pyexiv2.metadata import _flush_known_xmp_tags
+    _flush_known_xmp_tags()
 
@@ -42,6 +42,9 @@ from utils import TestConversions, TestFractions
 from usercomment import TestUserCommentReadWrite, TestUserCommentAdd
 from pickling import TestPicklingTags
 from datetimeformatter import TestDateTimeFormatter
+from redaction import TestRedaction
+from batch import TestBatchEditor
+from concurrency import TestConcurrentAccess
 
 
 def run_unit_tests():
@@ -64,6 +67,9 @@ def run_unit_tests():
     suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestUserCommentAdd))
     suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestPicklingTags))
     suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestDateTimeFormatter))
+    suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestRedaction))
+    suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestBatchEditor))
+    suite.addTest(unittest.defaultTestLoader.loadTestsFromTestCase(TestConcurrentAccess))
     # Run the test suite
     return unittest.TextTestRunner(verbosity=2).run(suite)
 
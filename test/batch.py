@@ -0,0 +1,178 @@
+# -*- coding: utf-8 -*-
+
+# ******************************************************************************
+#
+# Copyright (C) 2012 Olivier Tilloy <olivier@tilloy.net>
+#
+# This file is part of the pyexiv2 distribution.
+#
+# pyexiv2 is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# pyexiv2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with pyexiv2; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, 5th Floor, Boston, MA 02110-1301 USA.
+#
+# Author: Olivier Tilloy <olivier@tilloy.net>
+#
+# ******************************************************************************
+
+from pyexiv2.batch import BatchEditor
+from pyexiv2.metadata import ImageMetadata, sidecar_filename
+
+import os
+import shutil
+import tempfile
+import unittest
+from testutils import EMPTY_JPG_DATA
+
+
+class TestBatchEditor(unittest.TestCase):
+
+    def setUp(self):
+        self.pathnames = []
+        for i in xrange(3):
+            fd, pathname = tempfile.mkstemp(suffix='.jpg')
+            os.write(fd, EMPTY_JPG_DATA)
+            os.close(fd)
+            self.pathnames.append(pathname)
+        fd, self.journal = tempfile.mkstemp(suffix='.journal')
+        os.close(fd)
+        os.remove(self.journal)
+
+    def tearDown(self):
+        for pathname in self.pathnames:
+            os.remove(pathname)
+        if os.path.exists(self.journal):
+            os.remove(self.journal)
+
+    def _editor(self):
+        return BatchEditor(self.journal, {'Exif.Image.Make': 'Canon',
+                                          'Xmp.dc.subject': ['a', 'b']})
+
+    def test_run(self):
+        editor = self._editor()
+        self.assertEqual(editor.run(self.pathnames), (3, 0, 0))
+        for pathname in self.pathnames:
+            metadata = ImageMetadata(pathname)
+            metadata.read()
+            self.assertEqual(metadata['Exif.Image.Make'].value, 'Canon')
+            self.assertEqual(metadata['Xmp.dc.subject'].value, ['a', 'b'])
+        self.assertEqual(sorted(editor.completed().keys()),
+                         sorted(self.pathnames))
+
+    def test_resume(self):
+        editor = self._editor()
+        self.assertEqual(editor.run(self.pathnames[:1]), (1, 0, 0))
+        # Simulate a run interrupted after the intent to edit the second file
+        # was recorded, while the third one was being recorded.
+        fd = open(self.journal, 'ab')
+        fd.write('begin\t-\t%s\n' % self.pathnames[1])
+        fd.write('begin\t-\t%s' % self.pathnames[2][:5])
+        fd.close()
+        self.assertEqual(editor.run(self.pathnames), (2, 1, 0))
+        # The truncated entry was dropped instead of being glued to the next
+        # one.
+        for line in open(self.journal, 'rb'):
+            state, digest, path = line[:-1].split('\t', 2)
+            if state == 'edits':
+                self.assertEqual(digest, editor.digest)
+            else:
+                self.assert_(path in self.pathnames)
+        # Everything is done
+        self.assertEqual(editor.run(self.pathnames), (0, 3, 0))
+
+    def test_resume_modified_file(self):
+        editor = self._editor()
+        editor.run(self.pathnames)
+        # A file modified since it was edited is checked again
+        metadata = ImageMetadata(self.pathnames[0])
+        metadata.read()
+        metadata['Exif.Image.Make'] = 'Nikon'
+        metadata.write()
+        self.assertEqual(editor.run(self.pathnames), (1, 2, 0))
+
+    def test_already_up_to_date(self):
+        metadata = ImageMetadata(self.pathnames[0])
+        metadata.read()
+        metadata['Exif.Image.Make'] = 'Canon'
+        metadata['Xmp.dc.subject'] = ['a', 'b']
+        metadata.write()
+        self.assertEqual(self._editor().run(self.pathnames), (2, 1, 0))
+
+    def test_resume_other_edits(self):
+        editor = self._editor()
+        editor.run(self.pathnames)
+        # The same edits, given in another form, are recognized
+        same = BatchEditor(self.journal, [('Xmp.dc.subject', ['a', 'b']),
+                                          ('Exif.Image.Make', u'Canon')])
+        self.assertEqual(same.digest, editor.digest)
+        self.assertEqual(len(same.completed()), 3)
+        # Files completed for other edits are edited again
+        other = BatchEditor(self.journal, {'Exif.Image.Make': 'Nikon'})
+        self.assertNotEqual(other.digest, editor.digest)
+        self.assertEqual(other.completed(), {})
+        self.assertEqual(other.run(self.pathnames), (3, 0, 0))
+        # And the files completed before the other edits are no longer
+        self.assertEqual(editor.completed(), {})
+        self.assertEqual(editor.run(self.pathnames), (3, 0, 0))
+
+    def test_failure(self):
+        pathnames = self.pathnames + ['/nonexistent/image.jpg']
+        editor = self._editor()
+        self.assertEqual(editor.run(pathnames), (3, 0, 1))
+        self.assertEqual(editor.errors.keys(), ['/nonexistent/image.jpg'])
+        self.assert_(isinstance(editor.errors['/nonexistent/image.jpg'],
+                                IOError))
+
+    def test_failure_any_exception(self):
+        editor = self._editor()
+        edit = editor._edit
+        def failing_edit(filename):
+            if filename == self.pathnames[1]:
+                raise RuntimeError('unexpected')
+            return edit(filename)
+        editor._edit = failing_edit
+        self.assertEqual(editor.run(self.pathnames), (2, 0, 1))
+        self.assertEqual(editor.errors.keys(), [self.pathnames[1]])
+        self.assert_(isinstance(editor.errors[self.pathnames[1]],
+                                RuntimeError))
+        self.assertEqual(sorted(editor.completed().keys()),
+                         sorted([self.pathnames[0], self.pathnames[2]]))
+
+    def test_run_directory_sidecars(self):
+        directory = tempfile.mkdtemp()
+        try:
+            os.mkdir(os.path.join(directory, 'sub'))
+            pathnames = [os.path.join(directory, 'a.jpg'),
+                         os.path.join(directory, 'b.JPG'),
+                         os.path.join(directory, 'sub', 'c.jpg')]
+            for pathname in pathnames:
+                fd = open(pathname, 'wb')
+                fd.write(EMPTY_JPG_DATA)
+                fd.close()
+            editor = BatchEditor(self.journal, {'Xmp.dc.subject': ['a', 'b']},
+                                 sidecar='only')
+            self.assertEqual(editor.run_directory(directory, ['.jpg']),
+                             (2, 0, 0))
+            for pathname in pathnames[:2]:
+                fd = open(pathname, 'rb')
+                self.assertEqual(fd.read(), EMPTY_JPG_DATA)
+                fd.close()
+                metadata = ImageMetadata(pathname, sidecar='only')
+                metadata.read()
+                self.assertEqual(metadata['Xmp.dc.subject'].value, ['a', 'b'])
+            self.failIf(os.path.exists(sidecar_filename(pathnames[2])))
+            # The sidecars are not image files
+            self.assertEqual(editor.run_directory(directory, recursive=True),
+                             (1, 2, 0))
+            self.assert_(os.path.exists(sidecar_filename(pathnames[2])))
+        finally:
+            shutil.rmtree(directory)
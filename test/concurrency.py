@@ -0,0 +1,213 @@
+# -*- coding: utf-8 -*-
+
+# ******************************************************************************
+#
+# Copyright (C) 2012 Olivier Tilloy <olivier@tilloy.net>
+#
+# This file is part of the pyexiv2 distribution.
+#
+# pyexiv2 is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# pyexiv2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with pyexiv2; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, 5th Floor, Boston, MA 02110-1301 USA.
+#
+# Author: Olivier Tilloy <olivier@tilloy.net>
+#
+# ******************************************************************************
+
+from pyexiv2.metadata import ImageMetadata, human_dump_files
+from pyexiv2.xmp import unregister_namespaces
+
+import os
+import tempfile
+import threading
+import time
+import unittest
+from testutils import EMPTY_JPG_DATA
+
+
+class TestConcurrentAccess(unittest.TestCase):
+
+    THREADS = 8
+    ITERATIONS = 100
+
+    def setUp(self):
+        # Create an empty image file
+        fd, self.pathname = tempfile.mkstemp(suffix='.jpg')
+        os.write(fd, EMPTY_JPG_DATA)
+        os.close(fd)
+        # Write some metadata
+        m = ImageMetadata(self.pathname)
+        m.read()
+        m['Exif.Image.Make'] = 'EASTMAN KODAK COMPANY'
+        m['Iptc.Application2.Caption'] = ['blabla']
+        m['Xmp.dc.subject'] = ['image', 'test', 'pyexiv2']
+        m.comment = 'Hello World!'
+        m.write()
+        self.metadata = ImageMetadata(self.pathname)
+        self.metadata.read()
+        self.errors = []
+
+    def tearDown(self):
+        os.remove(self.pathname)
+
+    def _run(self, *targets):
+        def run(target):
+            try:
+                for i in xrange(self.ITERATIONS):
+                    target(i)
+            except Exception, error:
+                self.errors.append(error)
+        threads = [threading.Thread(target=run, args=(target,))
+                   for target in targets]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(self.errors, [])
+
+    def _read(self, i):
+        # Only use methods that share the lock: tags bound to the image are
+        # not protected, read them from a snapshot.
+        image = self.metadata._image
+        image._exifKeys()
+        image._iptcKeys()
+        image._xmpKeys()
+        image._getPixelWidth()
+        self.assertEqual(image._getComment(), 'Hello World!')
+        self.assertEqual(image._getMimeType(), 'image/jpeg')
+        snapshot = image._snapshot()
+        for key in snapshot._exifKeys():
+            snapshot._getExifTag(key)._getRawValue()
+
+    def test_parallel_readers(self):
+        self._run(*([self._read] * self.THREADS))
+
+    def _look_up(self, i):
+        # Tag lookups share the lock of the image.
+        image = self.metadata._image
+        for j in xrange(10):
+            image._getExifTag('Exif.Image.Make')._getRawValue()
+            image._getIptcTag('Iptc.Application2.Caption')._getRawValues()
+            image._getXmpTag('Xmp.dc.subject')._getArrayValue()
+
+    def _throughput(self, threads):
+        # The number of tags looked up per second by all the threads.
+        start = time.time()
+        self._run(*([self._look_up] * threads))
+        elapsed = max(time.time() - start, 1e-6)
+        return threads * self.ITERATIONS * 30 / elapsed
+
+    def test_parallel_readers_throughput(self):
+        # Readers looking tags up don't serialize on the lock of the image:
+        # their overall throughput doesn't collapse as they are added.
+        self._throughput(1)
+        single = self._throughput(1)
+        parallel = self._throughput(self.THREADS)
+        self.assert_(parallel >= single / 2,
+                     '%d lookups/s with %d threads, %d with one' %
+                     (parallel, self.THREADS, single))
+
+    def _dump_throughput(self, workers):
+        # The number of files dumped per second by a batch of workers.
+        filenames = [self.pathname] * (self.ITERATIONS * 4)
+        start = time.time()
+        dumps = human_dump_files(filenames, workers=workers)
+        elapsed = max(time.time() - start, 1e-6)
+        self.assertEqual(len(set(dumps)), 1)
+        return len(filenames) / elapsed
+
+    def test_parallel_dumps_throughput(self):
+        # Workers build their dumps in a scratch buffer of their own that
+        # keeps its capacity, rather than contending on the allocator for
+        # every file: their overall throughput doesn't collapse as they are
+        # added.
+        self._dump_throughput(1)
+        single = self._dump_throughput(1)
+        parallel = self._dump_throughput(self.THREADS)
+        self.assert_(parallel >= single / 2,
+                     '%d files/s with %d workers, %d with one' %
+                     (parallel, self.THREADS, single))
+
+    def test_readers_and_writer(self):
+        image = self.metadata._image
+        def write(i):
+            self.metadata['Exif.Image.Make'] = 'Make %d' % i
+            self.metadata['Xmp.dc.subject'] = ['image', str(i)]
+            image._writeMetadata()
+            image._getDataBuffer()
+            image._readMetadata()
+        self._run(write, *([self._read] * (self.THREADS - 1)))
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        self.assertEqual(metadata['Exif.Image.Make'].value,
+                         'Make %d' % (self.ITERATIONS - 1))
+
+    def test_parse_unknown_namespaces(self):
+        # Parsing packets that declare unknown namespaces registers them.
+        packet = '<x:xmpmeta xmlns:x="adobe:ns:meta/">' \
+                 '<rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">' \
+                 '<rdf:Description rdf:about="" ' \
+                 'xmlns:ns%(i)d="http://example.org/ns%(i)d/" ' \
+                 'ns%(i)d:Label="label %(i)d"/>' \
+                 '</rdf:RDF></x:xmpmeta>'
+        def parse(i):
+            other = ImageMetadata.from_buffer(EMPTY_JPG_DATA)
+            other.read()
+            other.set_xmp_packet(packet % {'i': i}, check=True)
+            self.assertEqual(other['Xmp.ns%d.Label' % i].value, 'label %d' % i)
+        try:
+            self._run(*([parse] * self.THREADS))
+        finally:
+            unregister_namespaces()
+
+    def test_parse_known_and_unknown_namespaces(self):
+        # Packets that only declare registered namespaces are parsed while
+        # others register new ones.
+        packet = '<x:xmpmeta xmlns:x="adobe:ns:meta/">' \
+                 '<rdf:RDF xmlns:rdf="http://www.w3.org/1999/02/22-rdf-syntax-ns#">' \
+                 '<rdf:Description rdf:about="" ' \
+                 'xmlns:%(prefix)s="%(ns)s" %(prefix)s:%(name)s="%(value)s"/>' \
+                 '</rdf:RDF></x:xmpmeta>'
+        def parse(i):
+            if i % 2 == 0:
+                values = {'prefix': 'pdf',
+                          'ns': 'http://ns.adobe.com/pdf/1.3/',
+                          'name': 'Keywords', 'value': 'keywords %d' % i}
+            else:
+                values = {'prefix': 'ns%d' % i,
+                          'ns': 'http://example.org/ns%d/' % i,
+                          'name': 'Label', 'value': 'label %d' % i}
+            other = ImageMetadata.from_buffer(EMPTY_JPG_DATA)
+            other.read()
+            other.set_xmp_packet(packet % values, check=(i % 4 < 2))
+            key = 'Xmp.%(prefix)s.%(name)s' % values
+            self.assertEqual(other[key].value, values['value'])
+            snapshot = self.metadata._image._snapshot()
+            self.assertEqual(snapshot._getXmpTag('Xmp.dc.subject')._getArrayValue(),
+                             ['image', 'test', 'pyexiv2'])
+        try:
+            self._run(*([parse] * self.THREADS))
+        finally:
+            unregister_namespaces()
+
+    def test_copies(self):
+        others = [ImageMetadata.from_buffer(EMPTY_JPG_DATA)
+                  for i in xrange(self.THREADS)]
+        for other in others:
+            other.read()
+        def copy(i):
+            other = others[i % len(others)]
+            self.metadata.copy(other)
+            other.copy(self.metadata, comment=False)
+        self._run(*([copy] * self.THREADS))
+
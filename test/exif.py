@@ -26,7 +26,7 @@
 
 import unittest
 
-from pyexiv2.exif import ExifTag, ExifValueError
+from pyexiv2.exif import ExifTag, ExifValueError, ExifArray
 from pyexiv2.metadata import ImageMetadata
 from pyexiv2.utils import make_fraction
 
@@ -34,6 +34,7 @@ import testutils
 
 import datetime
 import os.path
+import struct
 
 
 class TestExifTag(unittest.TestCase):
@@ -327,6 +328,34 @@ class TestExifTag(unittest.TestCase):
         # Invalid values
         self.failUnlessRaises(ExifValueError, tag._convert_to_string, 3)
 
+    def test_raw_bytes(self):
+        tag = ExifTag('Exif.Photo.MakerNote', '\x00\x01\xff' * 20000)
+        self.assertEqual(tag.type, 'Undefined')
+        self.assertEqual(tag.raw_bytes, '\x00\x01\xff' * 20000)
+        self.assertEqual(tag.raw_value[:12], '0 1 255 0 1 ')
+        tag.raw_bytes = bytearray('0100')
+        self.assertEqual(tag.value, '0100')
+        self.assertEqual(tag.raw_value, '48 49 48 48')
+        tag.raw_bytes = memoryview('0221')
+        self.assertEqual(tag.value, '0221')
+        tag.raw_value = '48 50 50 48'
+        self.assertEqual(tag.raw_bytes, '0220')
+        self.assertEqual(tag.value, '0220')
+        tag = ExifTag('Exif.Image.Orientation', 1)
+        self.failUnlessRaises(ValueError, getattr, tag, 'raw_bytes')
+
+    def test_str_undefined(self):
+        # Undefined values are suppressed when their raw value is longer than
+        # 100 characters.
+        tag = ExifTag('Exif.Photo.MakerNote')
+        tag.raw_bytes = '\x00' * 30
+        self.assertEqual(str(tag), '<Exif.Photo.MakerNote [Undefined] = %s>' %
+                         ' '.join(['0'] * 30))
+        tag.raw_bytes = '\xff' * 30
+        self.assertEqual(str(tag), '<Exif.Photo.MakerNote [Undefined] = '
+                         '(Binary value suppressed)>')
+        self.failUnlessRaises(ValueError, setattr, tag, 'raw_bytes', '\x01')
+
     def test_set_value(self):
         tag = ExifTag('Exif.Thumbnail.Orientation', 1) # top, left
         old_value = tag.value
@@ -363,3 +392,85 @@ class TestExifTag(unittest.TestCase):
         self.assertEqual(tag2.type, 'Long')
         self.assertEqual(tag2.value, [76830L, 20070527L, 2L, 1L, 4228109L])
 
+    def test_array_values(self):
+        tag = ExifTag('Exif.Image.BitsPerSample', [8, 8, 8])
+        values = tag.value
+        self.assert_(isinstance(values, ExifArray))
+        self.assertEqual(values, [8, 8, 8])
+        values[1] = 16
+        self.assertEqual(tag.raw_value, '8 16 8')
+        values[1:] = [4, 4, 4]
+        values.append(2)
+        self.assertEqual(tag.raw_value, '8 4 4 4 2')
+        del values[:2]
+        self.assertEqual(tag.value, [4, 4, 2])
+        self.assertEqual(values[::2], [4, 2])
+        self.failUnlessRaises(ExifValueError, values.__setitem__, 0, -1)
+        self.failUnlessRaises(ExifValueError, values.__setitem__, 0, 1 << 16)
+        self.failUnlessRaises(ExifValueError, values.__setitem__, 0, '4')
+        self.failUnlessRaises(IndexError, values.__getitem__, 3)
+        self.assertEqual(tag.raw_value, '4 4 2')
+
+        # Setting another value detaches the array from the tag.
+        tag.value = [1, 2]
+        values[0] = 5
+        self.assertEqual(tag.raw_value, '1 2')
+        self.assertEqual(values, [5, 4, 2])
+
+        tag = ExifTag('Exif.GPSInfo.GPSLatitude',
+                      [make_fraction(1, 2), make_fraction(3, 1)])
+        tag.value[0] = make_fraction(5, 4)
+        self.assertEqual(tag.raw_value, '5/4 3/1')
+        self.assertEqual(tag.value, [make_fraction(5, 4), make_fraction(3, 1)])
+        self.failUnlessRaises(ExifValueError, tag.value.__setitem__, 1,
+                              make_fraction(-1, 2))
+
+    def test_array_buffer_in_image(self):
+        filepath = testutils.get_absolute_file_path(os.path.join('data', 'pentax-makernote.jpg'))
+        metadata = ImageMetadata(filepath)
+        metadata.read()
+        key = 'Exif.Pentax.PreviewResolution'
+        values = list(metadata[key].value)
+        view = metadata[key].value.buffer
+        # The metadata of the image the buffer points into cannot be
+        # restructured while it is exported.
+        self.failUnlessRaises(BufferError, metadata.__delitem__, key)
+        self.failUnlessRaises(BufferError, metadata.read)
+        self.failUnlessRaises(BufferError, metadata.clone)
+        self.assertEqual(list(struct.unpack('2H', view.tobytes())), values)
+        del view
+        del metadata[key]
+        self.failIf(key in metadata.exif_keys)
+
+    def test_array_values_in_image(self):
+        filepath = testutils.get_absolute_file_path(os.path.join('data', 'pentax-makernote.jpg'))
+        metadata = ImageMetadata(filepath)
+        metadata.read()
+        tag = metadata['Exif.Pentax.PreviewResolution']
+        tag.value[0] = 320
+        self.assertEqual(metadata['Exif.Pentax.PreviewResolution'].raw_value,
+                         '320 480')
+        self.assertEqual(metadata._image._getExifTag(tag.key)._getRawValue(),
+                         '320 480')
+
+    def test_array_buffer(self):
+        tag = ExifTag('Exif.Image.BitsPerSample', [8, 8, 8])
+        view = tag.value.buffer
+        self.assertEqual(view.format, 'H')
+        self.assertEqual(view.shape, (3,))
+        self.assertEqual(struct.unpack('3H', view.tobytes()), (8, 8, 8))
+        view[2] = struct.pack('H', 16)
+        self.assertEqual(tag.raw_value, '8 8 16')
+        # No resizing while the buffer is exported.
+        self.failUnlessRaises(BufferError, tag.value.append, 8)
+        self.failUnlessRaises(BufferError, setattr, tag, 'raw_value', '8')
+        del view
+        tag.value.append(8)
+        self.assertEqual(tag.raw_value, '8 8 16 8')
+
+        tag = ExifTag('Exif.GPSInfo.GPSLatitude',
+                      [make_fraction(1, 2), make_fraction(3, 1)])
+        view = tag.value.buffer
+        self.assertEqual(view.format, 'I')
+        self.assertEqual(view.shape, (2, 2))
+        self.assertEqual(struct.unpack('4I', view.tobytes()), (1, 2, 3, 1))
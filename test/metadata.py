@@ -24,15 +24,18 @@
 #
 # ******************************************************************************
 
-from pyexiv2.metadata import ImageMetadata
+from pyexiv2.metadata import ImageMetadata, MetadataTemplate, sidecar_filename, \
+                              human_dump_files, known_tags, _to_raw_values
 from pyexiv2.exif import ExifTag
 from pyexiv2.iptc import IptcTag
-from pyexiv2.xmp import XmpTag
+from pyexiv2.xmp import XmpTag, register_namespace, unregister_namespace
 from pyexiv2.utils import FixedOffset, make_fraction
 
 import datetime
+import gc
 import os
 import tempfile
+import threading
 import time
 import unittest
 from testutils import EMPTY_JPG_DATA
@@ -475,6 +478,47 @@ class TestImageMetadata(unittest.TestCase):
         self.assertEqual(self.metadata._tags['xmp'], {})
         self.failIf(key in self.metadata.xmp_keys)
 
+    def test_xmp_struct(self):
+        self.metadata.read()
+        contact = {'Iptc4xmpCore:CiAdrCity': u'Paris',
+                   'Iptc4xmpCore:CiEmailWork': u'olivier@tilloy.net'}
+        history = [{'stEvt:action': u'created',
+                    'stEvt:softwareAgent': u'pyexiv2'},
+                   {'stEvt:action': u'saved',
+                    'stEvt:changed': [u'/metadata']}]
+        self.metadata.set_xmp_struct('Xmp.iptc.CreatorContactInfo', contact)
+        self.metadata.set_xmp_struct('Xmp.xmpMM.History', history)
+        self.assertEqual(self.metadata._tags['xmp'], {})
+        self.assert_('Xmp.iptc.CreatorContactInfo/Iptc4xmpCore:CiAdrCity'
+                     in self.metadata.xmp_keys)
+        self.assert_('Xmp.xmpMM.History[2]/stEvt:action'
+                     in self.metadata.xmp_keys)
+        self.assertEqual(self.metadata.get_xmp_struct('Xmp.iptc.CreatorContactInfo'),
+                         contact)
+        self.assertEqual(self.metadata.get_xmp_struct('Xmp.xmpMM.History'),
+                         history)
+        self.assertEqual(self.metadata.get_xmp_struct('Xmp.xmpMM.History[1]'),
+                         history[0])
+        self.metadata.write()
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other.get_xmp_struct('Xmp.xmpMM.History'), history)
+
+    def test_xmp_struct_replace(self):
+        self.metadata.read()
+        key = 'Xmp.iptc.CreatorContactInfo'
+        self.metadata.set_xmp_struct(key, {'Iptc4xmpCore:CiAdrCity': 'Paris',
+                                           'Iptc4xmpCore:CiAdrPcode': 75001})
+        self.metadata.set_xmp_struct(key, {'Iptc4xmpCore:CiAdrCity': 'Lyon'})
+        self.assertEqual(self.metadata.get_xmp_struct(key),
+                         {'Iptc4xmpCore:CiAdrCity': u'Lyon'})
+        self.failIf(key + '/Iptc4xmpCore:CiAdrPcode' in self.metadata.xmp_keys)
+
+    def test_xmp_struct_inexistent(self):
+        self.metadata.read()
+        self.failUnlessRaises(KeyError, self.metadata.get_xmp_struct,
+                              'Xmp.iptc.CreatorContactInfo')
+
     ###########################
     # Test dictionary interface
     ###########################
@@ -571,6 +615,43 @@ class TestImageMetadata(unittest.TestCase):
         self.failUnlessRaises(KeyError, self.metadata.__setitem__, key, datetime.date.today())
         self.failUnlessRaises(KeyError, self.metadata.__delitem__, key)
 
+    def test_tags_survive_restructuring(self):
+        # Tags bound to the image remain valid when the metadata is
+        # restructured (tags erased, XMP data reallocated).
+        self.metadata.read()
+        exif = self.metadata['Exif.Image.Make']
+        iptc = self.metadata['Iptc.Application2.Caption']
+        xmp = self.metadata['Xmp.dc.subject']
+        del self.metadata['Exif.Image.DateTime']
+        del self.metadata['Iptc.Application2.DateCreated']
+        self.metadata.update({'Xmp.xmp.Label': 'foo',
+                              'Xmp.xmp.Nickname': 'bar',
+                              'Xmp.xmp.Rating': 3,
+                              'Xmp.dc.source': 'baz'})
+        self.metadata.set_xmp_packet(self.metadata.get_xmp_packet())
+        exif.value = 'Foo'
+        iptc.value = ['Bar']
+        xmp.value = ['a', 'b']
+        image = self.metadata._image
+        self.assertEqual(image._getExifTag('Exif.Image.Make')._getRawValue(),
+                         'Foo')
+        self.assertEqual(image._getIptcTag('Iptc.Application2.Caption')._getRawValues(),
+                         ['Bar'])
+        self.assertEqual(image._getXmpTag('Xmp.dc.subject')._getArrayValue(),
+                         ['a', 'b'])
+
+    def test_removed_tags(self):
+        # Using a tag removed from the image since raises an error instead of
+        # accessing freed memory.
+        self.metadata.read()
+        for key, value in (('Exif.Image.Make', 'Foo'),
+                           ('Xmp.dc.subject', ['a'])):
+            tag = self.metadata[key]
+            del self.metadata[key]
+            self.failUnlessRaises(KeyError, setattr, tag, 'value', value)
+            self.metadata[key] = tag
+            self.assert_(key in self.metadata)
+
     ##########################
     # Test the image comment #
     ##########################
@@ -675,6 +756,815 @@ class TestImageMetadata(unittest.TestCase):
         self.assertTrue('Iptc.Application2.Caption' not in self.clean)
         self.assertTrue('Xmp.dc.subject' not in self.clean)
 
+    #####################
+    # Test batch update #
+    #####################
+
+    def test_update(self):
+        self.metadata.read()
+        self.metadata.update({'Exif.Image.Make': 'Canon',
+                              'Exif.Photo.ExposureTime': make_fraction(1, 125),
+                              'Iptc.Application2.Keywords': ['foo', 'bar'],
+                              'Xmp.dc.title': u'A title',
+                              'Xmp.dc.subject': ['a', 'b']},
+                             ['Exif.Image.DateTime', 'Xmp.dc.format'])
+        self.assertEqual(self.metadata['Exif.Image.Make'].value, 'Canon')
+        self.assertEqual(self.metadata['Exif.Photo.ExposureTime'].value,
+                         make_fraction(1, 125))
+        self.assertEqual(self.metadata['Iptc.Application2.Keywords'].value,
+                         ['foo', 'bar'])
+        self.assertEqual(self.metadata['Xmp.dc.title'].value,
+                         {u'x-default': u'A title'})
+        self.assertEqual(self.metadata['Xmp.dc.subject'].value, ['a', 'b'])
+        self.assert_('Exif.Image.DateTime' not in self.metadata.exif_keys)
+        self.assert_('Xmp.dc.format' not in self.metadata.xmp_keys)
+        self.metadata.write()
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Iptc.Application2.Keywords'].value,
+                         ['foo', 'bar'])
+        self.assert_('Exif.Image.DateTime' not in other.exif_keys)
+
+    def test_update_tags(self):
+        self.metadata.read()
+        tag = IptcTag('Iptc.Application2.Caption', ['foobar'])
+        self.metadata.update([(tag.key, tag)])
+        self.assertEqual(self.metadata[tag.key].value, ['foobar'])
+        self.assertEqual(self.metadata._image._getIptcTag(tag.key)._getRawValues(),
+                         ['foobar'])
+
+    def test_update_raw_values(self):
+        # Plain values are converted without building tags, to the same raw
+        # values as the tags would have.
+        values = {'Exif.Image.Make': u'Canon',
+                  'Exif.Image.DateTime': datetime.datetime(2010, 5, 20, 9, 15),
+                  'Exif.GPSInfo.GPSDateStamp': datetime.date(2010, 5, 20),
+                  'Exif.Photo.ExposureTime': make_fraction(1, 125),
+                  'Exif.Image.BitsPerSample': [8, 8, 8],
+                  'Iptc.Application2.Keywords': ['foo', u'bar'],
+                  'Iptc.Application2.DateCreated': [datetime.date(2010, 5, 20)],
+                  'Xmp.dc.title': u'A title',
+                  'Xmp.dc.subject': ['a', 'b'],
+                  'Xmp.xmp.Rating': 3,
+                  'Xmp.tiff.Orientation': 1}
+        raw_values, families = _to_raw_values(values)
+        self.assertEqual(families, set(['exif', 'iptc', 'xmp']))
+        for key, value in values.iteritems():
+            tag_class = {'Exif': ExifTag, 'Iptc': IptcTag,
+                         'Xmp': XmpTag}[key.split('.')[0]]
+            self.assertEqual(raw_values[key], tag_class(key, value).raw_value)
+        self.assertRaises(ValueError, _to_raw_values,
+                          {'Exif.Photo.ExposureTime': 'not a rational'})
+        self.assertRaises(TypeError, _to_raw_values,
+                          {'Iptc.Application2.Keywords': 'foo'})
+
+    def test_update_is_atomic(self):
+        self.metadata.read()
+        # Invalid value
+        self.assertRaises(ValueError, self.metadata.update,
+                          {'Exif.Image.Make': 'Canon',
+                           'Exif.Photo.ExposureTime': 'not a rational'})
+        # Non repeatable tag given several values
+        self.assertRaises(KeyError, self.metadata.update,
+                          {'Exif.Image.Make': 'Canon',
+                           'Iptc.Application2.Caption': ['foo', 'bar']})
+        # Deletion of an inexistent tag
+        self.assertRaises(KeyError, self.metadata.update,
+                          {'Exif.Image.Make': 'Canon'},
+                          ['Exif.Photo.ExposureTime'])
+        # Invalid raw value, only detected by libexiv2
+        self.assertRaises(ValueError, self.metadata._image._update,
+                          {'Exif.Image.Make': 'Canon',
+                           'Exif.Photo.ExposureTime': 'foo'}, [])
+        self.assertEqual(self.metadata['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+        self.assertEqual(self.metadata['Iptc.Application2.Caption'].value,
+                         ['blabla'])
+
+    ###########################
+    # Test XMP packet writing #
+    ###########################
+
+    def _xmp_packet(self):
+        fd = open(self.pathname, 'rb')
+        data = fd.read()
+        fd.close()
+        start = data.index('<x:xmpmeta')
+        end = data.index('</x:xmpmeta>')
+        return data[start:end]
+
+    def test_unmodified_xmp_written_as_is(self):
+        packet = self._xmp_packet()
+        self.metadata.read()
+        self.assertEqual(len(self.metadata.xmp_keys), 2)
+        self.metadata['Exif.Image.Make'] = 'Canon'
+        self.metadata.write()
+        self.assertEqual(self._xmp_packet(), packet)
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+
+    def test_read_xmp_tags_written_as_is(self):
+        # Reading XMP tags doesn't flag the XMP data as modified, modifying
+        # one does.
+        packet = self._xmp_packet()
+        self.metadata.read()
+        tag = self.metadata['Xmp.dc.subject']
+        self.assertEqual(tag.value, ['image', 'test', 'pyexiv2'])
+        self.metadata['Exif.Image.Make'] = 'Canon'
+        self.metadata.write()
+        self.assertEqual(self._xmp_packet(), packet)
+        tag.value = ['a', 'b']
+        self.metadata.write()
+        self.assertNotEqual(self._xmp_packet(), packet)
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.dc.subject'].value, ['a', 'b'])
+
+    def test_modified_xmp_written(self):
+        self.metadata.read()
+        self.metadata.update({'Xmp.dc.title': u'A title'}, ['Xmp.dc.format'])
+        self.metadata.write()
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.dc.title'].value, {u'x-default': u'A title'})
+        self.assert_('Xmp.dc.format' not in other.xmp_keys)
+        other.begin()
+        del other['Xmp.dc.subject']
+        other.rollback()
+        other['Exif.Image.Make'] = 'Canon'
+        other.write()
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+
+    def test_get_xmp_packet(self):
+        self.metadata.read()
+        packet = self.metadata.get_xmp_packet()
+        self.assert_(self._xmp_packet() in packet)
+        self.metadata['Xmp.dc.format'] = ('image', 'png')
+        self.assert_('image/png' in self.metadata.get_xmp_packet())
+
+    def test_set_xmp_packet(self):
+        self.metadata.read()
+        packet = self.metadata.get_xmp_packet().replace('image/jpeg',
+                                                        'image/png')
+        self.metadata.set_xmp_packet(packet)
+        self.assertEqual(self.metadata.get_xmp_packet(), packet)
+        self.assertEqual(self.metadata['Xmp.dc.format'].value, ('image', 'png'))
+        self.metadata.write()
+        self.assert_(self._xmp_packet() in packet)
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.dc.format'].value, ('image', 'png'))
+
+    def test_set_xmp_packet_tags_bound_before(self):
+        # Tags obtained before the packet was replaced modify the new XMP
+        # data, which is then written back.
+        self.metadata.read()
+        tag = self.metadata['Xmp.dc.format']
+        tag.value = ('image', 'gif')
+        packet = self.metadata.get_xmp_packet().replace('image/gif',
+                                                        'image/png')
+        self.metadata.set_xmp_packet(packet)
+        tag.value = ('image', 'tiff')
+        self.assertEqual(self.metadata['Xmp.dc.format'].value,
+                         ('image', 'tiff'))
+        self.metadata.write()
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.dc.format'].value, ('image', 'tiff'))
+
+    def test_set_xmp_packet_check(self):
+        self.metadata.read()
+        self.failUnlessRaises(ValueError, self.metadata.set_xmp_packet,
+                              '<x:xmpmeta', True)
+        self.assertEqual(self.metadata['Xmp.dc.format'].value,
+                         ('image', 'jpeg'))
+        self.metadata.set_xmp_packet('<x:xmpmeta')
+        self.failUnlessRaises(ValueError, self.metadata.__getitem__,
+                              'Xmp.dc.format')
+        # The error is raised again, the malformed packet is not taken for an
+        # empty one.
+        self.failUnlessRaises(ValueError, self.metadata.__getitem__,
+                              'Xmp.dc.format')
+        self.failUnlessRaises(ValueError, getattr, self.metadata, 'xmp_keys')
+
+    def test_write_compact_xmp(self):
+        self.metadata.read()
+        self.metadata['Xmp.dc.title'] = {'x-default': 'A title'}
+        self.metadata.write()
+        default_size = os.path.getsize(self.pathname)
+        self.metadata.write(xmp_compact=True, xmp_rdf_attributes=True,
+                            xmp_packet_wrapper=False)
+        self.assert_(os.path.getsize(self.pathname) < default_size)
+        fd = open(self.pathname, 'rb')
+        data = fd.read()
+        fd.close()
+        self.failIf('<?xpacket' in data)
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.dc.title'].value, {'x-default': 'A title'})
+        self.assertEqual(other['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+
+    def test_write_xmp_layout_sizes(self):
+        # Measure the size of the file with each layout option alone: each
+        # one starts from libexiv2's default layout instead of replacing it.
+        self.metadata.read()
+        self.metadata['Xmp.dc.title'] = {'x-default': 'A title'}
+        self.metadata['Xmp.xmp.Rating'] = 3
+        self.metadata['Xmp.tiff.Orientation'] = 1
+        def size(**options):
+            self.metadata.write(**options)
+            return os.path.getsize(self.pathname)
+        rdf_attributes_size = size(xmp_rdf_attributes=True)
+        self.assert_(size(xmp_rdf_attributes=False) > rdf_attributes_size)
+        self.assertEqual(size(xmp_padding=0), rdf_attributes_size)
+        compact_size = size(xmp_compact=True)
+        self.assert_(compact_size < rdf_attributes_size)
+        self.assertEqual(size(xmp_compact=True, xmp_rdf_attributes=True),
+                         compact_size)
+        self.assert_(size(xmp_compact=True, xmp_rdf_attributes=False) >
+                     compact_size)
+        self.assert_(size(xmp_packet_wrapper=False) < rdf_attributes_size)
+        other = ImageMetadata(self.pathname)
+        other.read()
+        self.assertEqual(other['Xmp.xmp.Rating'].value, 3)
+
+    def test_write_xmp_padding(self):
+        self.metadata.read()
+        self.metadata.write(xmp_padding=1)
+        small_size = os.path.getsize(self.pathname)
+        self.metadata.write(xmp_padding=4096)
+        self.assert_(os.path.getsize(self.pathname) >= small_size + 4000)
+
+    #################
+    # Test sidecars #
+    #################
+
+    def _write_sidecar(self, values):
+        sidecar = ImageMetadata(self.pathname, sidecar='only')
+        sidecar.read()
+        for key, value in values.iteritems():
+            sidecar[key] = value
+        sidecar.write()
+        return sidecar_filename(self.pathname)
+
+    def test_sidecar_only(self):
+        self.assertEqual(sidecar_filename('/a/b/image.nef'), '/a/b/image.xmp')
+        self.failUnlessRaises(ValueError, ImageMetadata, self.pathname, 'foo')
+        fd = open(self.pathname, 'rb')
+        data = fd.read()
+        fd.close()
+        path = self._write_sidecar({'Xmp.dc.subject': ['sidecar']})
+        try:
+            fd = open(self.pathname, 'rb')
+            self.assertEqual(fd.read(), data)
+            fd.close()
+            metadata = ImageMetadata(self.pathname, sidecar='only')
+            metadata.read()
+            self.assertEqual(metadata.exif_keys, [])
+            self.assertEqual(metadata.xmp_keys, ['Xmp.dc.subject'])
+            metadata['Xmp.dc.subject'] = ['sidecar', 'modified']
+            metadata.write()
+            other = ImageMetadata(self.pathname, sidecar='only')
+            other.read()
+            self.assertEqual(other['Xmp.dc.subject'].value,
+                             ['sidecar', 'modified'])
+        finally:
+            os.remove(path)
+
+    def test_sidecar_precedence(self):
+        path = self._write_sidecar({'Xmp.dc.subject': ['sidecar'],
+                                    'Xmp.dc.title': {'x-default': 'Title'}})
+        try:
+            metadata = ImageMetadata(self.pathname, sidecar='prefer')
+            metadata.read()
+            self.assertEqual(metadata['Xmp.dc.subject'].value, ['sidecar'])
+            self.assertEqual(metadata['Xmp.dc.format'].value, ('image', 'jpeg'))
+            self.assertEqual(metadata['Xmp.dc.title'].value,
+                             {'x-default': 'Title'})
+            metadata = ImageMetadata(self.pathname, sidecar='fallback')
+            metadata.read()
+            self.assertEqual(metadata['Xmp.dc.subject'].value,
+                             ['image', 'test', 'pyexiv2'])
+            self.assertEqual(metadata['Xmp.dc.title'].value,
+                             {'x-default': 'Title'})
+            # Writing updates the sidecar only, the merged XMP metadata is not
+            # embedded in the image
+            metadata['Xmp.dc.subject'] = ['sidecar', 'modified']
+            metadata['Exif.Image.Make'] = 'Make'
+            metadata.write()
+            other = ImageMetadata(self.pathname, 'only')
+            other.read()
+            self.assertEqual(other['Xmp.dc.subject'].value,
+                             ['sidecar', 'modified'])
+            other = ImageMetadata(self.pathname)
+            other.read()
+            self.assertEqual(other['Xmp.dc.subject'].value,
+                             ['image', 'test', 'pyexiv2'])
+            self.failIf('Xmp.dc.title' in other.xmp_keys)
+            self.assertEqual(other['Exif.Image.Make'].value, 'Make')
+        finally:
+            os.remove(path)
+
+    def test_sidecar_preserve_timestamps(self):
+        path = self._write_sidecar({'Xmp.dc.subject': ['sidecar']})
+        try:
+            os.utime(path, (1000000000, 1000000000))
+            metadata = ImageMetadata(self.pathname, sidecar='prefer')
+            metadata.read()
+            metadata['Xmp.dc.subject'] = ['sidecar', 'modified']
+            metadata.write(preserve_timestamps=True)
+            stat = os.stat(path)
+            self.assertEqual(stat.st_mtime, 1000000000)
+            metadata.write()
+            self.assertNotEqual(os.stat(path).st_mtime, 1000000000)
+        finally:
+            os.remove(path)
+
+    def test_sidecar_from_buffer(self):
+        fd = open(self.pathname, 'rb')
+        data = fd.read()
+        fd.close()
+        metadata = ImageMetadata.from_buffer(data)
+        metadata.read()
+        self.failUnlessRaises(ValueError, metadata.write_sidecar)
+        metadata = ImageMetadata(None, sidecar='only')
+        self.failUnlessRaises(ValueError, metadata.read)
+
+    def test_write_sidecar(self):
+        self.metadata.read()
+        path = sidecar_filename(self.pathname)
+        try:
+            self.metadata.write_sidecar()
+            other = ImageMetadata(self.pathname, sidecar='only')
+            other.read()
+            self.assertEqual(other['Xmp.dc.subject'].value,
+                             ['image', 'test', 'pyexiv2'])
+        finally:
+            os.remove(path)
+
+    def test_write_sidecar_pending_packet(self):
+        # A packet set without being checked is parsed before being written.
+        self.metadata.read()
+        packet = self.metadata.get_xmp_packet().replace('image/jpeg',
+                                                        'image/png')
+        self.metadata.set_xmp_packet(packet)
+        path = sidecar_filename(self.pathname)
+        try:
+            self.metadata.write_sidecar()
+            other = ImageMetadata(self.pathname, sidecar='only')
+            other.read()
+            self.assertEqual(other['Xmp.dc.format'].value, ('image', 'png'))
+            self.assertEqual(other['Xmp.dc.subject'].value,
+                             ['image', 'test', 'pyexiv2'])
+        finally:
+            os.remove(path)
+
+    ######################
+    # Test transactions #
+    ######################
+
+    def test_rollback(self):
+        self.metadata.read()
+        self.metadata.begin()
+        self.metadata['Exif.Image.Make'] = 'Canon'
+        del self.metadata['Iptc.Application2.Caption']
+        self.metadata['Xmp.dc.title'] = {'x-default': 'A title'}
+        self.metadata.comment = 'A comment'
+        self.metadata.rollback()
+        self.assertEqual(self.metadata['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+        self.assertEqual(self.metadata['Iptc.Application2.Caption'].value,
+                         ['blabla'])
+        self.assert_('Xmp.dc.title' not in self.metadata.xmp_keys)
+        self.assertEqual(self.metadata.comment, 'Hello World!')
+
+    def test_commit(self):
+        self.metadata.read()
+        self.metadata.begin()
+        self.metadata['Exif.Image.Make'] = 'Canon'
+        self.metadata.commit()
+        self.assertEqual(self.metadata['Exif.Image.Make'].value, 'Canon')
+        self.assertRaises(RuntimeError, self.metadata.rollback)
+
+    def test_transaction_state(self):
+        self.assertRaises(IOError, self.metadata.begin)
+        self.metadata.read()
+        self.assertRaises(RuntimeError, self.metadata.commit)
+        self.assertRaises(RuntimeError, self.metadata.rollback)
+        self.metadata.begin()
+        self.assertRaises(RuntimeError, self.metadata.begin)
+        # Reading the metadata again discards the transaction
+        self.metadata.read()
+        self.assertRaises(RuntimeError, self.metadata.rollback)
+
+    #################
+    # Test cloning #
+    #################
+
+    def test_clone_not_read(self):
+        self.assertRaises(IOError, self.metadata.clone)
+
+    def test_clone(self):
+        self.metadata.read()
+        clone = self.metadata.clone()
+        self.assertEqual(clone.exif_keys, self.metadata.exif_keys)
+        self.assertEqual(clone.iptc_keys, self.metadata.iptc_keys)
+        self.assertEqual(clone.xmp_keys, self.metadata.xmp_keys)
+        self.assertEqual(clone.comment, 'Hello World!')
+        self.assertEqual(clone.dimensions, self.metadata.dimensions)
+        self.assertEqual(clone['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+
+    def test_clone_copy_on_write(self):
+        self.metadata.read()
+        clone = self.metadata.clone()
+        clone['Exif.Image.Make'] = 'Canon'
+        del clone['Iptc.Application2.Caption']
+        clone.comment = 'A comment'
+        self.assertEqual(self.metadata['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+        self.assertEqual(self.metadata['Iptc.Application2.Caption'].value,
+                         ['blabla'])
+        self.assertEqual(self.metadata.comment, 'Hello World!')
+        # And the other way around
+        other = self.metadata.clone()
+        self.metadata['Exif.Image.Make'] = 'Nikon'
+        self.assertEqual(other['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+        self.assertEqual(clone['Exif.Image.Make'].value, 'Canon')
+
+    def test_clone_reads_do_not_detach(self):
+        # Reading tags from a clone doesn't copy the metadata it shares, which
+        # reopens the image file, only modifying them does.
+        self.metadata.read()
+        clone = self.metadata.clone()
+        moved = self.pathname + '.moved'
+        os.rename(self.pathname, moved)
+        try:
+            self.assertEqual(clone['Exif.Image.Make'].value,
+                             'EASTMAN KODAK COMPANY')
+            self.assertEqual(clone['Iptc.Application2.Caption'].value,
+                             ['blabla'])
+            self.assertEqual(clone['Xmp.dc.subject'].value,
+                             ['image', 'test', 'pyexiv2'])
+            tag = clone['Exif.Image.Make']
+            self.assertRaises(IOError, setattr, tag, 'value', 'Canon')
+        finally:
+            os.rename(moved, self.pathname)
+        tag.value = 'Canon'
+        self.assertEqual(clone['Exif.Image.Make'].value, 'Canon')
+        self.assertEqual(self.metadata['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+
+    def test_clone_tags_bound_before(self):
+        # Tags obtained before cloning don't modify the clone.
+        self.metadata.read()
+        exif = self.metadata['Exif.Image.Make']
+        iptc = self.metadata['Iptc.Application2.Caption']
+        xmp = self.metadata['Xmp.dc.subject']
+        clone = self.metadata.clone()
+        exif.value = 'Canon'
+        iptc.value = ['foo']
+        xmp.value = ['a', 'b']
+        self.assertEqual(clone['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+        self.assertEqual(clone['Iptc.Application2.Caption'].value, ['blabla'])
+        self.assertEqual(clone['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+        self.assertEqual(self.metadata['Exif.Image.Make'].value, 'Canon')
+        self.assertEqual(self.metadata['Iptc.Application2.Caption'].value,
+                         ['foo'])
+        self.assertEqual(self.metadata['Xmp.dc.subject'].value, ['a', 'b'])
+
+    def test_clone_buffer(self):
+        fd = open(self.pathname, 'rb')
+        buffer = fd.read()
+        fd.close()
+        master = ImageMetadata.from_buffer(buffer)
+        master.read()
+        variants = [master.clone() for i in xrange(3)]
+        for i, variant in enumerate(variants):
+            variant['Exif.Image.Make'] = 'Make %d' % i
+            variant.write()
+        del master
+        for i, variant in enumerate(variants):
+            metadata = ImageMetadata.from_buffer(variant.buffer)
+            metadata.read()
+            self.assertEqual(metadata['Exif.Image.Make'].value, 'Make %d' % i)
+
+    ##################
+    # Test snapshots #
+    ##################
+
+    def test_snapshot(self):
+        self.metadata.read()
+        snapshot = self.metadata.snapshot()
+        self.metadata['Exif.Image.Make'] = 'Canon'
+        del self.metadata['Iptc.Application2.Caption']
+        self.metadata['Xmp.dc.title'] = {'x-default': 'A title'}
+        self.metadata.comment = 'A comment'
+        self.assertEqual(snapshot['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+        self.assertEqual(snapshot['Iptc.Application2.Caption'].value,
+                         ['blabla'])
+        self.assert_('Iptc.Application2.Caption' in snapshot.iptc_keys)
+        self.assert_('Xmp.dc.title' not in snapshot.xmp_keys)
+        self.assertEqual(snapshot.comment, 'Hello World!')
+        self.assertRaises(KeyError, snapshot.__getitem__, 'Exif.Image.Artist')
+        self.assertEqual(self.metadata['Exif.Image.Make'].value, 'Canon')
+
+    def test_snapshot_tags_bound_before(self):
+        # Tags obtained before the snapshot was taken don't modify it.
+        self.metadata.read()
+        exif = self.metadata['Exif.Image.Make']
+        iptc = self.metadata['Iptc.Application2.Caption']
+        xmp = self.metadata['Xmp.dc.subject']
+        exif.value = 'Nikon'
+        snapshot = self.metadata.snapshot()
+        exif.value = 'Canon'
+        iptc.value = ['foo']
+        xmp.value = ['a', 'b']
+        self.assertEqual(snapshot['Exif.Image.Make'].value, 'Nikon')
+        self.assertEqual(snapshot['Iptc.Application2.Caption'].value,
+                         ['blabla'])
+        self.assertEqual(snapshot['Xmp.dc.subject'].value,
+                         ['image', 'test', 'pyexiv2'])
+        self.assertEqual(self.metadata['Exif.Image.Make'].value, 'Canon')
+        self.assertEqual(self.metadata['Iptc.Application2.Caption'].value,
+                         ['foo'])
+        self.assertEqual(self.metadata['Xmp.dc.subject'].value, ['a', 'b'])
+
+    def test_snapshot_tags_are_copies(self):
+        self.metadata.read()
+        snapshot = self.metadata.snapshot()
+        tag = snapshot['Exif.Image.Make']
+        tag.value = 'Canon'
+        self.assertEqual(snapshot['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+        self.assertEqual(self.metadata['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+
+    def test_snapshot_tags_outlive_snapshot(self):
+        self.metadata.read()
+        snapshot = self.metadata.snapshot()
+        tags = [snapshot._snapshot._getExifTag('Exif.Image.Make'),
+                snapshot._snapshot._getIptcTag('Iptc.Application2.Caption'),
+                snapshot._snapshot._getXmpTag('Xmp.dc.subject')]
+        del snapshot
+        self.metadata = None
+        gc.collect()
+        self.assertEqual(tags[0]._getRawValue(), 'EASTMAN KODAK COMPANY')
+        self.assertEqual(tags[1]._getRawValues(), ['blabla'])
+        self.assertEqual(tags[2]._getArrayValue(), ['image', 'test', 'pyexiv2'])
+
+    def test_bound_tags_outlive_image(self):
+        self.metadata.read()
+        image = self.metadata._image
+        tags = [image._getExifTag('Exif.Image.Make'),
+                image._getIptcTag('Iptc.Application2.Caption'),
+                image._getXmpTag('Xmp.dc.subject')]
+        tag = ExifTag('Exif.Image.Artist', 'Me')
+        tag._tag._setParentImage(image)
+        # Restructure the metadata: the tags look their datum up again in it
+        image._readMetadata()
+        del image
+        self.metadata = None
+        gc.collect()
+        self.assertEqual(tags[0]._getRawValue(), 'EASTMAN KODAK COMPANY')
+        self.assertEqual(tags[1]._getRawValues(), ['blabla'])
+        self.assertEqual(tags[2]._getArrayValue(), ['image', 'test', 'pyexiv2'])
+        # Re-reading the metadata discarded the new tag
+        self.assertRaises(KeyError, tag._tag._getRawValue)
+
+    def test_snapshot_concurrent_readers(self):
+        self.metadata.read()
+        snapshot = self.metadata.snapshot()
+        errors = []
+        def read():
+            try:
+                for i in xrange(50):
+                    for key in snapshot:
+                        snapshot[key].raw_value
+                    if snapshot['Exif.Image.Make'].value != \
+                            'EASTMAN KODAK COMPANY':
+                        errors.append('Snapshot modified')
+            except Exception, error:
+                errors.append(error)
+        readers = [threading.Thread(target=read) for i in xrange(4)]
+        for reader in readers:
+            reader.start()
+        for i in xrange(50):
+            self.metadata['Exif.Image.Make'] = 'Make %d' % i
+        for reader in readers:
+            reader.join()
+        self.assertEqual(errors, [])
+
+    ###########################
+    # Test metadata templates #
+    ###########################
+
+    def _template(self):
+        return MetadataTemplate({'Exif.Image.Copyright': 'pyexiv2',
+                                 'Iptc.Application2.Byline': ['John Doe'],
+                                 'Xmp.dc.rights': u'All rights reserved'})
+
+    def _check_template_applied(self, metadata):
+        self.assertEqual(metadata['Exif.Image.Copyright'].value, 'pyexiv2')
+        self.assertEqual(metadata['Iptc.Application2.Byline'].value,
+                         ['John Doe'])
+        self.assertEqual(metadata['Xmp.dc.rights'].value,
+                         {u'x-default': u'All rights reserved'})
+        # Other tags are preserved
+        self.assertEqual(metadata['Exif.Image.Make'].value,
+                         'EASTMAN KODAK COMPANY')
+
+    def test_template_invalid(self):
+        self.assertRaises(KeyError, MetadataTemplate, {'Foo.Bar.Baz': 'foo'})
+        self.assertRaises(ValueError, MetadataTemplate,
+                          {'Exif.Photo.ExposureTime': 'not a rational'})
+
+    def test_template_apply(self):
+        self.metadata.read()
+        self._template().apply(self.metadata)
+        self._check_template_applied(self.metadata)
+
+    def test_template_apply_to_files(self):
+        fd, other = tempfile.mkstemp(suffix='.jpg')
+        os.write(fd, open(self.pathname, 'rb').read())
+        os.close(fd)
+        try:
+            self._template().apply_to_files([self.pathname, other], workers=2)
+            for pathname in (self.pathname, other):
+                metadata = ImageMetadata(pathname)
+                metadata.read()
+                self._check_template_applied(metadata)
+        finally:
+            os.remove(other)
+
+    def test_template_apply_to_inexistent_file(self):
+        self.assertRaises(IOError, self._template().apply_to_files,
+                          ['idontexist'])
+
+    def test_template_apply_to_files_with_errors(self):
+        # The other files are processed, the error names the file that failed.
+        try:
+            self._template().apply_to_files(['idontexist', self.pathname,
+                                             'idontexisteither'], workers=2)
+        except IOError, error:
+            self.assert_('idontexist' in str(error))
+            self.assertEqual([filename for filename, e in error.errors],
+                             ['idontexist', 'idontexisteither'])
+        else:
+            self.fail('IOError not raised')
+        self.metadata.read()
+        self._check_template_applied(self.metadata)
+
+    #################################
+    # Test the human-readable dumps #
+    #################################
+
+    def test_human_dump_text(self):
+        self.metadata.read()
+        lines = self.metadata.human_dump().splitlines()
+        keys = [line.split('\t')[0] for line in lines]
+        self.assertEqual(keys, self.metadata.exif_keys +
+                               self.metadata.iptc_keys +
+                               self.metadata.xmp_keys)
+        self.assert_('Exif.Image.Make\tManufacturer\tEASTMAN KODAK COMPANY' in lines)
+        self.assert_('Iptc.Application2.Caption\tCaption\tblabla' in lines)
+
+    def test_human_dump_json(self):
+        import json
+        self.metadata.read()
+        dump = json.loads(self.metadata.human_dump('json'))
+        self.assertEqual([tag['key'] for tag in dump],
+                         self.metadata.exif_keys + self.metadata.iptc_keys +
+                         self.metadata.xmp_keys)
+        tag = [tag for tag in dump if tag['key'] == 'Exif.Image.Make'][0]
+        self.assertEqual(tag, {'key': 'Exif.Image.Make',
+                               'label': 'Manufacturer',
+                               'value': 'EASTMAN KODAK COMPANY'})
+
+    def test_human_dump_json_invalid_utf8(self):
+        import json
+        self.metadata.read()
+        # A Latin-1 byte followed by a well-formed UTF-8 sequence
+        self.metadata['Exif.Image.Make'].raw_value = 'Caf\xe9 caf\xc3\xa9'
+        dump = json.loads(self.metadata.human_dump('json'))
+        tag = [tag for tag in dump if tag['key'] == 'Exif.Image.Make'][0]
+        self.assertEqual(tag['value'], u'Caf\xe9 caf\xe9')
+
+    def test_human_dump_output(self):
+        self.metadata.read()
+        dump = self.metadata.human_dump()
+        fd, pathname = tempfile.mkstemp()
+        try:
+            self.assertEqual(self.metadata.human_dump(output=fd), None)
+            os.close(fd)
+            self.assertEqual(open(pathname, 'rb').read(), dump)
+            output = open(pathname, 'wb')
+            self.metadata.human_dump(output=output)
+            output.close()
+            self.assertEqual(open(pathname, 'rb').read(), dump)
+        finally:
+            os.remove(pathname)
+
+    def test_human_dump_reuses_buffer(self):
+        # Successive dumps in a thread share a buffer, none of them must
+        # contain leftovers of the previous one.
+        self.metadata.read()
+        empty = ImageMetadata.from_buffer(EMPTY_JPG_DATA)
+        empty.read()
+        dump = self.metadata.human_dump('json')
+        self.assertEqual(empty.human_dump('json'), '[]')
+        self.assertEqual(empty.human_dump('text'), '')
+        self.assertEqual(self.metadata.human_dump('json'), dump)
+
+    def test_human_dump_invalid_format(self):
+        self.metadata.read()
+        self.assertRaises(ValueError, self.metadata.human_dump, 'xml')
+
+    def test_human_dump_files(self):
+        self.metadata.read()
+        fd, other = tempfile.mkstemp(suffix='.jpg')
+        os.write(fd, EMPTY_JPG_DATA)
+        os.close(fd)
+        try:
+            pathnames = [self.pathname, other, self.pathname]
+            for workers in (1, 2):
+                dumps = human_dump_files(pathnames, 'json', workers)
+                self.assertEqual(dumps, [self.metadata.human_dump('json'),
+                                         '[]',
+                                         self.metadata.human_dump('json')])
+        finally:
+            os.remove(other)
+
+    def test_human_dump_files_with_errors(self):
+        self.metadata.read()
+        for workers in (1, 2):
+            dumps = human_dump_files([self.pathname, 'idontexist',
+                                      self.pathname], 'text', workers)
+            self.assertEqual(dumps[0], self.metadata.human_dump())
+            self.assert_(isinstance(dumps[1], IOError))
+            self.assertEqual(dumps[1].filename, 'idontexist')
+            self.assertEqual(dumps[2], self.metadata.human_dump())
+
+    #######################
+    # Test the known tags #
+    #######################
+
+    def test_known_tags(self):
+        tags = dict((tag[0], tag[1:]) for tag in known_tags('exif'))
+        tag = ExifTag('Exif.Photo.ExposureTime')
+        self.assertEqual(tags[tag.key], (tag.type, tag.label, tag.description))
+        self.assert_('Exif.Image.Make' in tags)
+
+        tags = dict((tag[0], tag[1:]) for tag in known_tags('iptc'))
+        tag = IptcTag('Iptc.Application2.Caption')
+        self.assertEqual(tags[tag.key], (tag.type, tag.title, tag.description))
+        self.assert_('Iptc.Envelope.CharacterSet' in tags)
+
+        tags = dict((tag[0], tag[1:]) for tag in known_tags('xmp'))
+        tag = XmpTag('Xmp.dc.subject')
+        self.assertEqual(tags[tag.key], (tag.type, tag.title, tag.description))
+        self.assert_('Xmp.xmp.Rating' in tags)
+
+    def test_known_tags_group(self):
+        keys = [tag[0] for tag in known_tags('exif', 'GPSInfo')]
+        self.assert_('Exif.GPSInfo.GPSLatitude' in keys)
+        self.assert_(all(key.startswith('Exif.GPSInfo.') for key in keys))
+        keys = [tag[0] for tag in known_tags('iptc', 'Envelope')]
+        self.assert_('Iptc.Envelope.CharacterSet' in keys)
+        self.assert_(all(key.startswith('Iptc.Envelope.') for key in keys))
+        keys = [tag[0] for tag in known_tags('xmp', 'dc')]
+        self.assert_('Xmp.dc.subject' in keys)
+        self.assert_(all(key.startswith('Xmp.dc.') for key in keys))
+
+    def test_known_tags_cached(self):
+        self.assert_(known_tags('exif') is known_tags('EXIF'))
+        self.assert_(known_tags('xmp', 'dc') is known_tags('xmp', 'dc'))
+
+    def test_known_tags_custom_namespace(self):
+        self.assertRaises(KeyError, known_tags, 'xmp', 'knowntags')
+        register_namespace('http://example.com/knowntags/', 'knowntags')
+        try:
+            self.assertEqual(known_tags('xmp', 'knowntags'), ())
+        finally:
+            unregister_namespace('http://example.com/knowntags/')
+        self.assertRaises(KeyError, known_tags, 'xmp', 'knowntags')
+
+    def test_known_tags_invalid(self):
+        self.assertRaises(ValueError, known_tags, 'makernote')
+        self.assertRaises(KeyError, known_tags, 'exif', 'idontexist')
+        self.assertRaises(KeyError, known_tags, 'iptc', 'idontexist')
+        self.assertRaises(KeyError, known_tags, 'xmp', 'idontexist')
+
     ###########################
     # Test the EXIF thumbnail #
     ###########################
@@ -793,6 +1683,19 @@ class TestImageMetadata(unittest.TestCase):
         self.metadata['Iptc.Application2.City'] = [u'Córdoba']
         self.assertEqual(self.metadata.iptc_charset, 'utf-8')
 
+    def test_legacy_iptc_values_round_trip(self):
+        # Values decoded from Latin-1, for lack of a charset, are encoded back
+        # into Latin-1 when the list of values is modified.
+        self.metadata.read()
+        self.metadata['Iptc.Application2.Keywords'] = ['keyword']
+        tag = self.metadata['Iptc.Application2.Keywords']
+        tag.raw_value = ['Caf\xe9']
+        self.assertEqual(self.metadata.iptc_charset, None)
+        self.assertEqual(tag.value, [u'Caf\xe9'])
+        tag.value.append(u'Cr\xe8me')
+        self.assertEqual(tag.raw_value, ['Caf\xe9', 'Cr\xe8me'])
+        self.assertEqual(tag.value, [u'Caf\xe9', u'Cr\xe8me'])
+
     def test_set_iptc_charset_utf8(self):
         self.metadata.read()
         self.assert_('Iptc.Envelope.CharacterSet' not in self.metadata.iptc_keys)
@@ -845,3 +1748,37 @@ class TestImageMetadata(unittest.TestCase):
         self.assertEqual(self.metadata.iptc_charset, 'ascii')
         self.assert_(key not in self.metadata.iptc_keys)
 
+    def test_iptc_charset_invalidated(self):
+        self.metadata.read()
+        key = 'Iptc.Application2.City'
+        self.assertEqual(self.metadata.iptc_charset, 'ascii')
+        # Editing a tag bound to the image invalidates the cached charset.
+        self.metadata[key] = ['Cordoba']
+        tag = self.metadata[key]
+        tag.raw_value = ['C\xc3\xb3rdoba']
+        self.assertEqual(self.metadata.iptc_charset, 'utf-8')
+        del self.metadata[key]
+        self.assertEqual(self.metadata.iptc_charset, 'ascii')
+
+    def test_iptc_string_values_decoded(self):
+        self.metadata.read()
+        key = 'Iptc.Application2.City'
+        self.metadata[key] = IptcTag(key, [u'Córdoba'])
+        self.metadata._tags['iptc'] = {}
+        value = self.metadata[key].value
+        self.assertEqual(value, [u'Córdoba'])
+        self.assert_(isinstance(value[0], unicode))
+
+        # Without any charset information, non UTF-8 data is decoded as
+        # Latin-1.
+        self.metadata[key].raw_value = ['C\xf3rdoba']
+        self.metadata._tags['iptc'] = {}
+        self.assertEqual(self.metadata.iptc_charset, None)
+        self.assertEqual(self.metadata[key].value, [u'Córdoba'])
+
+        # The charset declared in the data prevails.
+        self.metadata.iptc_charset = 'utf-8'
+        self.metadata[key].raw_value = ['C\xc3\xb3rdoba']
+        self.metadata._tags['iptc'] = {}
+        self.assertEqual(self.metadata[key].value, [u'Córdoba'])
+
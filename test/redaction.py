@@ -0,0 +1,175 @@
+# -*- coding: utf-8 -*-
+
+# ******************************************************************************
+#
+# Copyright (C) 2012 Olivier Tilloy <olivier@tilloy.net>
+#
+# This file is part of the pyexiv2 distribution.
+#
+# pyexiv2 is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# pyexiv2 is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with pyexiv2; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, 5th Floor, Boston, MA 02110-1301 USA.
+#
+# Author: Olivier Tilloy <olivier@tilloy.net>
+#
+# ******************************************************************************
+
+from pyexiv2.metadata import ImageMetadata
+from pyexiv2.redaction import RedactionPolicy, redact_buffer, redact_files
+from pyexiv2.utils import make_fraction
+from pyexiv2.xmp import register_namespace, unregister_namespace
+
+import os
+import tempfile
+import unittest
+from testutils import EMPTY_JPG_DATA
+
+
+class TestRedaction(unittest.TestCase):
+
+    def setUp(self):
+        # Create an empty image file
+        fd, self.pathname = tempfile.mkstemp(suffix='.jpg')
+        os.write(fd, EMPTY_JPG_DATA)
+        os.close(fd)
+        # Write some metadata
+        m = ImageMetadata(self.pathname)
+        m.read()
+        m['Exif.Image.Make'] = 'EASTMAN KODAK COMPANY'
+        m['Exif.GPSInfo.GPSLatitudeRef'] = 'N'
+        m['Exif.GPSInfo.GPSLatitude'] = [make_fraction(48, 1),
+                                         make_fraction(51, 1),
+                                         make_fraction(29, 1)]
+        m['Exif.Photo.BodySerialNumber'] = '0123456789'
+        m['Iptc.Application2.Caption'] = ['blabla']
+        m['Iptc.Application2.City'] = ['Paris']
+        m['Xmp.dc.subject'] = ['image', 'test', 'pyexiv2']
+        m['Xmp.photoshop.City'] = 'Paris'
+        m.write()
+
+    def tearDown(self):
+        os.remove(self.pathname)
+
+    def _read(self):
+        metadata = ImageMetadata(self.pathname)
+        metadata.read()
+        return metadata
+
+    def test_default_policy(self):
+        metadata = self._read()
+        self.assertEqual(metadata['Exif.Photo.BodySerialNumber'].value,
+                         '0123456789')
+        keys = RedactionPolicy().apply(metadata)
+        self.assertEqual(sorted(keys),
+                         ['Exif.GPSInfo.GPSLatitude',
+                          'Exif.GPSInfo.GPSLatitudeRef',
+                          'Exif.Photo.BodySerialNumber',
+                          'Iptc.Application2.City',
+                          'Xmp.photoshop.City'])
+        # The cache was flushed
+        self.failIf('Exif.Photo.BodySerialNumber' in metadata.exif_keys)
+        self.assert_('Exif.Image.Make' in metadata.exif_keys)
+        self.assertEqual(metadata.iptc_keys, ['Iptc.Application2.Caption'])
+        self.assertEqual(metadata.xmp_keys, ['Xmp.dc.subject'])
+        metadata.write()
+        metadata = self._read()
+        for key in keys:
+            self.failIf(key in metadata)
+        self.assert_('Exif.Image.Make' in metadata.exif_keys)
+
+    def test_patterns(self):
+        metadata = self._read()
+        policy = RedactionPolicy(['Exif.Image.?ake', 'Xmp.*'])
+        self.assertEqual(sorted(policy.apply(metadata)),
+                         ['Exif.Image.Make', 'Xmp.dc.subject',
+                          'Xmp.photoshop.City'])
+        # Nothing left to remove
+        self.assertEqual(policy.apply(metadata), [])
+
+    def test_namespaces(self):
+        metadata = self._read()
+        policy = RedactionPolicy([], ['http://ns.adobe.com/photoshop/1.0/'])
+        self.assertEqual(policy.apply(metadata), ['Xmp.photoshop.City'])
+        self.assertEqual(metadata.xmp_keys, ['Xmp.dc.subject'])
+
+    def test_unknown_namespace(self):
+        self.assertRaises(KeyError, RedactionPolicy, [],
+                          ['http://example.com/idontexist/'])
+
+    def test_in_place(self):
+        metadata = self._read()
+        policy = RedactionPolicy(['Exif.GPSInfo.GPSLatitude'], in_place=True)
+        self.assertEqual(policy.apply(metadata), ['Exif.GPSInfo.GPSLatitude'])
+        tag = metadata['Exif.GPSInfo.GPSLatitude']
+        self.assertEqual(tag.value, [make_fraction(0, 1)] * 3)
+        fd = open(self.pathname, 'rb')
+        data = fd.read()
+        fd.close()
+        metadata.write()
+        fd = open(self.pathname, 'rb')
+        patched = fd.read()
+        fd.close()
+        # The EXIF data was patched in place: only the bytes of the three
+        # numerators changed.
+        self.assertEqual(len(patched), len(data))
+        changed = [i for i in xrange(len(data)) if data[i] != patched[i]]
+        self.assert_(0 < len(changed) <= 3 * 4)
+        self.assertEqual(self._read()['Exif.GPSInfo.GPSLatitude'].value,
+                         [make_fraction(0, 1)] * 3)
+
+    def test_namespaces_resolved_when_applied(self):
+        name = 'http://example.com/redaction/'
+        register_namespace(name, 'redactiona')
+        try:
+            policy = RedactionPolicy([], [name])
+            unregister_namespace(name)
+            register_namespace(name, 'redactionb')
+            metadata = self._read()
+            metadata['Xmp.redactionb.Secret'] = 'secret'
+            self.assertEqual(policy.apply(metadata), ['Xmp.redactionb.Secret'])
+        finally:
+            unregister_namespace(name)
+
+    def test_redact_buffer(self):
+        fd = open(self.pathname, 'rb')
+        data = fd.read()
+        fd.close()
+        policy = RedactionPolicy(['Exif.GPSInfo.*'])
+        buffer, keys = redact_buffer(policy, data)
+        self.assertEqual(len(keys), 2)
+        self.failIfEqual(buffer, data)
+        metadata = ImageMetadata.from_buffer(buffer)
+        metadata.read()
+        self.failIf('Exif.GPSInfo.GPSLatitude' in metadata.exif_keys)
+        self.assert_('Exif.Photo.BodySerialNumber' in metadata.exif_keys)
+        # Nothing to remove, the buffer is returned untouched
+        self.assertEqual(redact_buffer(policy, buffer), (buffer, []))
+
+    def test_redact_files(self):
+        fd, other = tempfile.mkstemp(suffix='.jpg')
+        os.write(fd, EMPTY_JPG_DATA)
+        os.close(fd)
+        try:
+            result = redact_files(RedactionPolicy(), [self.pathname, other],
+                                  workers=2)
+            self.assertEqual(len(result[self.pathname]), 5)
+            self.assertEqual(result[other], [])
+        finally:
+            os.remove(other)
+        self.failIf('Exif.Photo.BodySerialNumber' in self._read().exif_keys)
+
+    def test_redact_files_with_errors(self):
+        result = redact_files(RedactionPolicy(), ['idontexist', self.pathname],
+                              workers=2)
+        self.assert_(isinstance(result['idontexist'], IOError))
+        self.assertEqual(len(result[self.pathname]), 5)
@@ -25,6 +25,7 @@
 # ******************************************************************************
 
 from pyexiv2.metadata import ImageMetadata
+from pyexiv2.exif import ExifTag
 
 import unittest
 import testutils
@@ -109,6 +110,20 @@ class TestUserCommentReadWrite(unittest.TestCase):
         self.assertEqual(tag.raw_value, 'charset="Unicode" %s' % self._expected_raw_value('mm', 'DÉJÀ VU'))
         self.assertEqual(tag.value, u'DÉJÀ VU')
 
+    def test_write_undecodable_bytes(self):
+        m = self._read_image('usercomment-ascii.jpg')
+        tag = m['Exif.Photo.UserComment']
+        tag.value = '\xe9t\xe9'
+        self.assertEqual(tag.raw_value, '\xe9t\xe9')
+        self.assertEqual(tag._tag._getComment(), '\xe9t\xe9')
+
+    def test_read_no_value(self):
+        tag = ExifTag('Exif.Photo.UserComment')
+        self.assertEqual(tag._tag._getComment(), None)
+        tag.value = u'déjà vu'
+        self.assertEqual(tag.raw_value, 'déjà vu')
+        self.assertEqual(tag._tag._getComment(), u'déjà vu')
+
 
 class TestUserCommentAdd(unittest.TestCase):
 
@@ -32,6 +32,7 @@ from pyexiv2.utils import FixedOffset, make_fraction
 from pyexiv2.metadata import ImageMetadata
 
 import datetime
+import threading
 from testutils import EMPTY_JPG_DATA
 
 # Optional dependency on python-tz, more tests can be run if it is installed
@@ -387,6 +388,26 @@ class TestXmpTag(unittest.TestCase):
         tag.value = 'bleh'
         self.failUnlessEqual(tag.value, {'x-default': 'bleh'})
 
+    def test_lang_alt_item(self):
+        tag = XmpTag('Xmp.dc.title', {u'x-default': u'Title',
+                                      u'fr-FR': u'Titre'})
+        self.failUnlessEqual(tag.get_lang_alt_item('fr-FR'), u'Titre')
+        self.failUnlessEqual(tag.get_lang_alt_item('de-DE'), u'Title')
+        self.failUnlessRaises(KeyError, tag.get_lang_alt_item, 'de-DE', None)
+        tag.set_lang_alt_item('de-DE', u'Titel')
+        self.failUnlessEqual(tag.get_lang_alt_item('de-DE', None), u'Titel')
+        self.failUnlessEqual(tag.value, {u'x-default': u'Title',
+                                         u'fr-FR': u'Titre',
+                                         u'de-DE': u'Titel'})
+        tag = XmpTag('Xmp.dc.description')
+        self.failUnlessRaises(KeyError, tag.get_lang_alt_item, 'x-default')
+        tag.set_lang_alt_item('x-default', u'Description')
+        self.failUnlessEqual(tag.value, {u'x-default': u'Description'})
+        tag = XmpTag('Xmp.dc.format')
+        self.failUnlessRaises(TypeError, tag.get_lang_alt_item, 'x-default')
+        self.failUnlessRaises(TypeError, tag.set_lang_alt_item, 'x-default',
+                              u'bleh')
+
 
 class TestXmpNamespaces(unittest.TestCase):
 
@@ -467,6 +488,23 @@ class TestXmpNamespaces(unittest.TestCase):
         unregister_namespace(name)
         self.assertRaises(KeyError, self.metadata.write)
 
+    def test_unregister_invalidates_cached_properties(self):
+        name = 'bluh/'
+        prefix = 'blx'
+        key = 'Xmp.%s.foo' % prefix
+        register_namespace(name, prefix)
+        tag = XmpTag(key, 'foobar')
+        type = tag.type
+        unregister_namespace(name)
+        self.assertRaises(KeyError, XmpTag, key, 'foobar')
+        # Existing tags keep the details resolved when they were built
+        self.assertEqual(tag.type, type)
+        self.assertEqual(tag.value, 'foobar')
+        # The standard properties are still resolved
+        tag = XmpTag('Xmp.dc.format', 'image/jpeg')
+        self.assertEqual(tag.type, 'MIMEType')
+        self.assertEqual(tag.title, 'Format')
+
     def test_unregister_all_ns(self):
         # Unregistering all custom namespaces will always succeed, even if there
         # are no custom namespaces registered.
@@ -484,3 +522,30 @@ class TestXmpNamespaces(unittest.TestCase):
         self.assertRaises(KeyError, self.metadata.__setitem__, 'Xmp.%s.baz' % prefix, 'foobaz')
         self.assertRaises(KeyError, self.metadata.__setitem__, 'Xmp.%s.baz' % prefix2, 'foobaz')
 
+
+    def test_register_while_reading(self):
+        # Registering namespaces while other threads parse XMP packets.
+        self.metadata['Xmp.dc.subject'] = ['foo', 'bar']
+        self.metadata['Xmp.dc.title'] = {'x-default': 'foobar'}
+        self.metadata.write()
+        buffer = self.metadata.buffer
+        errors = []
+        def read():
+            try:
+                for i in xrange(100):
+                    metadata = ImageMetadata.from_buffer(buffer)
+                    metadata.read()
+                    self.assertEqual(metadata['Xmp.dc.subject'].value,
+                                     ['foo', 'bar'])
+                    metadata.write()
+            except Exception, error:
+                errors.append(error)
+        readers = [threading.Thread(target=read) for i in xrange(4)]
+        for reader in readers:
+            reader.start()
+        for i in xrange(100):
+            register_namespace('threads%d/' % i, 'thr%d' % i)
+            unregister_namespace('threads%d/' % i)
+        for reader in readers:
+            reader.join()
+        self.assertEqual(errors, [])